@@ -0,0 +1,25 @@
+#ifndef __ARRAY_REF_H__
+#define __ARRAY_REF_H__
+
+#include <cstddef>
+#include <vector>
+
+// A read-only view of a contiguous array. The array is owned elsewhere:
+// either by a vector that the view is built from, or by a mapped file.
+template<class T>
+struct ArrayRef {
+  const T *Data;
+  size_t Size;
+
+  ArrayRef() : Data(nullptr), Size(0) {}
+  ArrayRef(const T *Data, size_t Size) : Data(Data), Size(Size) {}
+  ArrayRef(const std::vector<T> &V) : Data(V.data()), Size(V.size()) {}
+
+  size_t size() const { return Size; }
+  bool empty() const { return !Size; }
+  const T *begin() const { return Data; }
+  const T *end() const { return Data + Size; }
+  const T &operator[](size_t I) const { return Data[I]; }
+};
+
+#endif
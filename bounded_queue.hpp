@@ -0,0 +1,59 @@
+#ifndef __BOUNDED_QUEUE_H__
+#define __BOUNDED_QUEUE_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// A FIFO queue between the threads of a pipeline. Push blocks while the queue
+// is full, so a fast producer cannot run ahead of a slow consumer by more
+// than Capacity elements.
+template<class T>
+class BoundedQueue {
+  size_t Capacity;
+  std::deque<T> Elems;
+  bool Closed = false;
+  std::mutex Lock;
+  std::condition_variable NotFull;
+  std::condition_variable NotEmpty;
+
+public:
+  explicit BoundedQueue(size_t Capacity) : Capacity(Capacity ? Capacity : 1) {}
+
+  // Append Elem, waiting for space. Returns false, dropping Elem, if the
+  // queue is closed.
+  bool Push(T &&Elem) {
+    std::unique_lock<std::mutex> Guard(Lock);
+    NotFull.wait(Guard, [&] { return Closed || Elems.size() < Capacity; });
+    if (Closed)
+      return false;
+    Elems.push_back(std::move(Elem));
+    NotEmpty.notify_one();
+    return true;
+  }
+
+  // Take the first element, waiting for one. Returns false once the queue is
+  // closed and drained.
+  bool Pop(T &Elem) {
+    std::unique_lock<std::mutex> Guard(Lock);
+    NotEmpty.wait(Guard, [&] { return Closed || !Elems.empty(); });
+    if (Elems.empty())
+      return false;
+    Elem = std::move(Elems.front());
+    Elems.pop_front();
+    NotFull.notify_one();
+    return true;
+  }
+
+  // No more elements are pushed. The elements already in the queue can still
+  // be popped.
+  void Close() {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Closed = true;
+    NotFull.notify_all();
+    NotEmpty.notify_all();
+  }
+};
+
+#endif
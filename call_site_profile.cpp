@@ -0,0 +1,97 @@
+#include "call_site_profile.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char Magic[8] = {'S', 'T', 'P', 'R', 'O', 'F', 'I', 'L'};
+
+// The file is the header followed by NumEntries records. All in host byte
+// order.
+struct Header {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Reserved;
+  uint64_t NumEntries;
+};
+
+struct CountRecord {
+  uint64_t CalleePc;
+  uint64_t CallSitePc;
+  uint64_t Count;
+};
+
+} // namespace
+
+void CallSiteProfile::Record(uint64_t EntryPc, const StackTrace &ST,
+                             const SymbolTable &Symbols) {
+  // The first frame calls the entry function, and each following frame calls
+  // the function containing the previous one.
+  uint64_t CalleePc = EntryPc;
+  for (uint64_t CallSitePc : ST) {
+    Counts[Key{CalleePc, CallSitePc}]++;
+    if (!Symbols.CallerOf(CallSitePc, CalleePc))
+      break;
+  }
+}
+
+std::unordered_map<uint64_t, uint64_t>
+CallSiteProfile::CallSiteCounts() const {
+  std::unordered_map<uint64_t, uint64_t> Res;
+  for (const auto &El : Counts)
+    Res[El.first.CallSitePc] += El.second;
+  return Res;
+}
+
+bool CallSiteProfile::Load(const std::string &Path, std::string &Err) {
+  std::ifstream In(Path, std::ios::binary);
+  if (!In) {
+    Err = "cannot open " + Path + ": " + strerror(errno);
+    return false;
+  }
+  Header H;
+  if (!In.read((char*)&H, sizeof(H)) ||
+      memcmp(H.Magic, Magic, sizeof(Magic))) {
+    Err = Path + " is not a call site profile";
+    return false;
+  }
+  if (H.Version != Version) {
+    Err = Path + " has version " + std::to_string(H.Version) +
+          ", expected " + std::to_string(Version);
+    return false;
+  }
+  for (uint64_t I = 0; I < H.NumEntries; I++) {
+    CountRecord Rec;
+    if (!In.read((char*)&Rec, sizeof(Rec))) {
+      Err = Path + " is truncated or corrupted";
+      return false;
+    }
+    Counts[Key{Rec.CalleePc, Rec.CallSitePc}] += Rec.Count;
+  }
+  return true;
+}
+
+bool CallSiteProfile::Save(const std::string &Path, std::string &Err) const {
+  std::ofstream Out(Path, std::ios::binary | std::ios::trunc);
+  if (!Out) {
+    Err = "cannot create " + Path + ": " + strerror(errno);
+    return false;
+  }
+  Header H;
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.NumEntries = Counts.size();
+  Out.write((const char*)&H, sizeof(H));
+  for (const auto &El : Counts) {
+    CountRecord Rec = {El.first.CalleePc, El.first.CallSitePc, El.second};
+    Out.write((const char*)&Rec, sizeof(Rec));
+  }
+  if (!Out.flush()) {
+    Err = "cannot write " + Path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,68 @@
+#ifndef __CALL_SITE_PROFILE_H__
+#define __CALL_SITE_PROFILE_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "search.hpp"
+#include "symtab.hpp"
+
+// How often each edge of the reverse call graph appeared on the stack traces
+// reconstructed so far, so that the graphs can order the callers of each
+// function hottest first (see ReorderCallers of the layouts). The search then
+// tries the call sites of the typical stack traces before the rest, and
+// reaches them sooner. An edge is keyed by the called function and the call
+// site, as an indirect call site calls many functions.
+//
+// The profile can be saved to a file and loaded in later runs. The counts
+// are keyed by pcs, so a profile stays valid for any layout and numbering of
+// the same binary, and the edges that are not in the graph are ignored.
+class CallSiteProfile {
+public:
+  // Incremented on any change to the file layout.
+  static const uint32_t Version = 1;
+
+  // Count the edges of a stack trace reconstructed from the entry function.
+  // Not thread-safe.
+  void Record(uint64_t EntryPc, const StackTrace &ST,
+              const SymbolTable &Symbols);
+
+  // Times the call site was seen calling the function.
+  uint64_t Count(uint64_t CalleePc, uint64_t CallSitePc) const {
+    auto It = Counts.find(Key{CalleePc, CallSitePc});
+    return It == Counts.end() ? 0 : It->second;
+  }
+
+  // Times each call site was seen, calling any function.
+  std::unordered_map<uint64_t, uint64_t> CallSiteCounts() const;
+
+  // Add the counts in the file at Path. Returns false and sets Err if it is
+  // not a profile.
+  bool Load(const std::string &Path, std::string &Err);
+
+  // Write all counts to Path. Returns false and sets Err on failure.
+  bool Save(const std::string &Path, std::string &Err) const;
+
+  size_t size() const { return Counts.size(); }
+  bool empty() const { return Counts.empty(); }
+
+private:
+  struct Key {
+    uint64_t CalleePc;
+    uint64_t CallSitePc;
+
+    bool operator==(const Key &Other) const {
+      return CalleePc == Other.CalleePc && CallSitePc == Other.CallSitePc;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &K) const {
+      return (K.CalleePc * 0x9e3779b97f4a7c15ull) ^ K.CallSitePc;
+    }
+  };
+
+  std::unordered_map<Key, uint64_t, KeyHash> Counts;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __CALLER_RANGES_H__
+#define __CALLER_RANGES_H__
+
+// The callers of a function in the reverse call graphs are ranges of call
+// sites: the direct call sites calling it, then the buckets of indirect call
+// sites that may call it, which are shared by all functions of the same type
+// instead of copied into each. PosT is the position of a call site in the
+// layout, e.g., an index or a pointer to the node.
+//
+// The buckets of a function are a list of ranges ended by an empty range.
+// The other ranges are never empty, so that stepping over the end of a range
+// moves to the first call site of the next one at once.
+template<class PosT>
+struct CallerRange {
+  PosT Begin;
+  PosT End;
+
+  // The list of the functions that no bucket may call.
+  static const CallerRange NoBuckets[1];
+};
+
+template<class PosT>
+const CallerRange<PosT> CallerRange<PosT>::NoBuckets[1] = {{PosT(), PosT()}};
+
+// Position in the callers of a function, walking the ranges in turn: the
+// call site, the end of its range, and the buckets left after it. Stepping
+// over the end of a range moves to the next one, so the position is only at
+// the end of its range past the last call site. Comparing to the end is then
+// the same test as the one of the step, and the walk costs one comparison
+// per call site as a single array does.
+template<class PosT>
+struct CallerIterator {
+  PosT Pos;
+  PosT RangeEnd;
+  const CallerRange<PosT> *NextRange;
+
+  // The first call site of the first range, e.g., the direct call sites,
+  // then of the buckets.
+  static CallerIterator Begin(PosT FirstBegin, PosT FirstEnd,
+                              const CallerRange<PosT> *Buckets) {
+    CallerIterator It = {FirstBegin, FirstEnd, Buckets};
+    if (FirstBegin == FirstEnd)
+      It.EnterNextRange();
+    return It;
+  }
+  // Past the last call site.
+  static CallerIterator End() { return {PosT(), PosT(), nullptr}; }
+
+  bool AtEnd() const { return Pos == RangeEnd; }
+
+  CallerIterator &operator++() {
+    if (++Pos == RangeEnd)
+      EnterNextRange();
+    return *this;
+  }
+  bool operator==(const CallerIterator &Other) const {
+    if (AtEnd() || Other.AtEnd())
+      return AtEnd() == Other.AtEnd();
+    return Pos == Other.Pos;
+  }
+  bool operator!=(const CallerIterator &Other) const {
+    return !(*this == Other);
+  }
+
+private:
+  // Past the last bucket, this enters the empty range ending the list.
+  void EnterNextRange() {
+    Pos = NextRange->Begin;
+    RangeEnd = NextRange->End;
+    ++NextRange;
+  }
+};
+
+#endif
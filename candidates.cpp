@@ -0,0 +1,70 @@
+#include "candidates.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+uint64_t Fingerprint(const uint64_t *Frames, size_t Depth) {
+  uint64_t Res = Depth;
+  for (size_t I = 0; I < Depth; I++) {
+    Res = (Res ^ Frames[I]) * 0x9e3779b97f4a7c15ull;
+    Res ^= Res >> 31;
+  }
+  return Res;
+}
+
+} // namespace
+
+CandidateSet::CandidateSet(size_t MaxCandidates)
+  : MaxCandidates(std::max<size_t>(MaxCandidates, 1)), Truncated(false),
+    Matches(0) {}
+
+void CandidateSet::Clear() {
+  Pool.clear();
+  Candidates.clear();
+  Truncated = false;
+  Matches = 0;
+}
+
+bool CandidateSet::Add(const uint64_t *Frames, size_t Depth) {
+  Matches++;
+  // Matches are rare, hence the set is small when they are found and a scan
+  // is cheaper than keeping an index.
+  uint64_t Fp = Fingerprint(Frames, Depth);
+  for (const Candidate &C : Candidates)
+    if (C.Fingerprint == Fp && C.Depth == Depth &&
+        !memcmp(Pool.data() + C.Offset, Frames, Depth * sizeof(uint64_t)))
+      return true;
+  if (Candidates.size() == MaxCandidates) {
+    Truncated = true;
+    return false;
+  }
+  Candidates.push_back({(uint32_t)Pool.size(), (uint32_t)Depth, Fp, 0});
+  Pool.insert(Pool.end(), Frames, Frames + Depth);
+  return true;
+}
+
+void CandidateSet::Rank(uint64_t EntryPc, const CallSiteProfile *Profile,
+                        const SymbolTable &Symbols) {
+  for (Candidate &C : Candidates) {
+    if (!Profile) {
+      C.Score = -(double)C.Depth;
+      continue;
+    }
+    // The first frame calls the entry function, and each following frame
+    // calls the function containing the previous one.
+    C.Score = 0;
+    uint64_t CalleePc = EntryPc;
+    for (uint64_t CallSitePc : Frames(C)) {
+      C.Score += std::log2(1.0 + Profile->Count(CalleePc, CallSitePc));
+      if (!Symbols.CallerOf(CallSitePc, CalleePc))
+        break;
+    }
+  }
+  std::stable_sort(Candidates.begin(), Candidates.end(),
+                   [](const Candidate &A, const Candidate &B) {
+                     return A.Score > B.Score;
+                   });
+}
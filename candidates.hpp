@@ -0,0 +1,71 @@
+#ifndef __CANDIDATES_H__
+#define __CANDIDATES_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "array_ref.hpp"
+#include "call_site_profile.hpp"
+#include "symtab.hpp"
+
+// The stack traces matching a compressed form, as found by a search that
+// enumerates all of them instead of taking the first (see the Candidates of
+// MultiQuerySearch::Query). Without the stack trace that was compressed, each
+// of them may be the one, and there are more than one on a hash collision
+// that the verifier did not reject.
+//
+// The frames of all candidates are kept in a single pool, so that adding a
+// candidate during the search copies its frames once and allocates nothing
+// once the pool has grown. The same frames reached by different paths, e.g.,
+// through a call site listed twice for a function, are a single candidate.
+class CandidateSet {
+public:
+  struct Candidate {
+    uint32_t Offset;      //< Of the frames in the pool.
+    uint32_t Depth;       //< Number of frames.
+    uint64_t Fingerprint; //< Of the frames, to find the duplicates.
+    double Score;         //< Set by Rank, higher first.
+  };
+
+  // Keep at most MaxCandidates (at least 1) candidates.
+  explicit CandidateSet(size_t MaxCandidates);
+
+  void Clear();
+
+  // Add the stack trace unless it is a candidate already. Returns false once
+  // a candidate beyond MaxCandidates is found, which is dropped: then the set
+  // is truncated, and the search may stop looking for more.
+  bool Add(const uint64_t *Frames, size_t Depth);
+
+  // Whether there were more candidates than kept. If not, the set has all
+  // stack traces matching the compressed form.
+  bool IsTruncated() const { return Truncated; }
+
+  // Matches added, including the duplicates and the one dropped.
+  uint64_t NumMatches() const { return Matches; }
+
+  // Order the candidates from the most likely. With a profile, the score of
+  // a candidate is the sum of log2(1 + count) of its edges, so that the
+  // stack traces taking the call sites seen most on the reconstructed ones,
+  // and none never seen, come first. Without, the shallower ones come first.
+  // Ties keep the order they were found in.
+  void Rank(uint64_t EntryPc, const CallSiteProfile *Profile,
+            const SymbolTable &Symbols);
+
+  size_t size() const { return Candidates.size(); }
+  bool empty() const { return Candidates.empty(); }
+  const Candidate &operator[](size_t I) const { return Candidates[I]; }
+  ArrayRef<uint64_t> Frames(const Candidate &C) const {
+    return ArrayRef<uint64_t>(Pool.data() + C.Offset, C.Depth);
+  }
+
+private:
+  size_t MaxCandidates;
+  std::vector<uint64_t> Pool;
+  std::vector<Candidate> Candidates;
+  bool Truncated;
+  uint64_t Matches;
+};
+
+#endif
@@ -1,19 +1,36 @@
 #include "cg.hpp"  
+#include "memory_usage.hpp"
+#include "scan.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
-#include <sstream>
+#include <iterator>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <tuple>
 #include <string>
 
+// Note the bytes of a structure once it is complete.
+template<class T>
+void CallGraph::Built(const char *Name, const T &Structure) {
+  if (MeasureMemory)
+    StructureBytes.emplace_back(Name, HeapBytes(Structure));
+}
+
+// Free a structure that is not used anymore, in the low-memory mode.
+template<class T>
+void CallGraph::Release(T &Structure) {
+  if (LowMemory)
+    T().swap(Structure);
+}
+
 // Get targets to callers mapping. This is an intermediate state from raw call
 // graph to reverse call graph. Filtering is done at this step.
 // The mapping is inclusive of all functions, i.e., a key exist even if a
@@ -21,22 +38,38 @@
 void CallGraph::UpdateTargetToCallers(const CallGraphFilter& F) {
   auto Filter = F; //< Filter may be updated.
 
+  // The functions in the order of the map, split in chunks between the
+  // threads. The results of the chunks are used in this order.
+  std::vector<const std::pair<const uint64_t, std::string>*> Funcs;
+  Funcs.reserve(FuncAddrToName.size());
+  for (const auto &El : FuncAddrToName)
+    Funcs.push_back(&El);
+  size_t NumFuncChunks = NumChunks(Pool, Funcs.size());
+
   // Transform function name filters to function pc filters.
   if (Filter.ExcludeFuncsWithKeywordInName.size()) {
-    for (const auto &El : FuncAddrToName) {
-      uint64_t FuncPc = El.first;
-      const auto &FuncName = El.second;
+    std::vector<std::vector<uint64_t>> Matching(NumFuncChunks);
+    ForEachChunk(Pool, Funcs.size(), NumFuncChunks,
+                 [&](size_t C, size_t Begin, size_t End) {
+      for (size_t I = Begin; I < End; I++) {
+        uint64_t FuncPc = Funcs[I]->first;
+        const auto &FuncName = Funcs[I]->second;
 
-      for (const auto &Keyword : Filter.ExcludeFuncsWithKeywordInName)
-        if (FuncName.find(Keyword) != std::string::npos)
-            Filter.ExcludeFuncs.insert(FuncPc);
-    }
+        for (const auto &Keyword : Filter.ExcludeFuncsWithKeywordInName)
+          if (FuncName.find(Keyword) != std::string::npos)
+            Matching[C].push_back(FuncPc);
+      }
+    });
+    for (const auto &FuncPcs : Matching)
+      Filter.ExcludeFuncs.insert(FuncPcs.begin(), FuncPcs.end());
   }
 
+  // Only looks up, so that it can be called from many threads.
   auto ShouldExcludeFunc = [&](uint64_t FuncPc) -> bool {
     // Don't exclude if it is specifically asked for.
-    if (FuncAddrToName.count(FuncPc)) {
-      auto FuncName = FuncAddrToName[FuncPc];
+    auto NameIt = FuncAddrToName.find(FuncPc);
+    if (NameIt != FuncAddrToName.end()) {
+      const auto &FuncName = NameIt->second;
       for (const auto &FName : Filter.IncludeCallsToFunctionsWithName) {
         if (FuncName == FName)
           return false;
@@ -77,232 +110,549 @@ void CallGraph::UpdateTargetToCallers(const CallGraphFilter& F) {
       TypeIdToIndirCallSites[TypeId].emplace_back(CallerPc, CallSitePc);
     }
   }
+  Release(TypeIdToIndirCalls);
+  Release(IndirCallUnknownType);
+
+  // Move the call site lists to the buckets.
+  const uint32_t NoBucket = UINT32_MAX;
+  uint32_t UnknownTypeBucket = NoBucket;
+  if (!IndirCallUnknownTypeCallSites.empty()) {
+    UnknownTypeBucket = CallerBuckets.size();
+    CallerBuckets.push_back(std::move(IndirCallUnknownTypeCallSites));
+  }
+  std::unordered_map<uint64_t, uint32_t> TypeIdToBucket;
+  for (auto &El : TypeIdToIndirCallSites) {
+    TypeIdToBucket[El.first] = CallerBuckets.size();
+    CallerBuckets.push_back(std::move(El.second));
+  }
+  Release(TypeIdToIndirCallSites);
+  // All call sites with a type id, only made if a target has no type id.
+  uint32_t AllTypesBucket = NoBucket;
+  auto GetAllTypesBucket = [&]() {
+    if (AllTypesBucket == NoBucket) {
+      AllTypesBucket = CallerBuckets.size();
+      CallerBuckets.emplace_back();
+      for (const auto &El : TypeIdToBucket) {
+        const auto &CallSites = CallerBuckets[El.second];
+        CallerBuckets[AllTypesBucket].insert(
+          CallerBuckets[AllTypesBucket].end(), CallSites.begin(),
+          CallSites.end());
+      }
+    }
+    return AllTypesBucket;
+  };
 
   // Add for indirect calls.
-  for (const auto &El : FuncAddrToName) {
-    uint64_t FuncPc = El.first;
-    if (ShouldExcludeFunc(FuncPc))
+  std::vector<char> Excluded(Funcs.size());
+  ForEachChunk(Pool, Funcs.size(), NumFuncChunks,
+               [&](size_t, size_t Begin, size_t End) {
+    for (size_t I = Begin; I < End; I++)
+      Excluded[I] = ShouldExcludeFunc(Funcs[I]->first);
+  });
+  for (size_t I = 0; I < Funcs.size(); I++) {
+    uint64_t FuncPc = Funcs[I]->first;
+    if (Excluded[I])
       continue;
 
-    auto &FuncTargetToCallers = TargetsToCallers[FuncPc];
-    
+    TargetsToCallers[FuncPc];
+
     // Add indirect calls based on function's indirect target properties.
     bool FuncIsIndirTarget = IndirTargetToTypeId.count(FuncPc) ||
                              IndirTargetUnknownType.count(FuncPc);
-    if (FuncIsIndirTarget) {
-      // Add indirect calls with unknown type id.
-      if (!Filter.ExcludeUnknownIndirCalls)
-        FuncTargetToCallers.insert(FuncTargetToCallers.end(),
-                                   IndirCallUnknownTypeCallSites.begin(),
-                                   IndirCallUnknownTypeCallSites.end());
-
-      // Add indirect calls with matching type id.
-      bool FuncHasTypeId = IndirTargetToTypeId.count(FuncPc);
-      if (FuncHasTypeId) { //< Function with type id.
-        // Add call sites with matching type id.
-        uint64_t FuncTypeId = IndirTargetToTypeId.find(FuncPc)->second;
-        if (!TypeIdToIndirCallSites[FuncTypeId].empty()) {
-          auto CallSites = TypeIdToIndirCallSites[FuncTypeId];
-          FuncTargetToCallers.insert(FuncTargetToCallers.end(),
-                                     CallSites.begin(), CallSites.end());
-        }
-      } else if (!Filter.ExcludeIndirCallsToUnknownTargets) {
-                           //< Function with unknown type id.
-        // Add all indirect calls as potential caller.
-        // Only add call sites with known type ids. The rest are added or not
-        // based on another filter value.
-        for (const auto &El : TypeIdToIndirCallSites) {
-          const auto CallSites = El.second;
-          TargetsToCallers[FuncPc].insert(TargetsToCallers[FuncPc].end(),
-                                         CallSites.begin(),
-                                         CallSites.end());
-        }
-      }
+    if (!FuncIsIndirTarget)
+      continue;
+    std::vector<uint32_t> Buckets;
+    // Add indirect calls with unknown type id.
+    if (UnknownTypeBucket != NoBucket)
+      Buckets.push_back(UnknownTypeBucket);
+
+    // Add indirect calls with matching type id.
+    auto TypeIt = IndirTargetToTypeId.find(FuncPc);
+    if (TypeIt != IndirTargetToTypeId.end()) { //< Function with type id.
+      auto BucketIt = TypeIdToBucket.find(TypeIt->second);
+      if (BucketIt != TypeIdToBucket.end())
+        Buckets.push_back(BucketIt->second);
+    } else if (!Filter.ExcludeIndirCallsToUnknownTargets) {
+                         //< Function with unknown type id.
+      // Add all indirect calls as potential caller.
+      // Only add call sites with known type ids. The rest are added or not
+      // based on another filter value.
+      Buckets.push_back(GetAllTypesBucket());
     }
+
+    // Buckets are never empty, so that the graphs can walk them in turn.
+    Buckets.erase(std::remove_if(Buckets.begin(), Buckets.end(),
+                                 [&](uint32_t B) {
+                                   return CallerBuckets[B].empty();
+                                 }),
+                  Buckets.end());
+    if (!Buckets.empty())
+      TargetsToBuckets[FuncPc] = std::move(Buckets);
   }
+  Built("CallerBuckets", CallerBuckets);
+  Built("TargetsToBuckets", TargetsToBuckets);
+
+  Release(IndirTargetToTypeId);
 
   //
   // Add for direct calls
   //
-  for (auto const &El : FuncAddrToDirCallSites) {
-    uintptr_t CallerPc = El.first;
-    const auto &Calls = El.second;
-    if (ShouldExcludeFunc(CallerPc))
-      continue;
+  AddDirectCallers(ShouldExcludeFunc);
+  Release(FuncAddrToDirCallSites);
+  Release(IndirTargetUnknownType);
+}
+
 
-    for (const auto &Call : Calls) {
-      auto CallSitePc = std::get<0>(Call);
-      auto TargetPc = std::get<1>(Call);
-      if (ShouldExcludeFunc(CallSitePc) || ShouldExcludeFunc(TargetPc))
+// Add the direct calls to TargetsToCallers in the order of
+// FuncAddrToDirCallSites. On a pool, the calls are filtered by chunks of
+// callers, then each thread adds the calls to its share of the targets,
+// walking the chunks in order.
+void CallGraph::AddDirectCallers(
+    const std::function<bool(uint64_t)> &ShouldExcludeFunc) {
+  if (!Pool || Pool->NumThreads() == 1) {
+    for (auto const &El : FuncAddrToDirCallSites) {
+      uintptr_t CallerPc = El.first;
+      const auto &Calls = El.second;
+      if (ShouldExcludeFunc(CallerPc))
         continue;
-      TargetsToCallers[TargetPc].emplace_back(CallerPc, CallSitePc);
+
+      for (const auto &Call : Calls) {
+        auto CallSitePc = std::get<0>(Call);
+        auto TargetPc = std::get<1>(Call);
+        if (ShouldExcludeFunc(CallSitePc) || ShouldExcludeFunc(TargetPc))
+          continue;
+        TargetsToCallers[TargetPc].emplace_back(CallerPc, CallSitePc);
+      }
     }
+    return;
   }
-}
-
 
-CallGraph::CallGraph(std::istream &In, const CallGraphFilter &CGF) {
-  std::string X;
+  std::vector<const std::pair<const uint64_t,
+                              std::vector<std::tuple<uint64_t, uint64_t>>>*>
+    Callers;
+  Callers.reserve(FuncAddrToDirCallSites.size());
+  for (const auto &El : FuncAddrToDirCallSites)
+    Callers.push_back(&El);
 
-  auto TryReadHex64 = [&](std::stringstream &SS, uint64_t &H) -> bool {
-    if (!SS.good())
-      return false;
-    SS >> std::hex >> H;
-    return true;
+  struct Call {
+    uint64_t TargetPc;
+    CallSite CS;
   };
-  auto ReadHex64 = [&](std::stringstream &SS, uint64_t &H) {
-    if(!TryReadHex64(SS, H)) {
-      std::cerr << "cannot read hex value" << std::endl;
-      exit(-1);
-    };
+  // Function entries are aligned, so the pcs are mixed before sharing them.
+  size_t NumShares = Pool->NumThreads();
+  auto ShareOf = [&](uint64_t Pc) {
+    return (size_t)((Pc * 0x9e3779b97f4a7c15ull) >> 32) % NumShares;
   };
+  size_t N = NumChunks(Pool, Callers.size());
+  // Calls kept by each chunk, per share of the targets, and the targets
+  // that have no list yet, in the order they are called.
+  std::vector<std::vector<std::vector<Call>>> Kept(
+    N, std::vector<std::vector<Call>>(NumShares));
+  std::vector<std::vector<uint64_t>> NewTargets(N);
+  ForEachChunk(Pool, Callers.size(), N,
+               [&](size_t C, size_t Begin, size_t End) {
+    for (size_t I = Begin; I < End; I++) {
+      uint64_t CallerPc = Callers[I]->first;
+      if (ShouldExcludeFunc(CallerPc))
+        continue;
 
-  auto ReadHex64List = [&](std::stringstream &SS, std::vector<uint64_t>& V) -> size_t {
-    size_t Count = 0;
-    uint64_t H;
-    while (TryReadHex64(SS, H)) {
-      V.push_back(H);
-      Count++;
+      for (const auto &Call : Callers[I]->second) {
+        auto CallSitePc = std::get<0>(Call);
+        auto TargetPc = std::get<1>(Call);
+        if (ShouldExcludeFunc(CallSitePc) || ShouldExcludeFunc(TargetPc))
+          continue;
+        if (!TargetsToCallers.count(TargetPc))
+          NewTargets[C].push_back(TargetPc);
+        Kept[C][ShareOf(TargetPc)].push_back(
+          {TargetPc, CallSite(CallerPc, CallSitePc)});
+      }
     }
-    return Count;
+  });
+
+  // The new targets are inserted in the order of the serial build, which
+  // keeps the map the same. The lists are then only looked up.
+  for (const auto &Targets : NewTargets)
+    for (uint64_t TargetPc : Targets)
+      TargetsToCallers[TargetPc];
+  ForEachChunk(Pool, NumShares, NumShares, [&](size_t Share, size_t, size_t) {
+    for (const auto &Calls : Kept)
+      for (const Call &C : Calls[Share])
+        TargetsToCallers.find(C.TargetPc)->second.push_back(C.CS);
+  });
+}
+
+CallGraph::CallGraph(std::istream &In, const CallGraphFilter &CGF,
+                     bool LowMemory, bool MeasureMemory,
+                     WorkStealingPool *Pool)
+  : LowMemory(LowMemory), MeasureMemory(MeasureMemory), Pool(Pool) {
+  std::string Text((std::istreambuf_iterator<char>(In)),
+                   std::istreambuf_iterator<char>());
+  Read(Text);
+  Init(CGF);
+}
+
+CallGraph::CallGraph(std::string_view Text, const CallGraphFilter &CGF,
+                     bool LowMemory, bool MeasureMemory,
+                     WorkStealingPool *Pool)
+  : LowMemory(LowMemory), MeasureMemory(MeasureMemory), Pool(Pool) {
+  Read(Text);
+  Init(CGF);
+}
+
+namespace {
+
+enum SectionKind {
+  IndirTargetTypes,
+  IndirCallTypes,
+  IndirCallSites,
+  DirCallSites,
+  Functions,
+  NumSectionKinds
+};
+
+const char *const SectionHeaders[NumSectionKinds] = {
+  "INDIRECT TARGET TYPES",
+  "INDIRECT CALL TYPES",
+  "INDIRECT CALL SITES",
+  "DIRECT CALL SITES",
+  "FUNCTIONS",
+};
+
+// Lines of a section, parsed: the hex value each line starts with, e.g., the
+// caller pc, and the hex values following it, which end at Ends of the line.
+// Words holds the word of each line of the sections that have one: the type
+// id of the target types, which may be "UNKNOWN", or the function name.
+struct ParsedLines {
+  std::vector<uint64_t> Keys;
+  std::vector<std::string_view> Words;
+  std::vector<size_t> Ends;
+  std::vector<uint64_t> Values;
+
+  size_t size() const { return Keys.size(); }
+  const uint64_t *ValuesBegin(size_t I) const {
+    return Values.data() + (I ? Ends[I - 1] : 0);
+  }
+  const uint64_t *ValuesEnd(size_t I) const { return Values.data() + Ends[I]; }
+
+  void clear() {
+    Keys.clear();
+    Words.clear();
+    Ends.clear();
+    Values.clear();
+  }
+};
+
+void ReadHex64(TextCursor &L, uint64_t &H) {
+  if (!L.ReadHex(H)) {
+    std::cerr << "cannot read hex value" << std::endl;
+    exit(-1);
   };
+}
 
-  // Read from file.
-  while(std::getline(In, X)) {
-    // Read indirect target types.
-    if (!X.find("INDIRECT TARGET TYPES")) {
-      assert (TypeIdToIndirTargets.empty()
-              && "Multiple \"INDIRECT TARGETS TYPES\" sections.");
-      while (std::getline(In, X)) { //< Read type id per line
-        if (X == "") break;
-        std::stringstream Line(X);
-        // Read type id. It can be an id or string "UNKNOWN".
-        std::string TypeId;
-        Line >> TypeId;
-        if (TypeId == "UNKNOWN") {
-          std::vector<uint64_t> V;
-          ReadHex64List(Line, V);
-          IndirTargetUnknownType.insert(V.begin(), V.end());
-        } else {
-          uint64_t TypeIdVal = std::stoull(TypeId, 0, 16);
-          // TODO: use these for without callgraph evaluation
-          // TypeIdVal = 0;
-          ReadHex64List(Line, TypeIdToIndirTargets[TypeIdVal]);
-          // Reverse mapping.
-          for (auto FuncPc : TypeIdToIndirTargets[TypeIdVal])
-            IndirTargetToTypeId[FuncPc] = TypeIdVal;
+void ReadHex64List(TextCursor &L, std::vector<uint64_t> &V) {
+  uint64_t H;
+  while (L.ReadHex(H))
+    V.push_back(H);
+}
+
+void ParseLine(SectionKind Kind, TextCursor &Line, ParsedLines &Out) {
+  uint64_t Key = 0;
+  std::string_view Word;
+  switch (Kind) {
+  case IndirTargetTypes:
+    // Read type id. It can be an id or string "UNKNOWN".
+    Line.ReadWord(Word);
+    if (Word != "UNKNOWN") {
+      TextCursor TypeIdWord(Word);
+      ReadHex64(TypeIdWord, Key);
+    }
+    Out.Words.push_back(Word);
+    ReadHex64List(Line, Out.Values);
+    break;
+  case IndirCallTypes: //< Type id and indirect call site pcs.
+  case IndirCallSites: //< Caller pc and indirect call site pcs.
+    ReadHex64(Line, Key);
+    ReadHex64List(Line, Out.Values);
+    break;
+  case DirCallSites: {
+    // Read caller pc, then direct call site and target pcs.
+    ReadHex64(Line, Key);
+    uint64_t CallSitePc, TargetPc;
+    while (Line.ReadHex(CallSitePc)) {
+      ReadHex64(Line, TargetPc);
+      Out.Values.push_back(CallSitePc);
+      Out.Values.push_back(TargetPc);
+    }
+    break;
+  }
+  case Functions:
+    // Read function pc and name.
+    ReadHex64(Line, Key);
+    Line.ReadWord(Word);
+    Out.Words.push_back(Word);
+    break;
+  case NumSectionKinds:
+    break;
+  }
+  Out.Keys.push_back(Key);
+  Out.Ends.push_back(Out.Values.size());
+}
+
+// The sections in the order they appear: the lines following the header up
+// to an empty line.
+std::vector<std::pair<SectionKind, std::string_view>>
+FindSections(std::string_view Text) {
+  std::vector<std::pair<SectionKind, std::string_view>> Res;
+  TextCursor In(Text);
+  TextCursor Line(In);
+  while (In.NextLine(Line)) {
+    for (int K = 0; K < NumSectionKinds; K++) {
+      if (!Line.StartsWith(SectionHeaders[K]))
+        continue;
+      const char *Begin = In.Cur;
+      const char *End = In.End;
+      while (In.NextLine(Line))
+        if (Line.AtEnd()) {
+          End = Line.Cur;
+          break;
         }
-      }
+      Res.emplace_back((SectionKind)K, std::string_view(Begin, End - Begin));
     }
+  }
+  return Res;
+}
+
+// Split the text into about NumPieces pieces of whole lines.
+std::vector<std::string_view> SplitLines(std::string_view Text,
+                                         size_t NumPieces) {
+  std::vector<std::string_view> Res;
+  const char *Begin = Text.data();
+  const char *End = Text.data() + Text.size();
+  for (size_t P = 1; P <= NumPieces && Begin != End; P++) {
+    const char *Split = std::max(Begin, Text.data() +
+                                          Text.size() * P / NumPieces);
+    if (Split != End) {
+      const char *Eol = (const char*)memchr(Split, '\n', End - Split);
+      Split = Eol ? Eol + 1 : End;
+    }
+    Res.emplace_back(Begin, Split - Begin);
+    Begin = Split;
+  }
+  return Res;
+}
 
-    // Read indirect call types.
-    if (!X.find("INDIRECT CALL TYPES")) {
+} // namespace
+
+// Parse the llvm-objdump output. Lines are scanned in place, without copying
+// them or allocating per line.
+//
+// Each line of a section is added to the structures of the section by one or
+// more adders, which are called in the order of the lines. Without a pool,
+// each line is added once parsed. On a pool, a section is parsed in chunks of
+// lines on the threads, and the adders then run at the same time, each
+// walking all the parsed lines in order.
+void CallGraph::Read(std::string_view Text) {
+  typedef std::function<void(const ParsedLines&, size_t)> Adder;
+  auto AddersOf = [&](SectionKind Kind) {
+    std::vector<Adder> Res;
+    switch (Kind) {
+    case IndirTargetTypes:
+      assert (TypeIdToIndirTargets.empty()
+              && "Multiple \"INDIRECT TARGETS TYPES\" sections.");
+      Res.push_back([&](const ParsedLines &P, size_t I) {
+        if (P.Words[I] == "UNKNOWN") {
+          IndirTargetUnknownType.insert(P.ValuesBegin(I), P.ValuesEnd(I));
+          return;
+        }
+        uint64_t TypeIdVal = P.Keys[I];
+        // TODO: use these for without callgraph evaluation
+        // TypeIdVal = 0;
+        auto &Targets = TypeIdToIndirTargets[TypeIdVal];
+        for (const uint64_t *V = P.ValuesBegin(I); V != P.ValuesEnd(I); V++)
+          Targets.push_back(*V);
+        // Reverse mapping.
+        for (auto FuncPc : Targets)
+          IndirTargetToTypeId[FuncPc] = TypeIdVal;
+      });
+      break;
+    case IndirCallTypes:
       assert (TypeIdToIndirCalls.empty()
               && "Multiple \"INDIRECT CALLS TYPES\" sections.");
-      while (std::getline(In, X)) {
-        if (X == "") break;
-        std::stringstream Line(X);
-        // Read type id and indirect call site pcs.
-        uint64_t TypeId;
-        ReadHex64(Line, TypeId);
+      Res.push_back([&](const ParsedLines &P, size_t I) {
+        uint64_t TypeId = P.Keys[I];
         // TODO: use these for without callgraph evaluation
         //TypeId = 0;
         auto &CallSitePcList = TypeIdToIndirCalls[TypeId];
-        ReadHex64List(Line, CallSitePcList);
+        for (const uint64_t *V = P.ValuesBegin(I); V != P.ValuesEnd(I); V++)
+          CallSitePcList.push_back(*V);
         // Reverse mapping: indirect call site pc to type id.
         for (auto CallSitePc : CallSitePcList)
           IndirCallToTypeId[CallSitePc] = TypeId;
-      }
-    }
-
-    // Read indirect call sites.
-    if (!X.find("INDIRECT CALL SITES")) {
-      assert (FuncAddrToIndirCallSites.empty() 
+      });
+      break;
+    case IndirCallSites:
+      assert (FuncAddrToIndirCallSites.empty()
               && "Multiple \"INDIRECT CALL SITES\" sections.");
-      while (std::getline(In, X)) {  
-        if (X == "") break;
-        std::stringstream Line(X);
-        // Read caller pc.
-        uint64_t CallerPc;
-        ReadHex64(Line, CallerPc);
-        // Read indirect call site pcs.
-        std::vector<uint64_t> CallSitePcs;
-        ReadHex64List(Line, CallSitePcs);
-        FuncAddrToIndirCallSites[CallerPc] = CallSitePcs;
-        // Insert to set of all indirect call site pcs.
-        IndirCallSiteAddrs.insert(CallSitePcs.begin(), CallSitePcs.end());
-      }
-    }
-
-    // Read direct call sites.
-    if (!X.find("DIRECT CALL SITES")) {
-      assert (FuncAddrToDirCallSites.empty() 
+      Res.push_back([&](const ParsedLines &P, size_t I) {
+        auto &CallSitePcs = FuncAddrToIndirCallSites[P.Keys[I]];
+        CallSitePcs.clear();
+        for (const uint64_t *V = P.ValuesBegin(I); V != P.ValuesEnd(I); V++)
+          CallSitePcs.push_back(*V);
+      });
+      // Insert to set of all indirect call site pcs.
+      Res.push_back([&](const ParsedLines &P, size_t I) {
+        IndirCallSiteAddrs.insert(P.ValuesBegin(I), P.ValuesEnd(I));
+      });
+      break;
+    case DirCallSites:
+      assert (FuncAddrToDirCallSites.empty()
               && "Multiple \"DIRECT CALL SITES\" sections.");
-      while (std::getline(In, X)) {
-        if (X == "") break;
-        std::stringstream Line(X);
-        // Read caller pc.
-        uint64_t CallerPc;
-        ReadHex64(Line, CallerPc);
-        // Read direct call site and target pcs.
-        uint64_t CallSitePc, TargetPc;
-        while (TryReadHex64(Line, CallSitePc)) {
-          ReadHex64(Line, TargetPc);
-          FuncAddrToDirCallSites[CallerPc].emplace_back(CallSitePc, TargetPc);
-          // Insert to set of all direct call site pcs.
-          DirCallSiteAddrs.insert(CallSitePc);
-        }
-      }
+      Res.push_back([&](const ParsedLines &P, size_t I) {
+        const uint64_t *Begin = P.ValuesBegin(I), *End = P.ValuesEnd(I);
+        if (Begin == End)
+          return;
+        auto &Calls = FuncAddrToDirCallSites[P.Keys[I]];
+        for (const uint64_t *V = Begin; V != End; V += 2)
+          Calls.emplace_back(V[0], V[1]);
+      });
+      // Insert to set of all direct call site pcs. Not used by the graphs.
+      if (!LowMemory)
+        Res.push_back([&](const ParsedLines &P, size_t I) {
+          const uint64_t *End = P.ValuesEnd(I);
+          for (const uint64_t *V = P.ValuesBegin(I); V != End; V += 2)
+            DirCallSiteAddrs.insert(V[0]);
+        });
+      break;
+    case Functions:
+      assert (FuncAddrToName.empty()
+              && "Multiple \"FUNCTION SYMBOLS\" sections.");
+      Res.push_back([&](const ParsedLines &P, size_t I) {
+        FuncAddrToName[P.Keys[I]] = std::string(P.Words[I]);
+      });
+      break;
+    case NumSectionKinds:
+      break;
     }
+    return Res;
+  };
 
-    // Read functions.
-    if (!X.find("FUNCTIONS")) {
-      assert (FuncAddrToName.empty() 
-              && "Multiple \"FUNCTION SYMBOLS\" sections.");
-      while (std::getline(In, X)) {
-        if (X == "") break;
-        std::stringstream Line(X);
-        // Read function pc.
-        uint64_t FunctionPc;
-        ReadHex64(Line, FunctionPc);
-        // Read function name.
-        std::string FuncName;
-        Line >> FuncName;
-        FuncAddrToName[FunctionPc] = FuncName;
+  std::vector<std::pair<SectionKind, std::string_view>> Sections;
+  Phases.Run("find the sections", [&] { Sections = FindSections(Text); });
+
+  if (!Pool || Pool->NumThreads() == 1) {
+    Phases.Run("parse and add the sections", [&] {
+      ParsedLines Parsed;
+      for (const auto &Section : Sections) {
+        std::vector<Adder> Adders = AddersOf(Section.first);
+        TextCursor In(Section.second);
+        TextCursor Line(In);
+        while (In.NextLine(Line)) {
+          Parsed.clear();
+          ParseLine(Section.first, Line, Parsed);
+          for (const Adder &Add : Adders)
+            Add(Parsed, 0);
+        }
       }
-    }
+    });
+    return;
   }
 
-  // Set FuncNameToAddr.
-  for (auto &El : FuncAddrToName)
-    FuncNameToAddr[El.second] = El.first;
-  
-  // Set targets without any info.
-  for (auto &El : FuncAddrToName) {
-    uint64_t FuncPc = El.first;
-    if (!IndirTargetToTypeId.count(FuncPc) && !IndirTargetUnknownType.count(FuncPc))
-      TargetsWithNoInfo.insert(FuncPc);
+  // Pieces of about 1 MB, at most a few per thread.
+  for (const auto &Section : Sections) {
+    std::vector<std::string_view> Pieces = SplitLines(
+      Section.second, NumChunks(Pool, Section.second.size() / (1 << 20) + 1));
+    std::vector<ParsedLines> Parsed(Pieces.size());
+    Phases.Run("parse the sections", [&] {
+      ForEachChunk(Pool, Pieces.size(), Pieces.size(),
+                   [&](size_t C, size_t, size_t) {
+        TextCursor In(Pieces[C]);
+        TextCursor Line(In);
+        while (In.NextLine(Line))
+          ParseLine(Section.first, Line, Parsed[C]);
+      });
+    });
+    Phases.Run("add the sections", [&] {
+      std::vector<std::function<void()>> Tasks;
+      for (const Adder &Add : AddersOf(Section.first))
+        Tasks.push_back([&, Add] {
+          for (const ParsedLines &P : Parsed)
+            for (size_t I = 0; I < P.size(); I++)
+              Add(P, I);
+        });
+      RunTasks(Pool, Tasks);
+    });
   }
-  
-  // Set indirect calls without a type id.
-  for (auto IndirCallSitePc : IndirCallSiteAddrs)
-    if (IndirCallToTypeId.count(IndirCallSitePc))
-      IndirCallUnknownType.insert(IndirCallSitePc);
-  
+}
+
+// Set the mappings derived from the parsed ones, and filter.
+void CallGraph::Init(const CallGraphFilter &CGF) {
+  Built("TypeIdToIndirTargets", TypeIdToIndirTargets);
+  Built("IndirTargetToTypeId", IndirTargetToTypeId);
+  Built("IndirTargetUnknownType", IndirTargetUnknownType);
+  Built("TypeIdToIndirCalls", TypeIdToIndirCalls);
+  Built("IndirCallToTypeId", IndirCallToTypeId);
+  Built("FuncAddrToIndirCallSites", FuncAddrToIndirCallSites);
+  Built("FuncAddrToDirCallSites", FuncAddrToDirCallSites);
+  Built("DirCallSiteAddrs", DirCallSiteAddrs);
+  Built("IndirCallSiteAddrs", IndirCallSiteAddrs);
+  Built("FuncAddrToName", FuncAddrToName);
+  // Only read to set IndirTargetToTypeId.
+  Release(TypeIdToIndirTargets);
+
+  // The derived mappings do not depend on each other, and are set at the
+  // same time on a pool.
+  std::vector<std::function<void()>> Tasks;
   // Set call site to caller mappings.
-  for (const auto& El: FuncAddrToDirCallSites) {
-    uint64_t Func = El.first;
-    for (const auto &DirCallSite : El.second) {
-      uint64_t CallSite = std::get<0>(DirCallSite);
-      CallSiteToCaller[CallSite] = Func;
+  Tasks.push_back([&] {
+    for (const auto& El: FuncAddrToDirCallSites) {
+      uint64_t Func = El.first;
+      for (const auto &DirCallSite : El.second) {
+        uint64_t CallSite = std::get<0>(DirCallSite);
+        CallSiteToCaller[CallSite] = Func;
+      }
     }
+    for (const auto& El: FuncAddrToIndirCallSites) {
+      uint64_t Func = El.first;
+      for (const auto &IndirCallSite : El.second)
+        CallSiteToCaller[IndirCallSite] = Func;
+    }
+  });
+  // Neither is used by the graphs.
+  if (!LowMemory) {
+    // Set FuncNameToAddr.
+    Tasks.push_back([&] {
+      for (auto &El : FuncAddrToName)
+        FuncNameToAddr[El.second] = El.first;
+    });
+
+    // Set targets without any info.
+    Tasks.push_back([&] {
+      for (auto &El : FuncAddrToName) {
+        uint64_t FuncPc = El.first;
+        if (!IndirTargetToTypeId.count(FuncPc) && !IndirTargetUnknownType.count(FuncPc))
+          TargetsWithNoInfo.insert(FuncPc);
+      }
+    });
   }
-  for (const auto& El: FuncAddrToIndirCallSites) {
-    uint64_t Func = El.first;
-    for (const auto &IndirCallSite : El.second)
-      CallSiteToCaller[IndirCallSite] = Func;
+  // Set indirect calls without a type id.
+  Tasks.push_back([&] {
+    for (auto IndirCallSitePc : IndirCallSiteAddrs)
+      if (IndirCallToTypeId.count(IndirCallSitePc))
+        IndirCallUnknownType.insert(IndirCallSitePc);
+  });
+  Phases.Run("derive the mappings", [&] { RunTasks(Pool, Tasks); });
+
+  if (!LowMemory) {
+    Built("FuncNameToAddr", FuncNameToAddr);
+    Built("TargetsWithNoInfo", TargetsWithNoInfo);
   }
+  Built("IndirCallUnknownType", IndirCallUnknownType);
+  Release(IndirCallSiteAddrs);
+  Release(IndirCallToTypeId);
+  Built("CallSiteToCaller", CallSiteToCaller);
+  Release(FuncAddrToIndirCallSites);
 
   // Update target to callers.
-  UpdateTargetToCallers(CGF);
+  Phases.Run("filter", [&] { UpdateTargetToCallers(CGF); });
+  Built("TargetsToCallers", TargetsToCallers);
 }
@@ -1,12 +1,15 @@
 #ifndef __CALL_GRAPH_H__
 #define __CALL_GRAPH_H__
 
+#include "parallel_build.hpp"
+
 #include <iostream>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <tuple>
 #include <string>
+#include <string_view>
 
 struct CallSite {
   uint64_t CallerPc;
@@ -71,14 +74,64 @@ struct CallGraph {
   std::unordered_map<uint64_t, uint64_t> CallSiteToCaller;
 
   std::unordered_map<uint64_t/*TargetFuncPc*/, 
-                     std::vector<CallSite>/*potential calls to it*/> TargetsToCallers;
+                     std::vector<CallSite>/*direct calls to it*/> TargetsToCallers;
+
+  // Indirect call sites, each list kept once and referred to by all the
+  // targets it may call: the call sites of a type id, the ones without a type
+  // id, and all the ones with a type id (for the targets without one).
+  // Copying them into TargetsToCallers would take the number of targets times
+  // the number of call sites of their type. The potential callers of a
+  // function are its direct call sites, then the call sites of its buckets in
+  // order.
+  std::vector<std::vector<CallSite>> CallerBuckets;
+  std::unordered_map<uint64_t/*TargetFuncPc*/,
+                     std::vector<uint32_t>/*into CallerBuckets*/> TargetsToBuckets;
+
+  // Estimated bytes of each structure once it is complete, in the order they
+  // are built, if measured. In the low-memory mode, the structures are
+  // released soon after, so these are the bytes each of them held at most.
+  std::vector<std::pair<const char*, size_t>> StructureBytes;
+
+  // Time of each phase of the build.
+  BuildPhases Phases;
 
   private:
+    bool LowMemory;
+    bool MeasureMemory;
+    WorkStealingPool *Pool;
+
     void UpdateTargetToCallers(const CallGraphFilter& F);
+    void AddDirectCallers(
+      const std::function<bool(uint64_t)> &ShouldExcludeFunc);
+    void Read(std::string_view Text);
+    void Init(const CallGraphFilter &CGF);
+    template<class T> void Built(const char *Name, const T &Structure);
+    template<class T> void Release(T &Structure);
 
   public:
     // Read from llvm-objdump output
-    CallGraph(std::istream &In, const CallGraphFilter &CGF);
+    CallGraph(std::istream &In, const CallGraphFilter &CGF,
+              bool LowMemory = false, bool MeasureMemory = false,
+              WorkStealingPool *Pool = nullptr);
+
+    // Read from llvm-objdump output in memory, e.g., a mapped file.
+    //
+    // In the low-memory mode, only the structures that the reverse call
+    // graphs and the symbol table are built from are kept: TargetsToCallers,
+    // CallerBuckets, TargetsToBuckets, FuncAddrToName and CallSiteToCaller.
+    // The rest are never built, or released right after their last use,
+    // which lowers the peak memory of the build. If MeasureMemory,
+    // StructureBytes is filled.
+    //
+    // If Pool is given, the sections are parsed in chunks on its threads,
+    // the structures that do not depend on each other are built at the same
+    // time, and the filtering is split by function. Each structure is
+    // filled in the same order as by the serial build, so that the call
+    // graph is the same. The parsed sections are held until their structures
+    // are built.
+    CallGraph(std::string_view Text, const CallGraphFilter &CGF,
+              bool LowMemory = false, bool MeasureMemory = false,
+              WorkStealingPool *Pool = nullptr);
 
     void Print(std::ostream &Out) const;
 
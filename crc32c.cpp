@@ -0,0 +1,32 @@
+#include "crc32c.hpp"
+
+// Reflected CRC32C (Castagnoli) polynomial.
+static const uint32_t Poly = 0x82F63B78;
+
+constexpr Crc32cTables::Crc32cTables() : Slice(), TopToIdx() {
+  for (uint32_t I = 0; I < 256; I++) {
+    uint32_t Crc = I;
+    for (int B = 0; B < 8; B++)
+      Crc = (Crc >> 1) ^ (Crc & 1 ? Poly : 0);
+    Slice[0][I] = Crc;
+  }
+  for (int K = 1; K < 8; K++)
+    for (uint32_t I = 0; I < 256; I++)
+      Slice[K][I] = (Slice[K - 1][I] >> 8) ^ Slice[0][Slice[K - 1][I] & 0xFF];
+  // The highest bytes of the table entries are all distinct, hence a step
+  // is inverted by finding the entry through the highest byte.
+  for (uint32_t I = 0; I < 256; I++)
+    TopToIdx[Slice[0][I] >> 24] = I;
+}
+
+// Constant initialized, so that it is usable from other static initializers.
+const Crc32cTables Crc32cTab;
+
+uint32_t Crc32cUnstep(uint32_t Crc, uint64_t Data) {
+  for (int I = 7; I >= 0; I--) {
+    uint8_t Idx = Crc32cTab.TopToIdx[Crc >> 24];
+    uint8_t Byte = Data >> (8 * I);
+    Crc = ((Crc ^ Crc32cTab.Slice[0][Idx]) << 8) | (uint8_t)(Idx ^ Byte);
+  }
+  return Crc;
+}
@@ -0,0 +1,36 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <cstdint>
+
+// Tables of the software CRC32C. Slice[K][B] is the CRC of the byte B
+// followed by K zero bytes, so that the 8 bytes of a step are looked up
+// independently (slicing-by-8).
+struct Crc32cTables {
+  uint32_t Slice[8][256];
+  uint8_t TopToIdx[256]; //< Index of the Slice[0] entry by its highest byte.
+
+  constexpr Crc32cTables();
+};
+
+extern const Crc32cTables Crc32cTab;
+
+// Software implementation of the CRC32C step that HashStep computes with
+// __builtin_ia32_crc32di, i.e., the crc32 instruction on a 64-bit operand.
+// The data is processed as 8 little-endian bytes without any inversion.
+inline uint32_t Crc32cStep(uint32_t Crc, uint64_t Data) {
+  uint64_t X = Data ^ Crc;
+  return Crc32cTab.Slice[7][X & 0xFF] ^ Crc32cTab.Slice[6][(X >> 8) & 0xFF] ^
+         Crc32cTab.Slice[5][(X >> 16) & 0xFF] ^
+         Crc32cTab.Slice[4][(X >> 24) & 0xFF] ^
+         Crc32cTab.Slice[3][(X >> 32) & 0xFF] ^
+         Crc32cTab.Slice[2][(X >> 40) & 0xFF] ^
+         Crc32cTab.Slice[1][(X >> 48) & 0xFF] ^ Crc32cTab.Slice[0][X >> 56];
+}
+
+// Inverse of Crc32cStep on the state: Crc32cUnstep(Crc32cStep(C, D), D) == C.
+// The step is affine over GF(2) and bijective on the state for a fixed Data,
+// so that the state before a frame is computable from the state after it.
+uint32_t Crc32cUnstep(uint32_t Crc, uint64_t Data);
+
+#endif
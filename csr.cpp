@@ -0,0 +1,395 @@
+#include "csr.hpp"
+
+#include <algorithm>
+#include <queue>
+
+namespace {
+
+typedef CsrReverseCallGraph::FuncId FuncId;
+typedef CsrReverseCallGraph::CallerRange CallerRange;
+
+// Adjacency of the functions, where some of the neighbors are in groups
+// shared by many functions, e.g., the callers in a bucket of indirect call
+// sites. The neighbors of a function are its own ones, then the members of
+// its groups. The groups are not copied into each function, so that the
+// adjacency stays linear in the size of the graph.
+struct Adjacency {
+  std::vector<std::vector<FuncId>> Own;        //< Per function.
+  std::vector<std::vector<uint32_t>> GroupsOf; //< Per function.
+  std::vector<std::vector<FuncId>> Groups;
+
+  explicit Adjacency(size_t NumFuncs) : Own(NumFuncs), GroupsOf(NumFuncs) {}
+
+  // Number of neighbors of each function, counting the repeated ones again.
+  std::vector<size_t> Degrees() const {
+    std::vector<size_t> Res(Own.size());
+    for (FuncId F = 0; F < Own.size(); F++) {
+      Res[F] = Own[F].size();
+      for (uint32_t G : GroupsOf[F])
+        Res[F] += Groups[G].size();
+    }
+    return Res;
+  }
+};
+
+// Breadth-first numbering over the given adjacency. Each component is
+// started from the first function in Seeds that is not numbered yet.
+// Neighbors are visited in ascending degree order if SortByDegree is set.
+std::vector<FuncId>
+BreadthFirstOrder(const Adjacency &Adj, const std::vector<FuncId> &Seeds,
+                  bool SortByDegree) {
+  std::vector<FuncId> Order;
+  std::vector<size_t> Degrees;
+  if (SortByDegree)
+    Degrees = Adj.Degrees();
+  std::vector<bool> Visited(Adj.Own.size(), false);
+  std::vector<bool> Expanded(Adj.Groups.size(), false);
+  std::vector<FuncId> Neighbors;
+  auto Visit = [&](FuncId N) {
+    if (!Visited[N]) {
+      Visited[N] = true;
+      Neighbors.push_back(N);
+    }
+  };
+  for (FuncId Seed : Seeds) {
+    if (Visited[Seed])
+      continue;
+    std::queue<FuncId> Queue;
+    Queue.push(Seed);
+    Visited[Seed] = true;
+    while (!Queue.empty()) {
+      FuncId F = Queue.front();
+      Queue.pop();
+      Order.push_back(F);
+      Neighbors.clear();
+      for (FuncId N : Adj.Own[F])
+        Visit(N);
+      // All members of a group are visited once it is expanded, so it is
+      // expanded once, however many functions it is shared by.
+      for (uint32_t G : Adj.GroupsOf[F])
+        if (!Expanded[G]) {
+          Expanded[G] = true;
+          for (FuncId N : Adj.Groups[G])
+            Visit(N);
+        }
+      if (SortByDegree)
+        std::stable_sort(Neighbors.begin(), Neighbors.end(),
+                         [&](FuncId A, FuncId B) {
+                           return Degrees[A] < Degrees[B];
+                         });
+      for (FuncId N : Neighbors)
+        Queue.push(N);
+    }
+  }
+  return Order;
+}
+
+} // namespace
+
+CsrReverseCallGraph::CsrReverseCallGraph(const CallGraph &RawCG, Order O,
+                                         WorkStealingPool *Pool) {
+  // Get the filtered target to callers mapping.
+  auto &TargetToCallers = RawCG.TargetsToCallers;
+  auto &TargetToBuckets = RawCG.TargetsToBuckets;
+  auto &Buckets = RawCG.CallerBuckets;
+  // Buckets that no function refers to are left out.
+  std::vector<bool> Referenced(Buckets.size(), false);
+  for (const auto &El : TargetToBuckets)
+    for (uint32_t B : El.second)
+      Referenced[B] = true;
+
+  // Number the functions in ascending entry pc order first. Callers without
+  // an entry in the mapping are numbered too, as functions with no callers.
+  std::vector<uint64_t> Pcs;
+  std::unordered_map<uint64_t, FuncId> PcToId;
+  Phases.Run("number the functions", [&] {
+    for (const auto &El : TargetToCallers) {
+      Pcs.push_back(El.first);
+      for (const auto &CS : El.second)
+        Pcs.push_back(CS.CallerPc);
+    }
+    for (const auto &El : TargetToBuckets)
+      Pcs.push_back(El.first);
+    for (uint32_t B = 0; B < Buckets.size(); B++)
+      if (Referenced[B])
+        for (const auto &CS : Buckets[B])
+          Pcs.push_back(CS.CallerPc);
+    std::sort(Pcs.begin(), Pcs.end());
+    Pcs.erase(std::unique(Pcs.begin(), Pcs.end()), Pcs.end());
+    for (FuncId F = 0; F < Pcs.size(); F++)
+      PcToId[Pcs[F]] = F;
+  });
+  // Only looks up, so that it can be called from many threads.
+  auto IdOf = [&](uint64_t Pc) { return PcToId.find(Pc)->second; };
+
+  // Callers per function with the initial numbering: the direct ones, and
+  // the callers in the buckets as the groups. Each function and bucket is
+  // filled by one thread.
+  Adjacency CallerAdj(Pcs.size());
+  std::vector<const std::vector<CallSite>*> CallSitesOf(Pcs.size(), nullptr);
+  Phases.Run("look up the callers", [&] {
+    std::vector<const std::pair<const uint64_t, std::vector<CallSite>>*>
+      Targets;
+    Targets.reserve(TargetToCallers.size());
+    for (const auto &El : TargetToCallers)
+      Targets.push_back(&El);
+    ForEachChunk(Pool, Targets.size(), NumChunks(Pool, Targets.size()),
+                 [&](size_t, size_t Begin, size_t End) {
+      for (size_t I = Begin; I < End; I++) {
+        FuncId F = IdOf(Targets[I]->first);
+        CallSitesOf[F] = &Targets[I]->second;
+        for (const auto &CS : Targets[I]->second)
+          CallerAdj.Own[F].push_back(IdOf(CS.CallerPc));
+      }
+    });
+    CallerAdj.Groups.resize(Buckets.size());
+    ForEachChunk(Pool, Buckets.size(), NumChunks(Pool, Buckets.size()),
+                 [&](size_t, size_t Begin, size_t End) {
+      for (size_t B = Begin; B < End; B++)
+        if (Referenced[B])
+          for (const auto &CS : Buckets[B])
+            CallerAdj.Groups[B].push_back(IdOf(CS.CallerPc));
+    });
+    for (const auto &El : TargetToBuckets)
+      CallerAdj.GroupsOf[IdOf(El.first)] = El.second;
+  });
+
+  // Renumber. NewToOld[NewId] is the initial id.
+  std::vector<FuncId> NewToOld(Pcs.size());
+  Phases.Run("order the functions", [&] {
+    for (FuncId F = 0; F < Pcs.size(); F++)
+      NewToOld[F] = F;
+    if (O == Order::Bfs) {
+      // The search walks from a function to its callers, so number the callers
+      // of a function next to each other and close to it.
+      NewToOld = BreadthFirstOrder(CallerAdj, NewToOld, false);
+    } else if (O == Order::Rcm) {
+      // Cuthill-McKee needs a symmetric adjacency. The functions calling
+      // through a bucket get the functions referring to it as a group.
+      size_t NumBuckets = Buckets.size();
+      Adjacency Adj(Pcs.size());
+      Adj.Groups = CallerAdj.Groups;
+      Adj.Groups.resize(2 * NumBuckets);
+      for (FuncId F = 0; F < Pcs.size(); F++) {
+        for (FuncId C : CallerAdj.Own[F]) {
+          Adj.Own[F].push_back(C);
+          Adj.Own[C].push_back(F);
+        }
+        for (uint32_t B : CallerAdj.GroupsOf[F]) {
+          Adj.GroupsOf[F].push_back(B);
+          Adj.Groups[NumBuckets + B].push_back(F);
+        }
+      }
+      for (uint32_t B = 0; B < NumBuckets; B++)
+        for (FuncId C : CallerAdj.Groups[B])
+          Adj.GroupsOf[C].push_back(NumBuckets + B);
+      for (FuncId F = 0; F < Pcs.size(); F++) {
+        auto &A = Adj.Own[F];
+        std::sort(A.begin(), A.end());
+        A.erase(std::unique(A.begin(), A.end()), A.end());
+        auto &G = Adj.GroupsOf[F];
+        std::sort(G.begin(), G.end());
+        G.erase(std::unique(G.begin(), G.end()), G.end());
+      }
+      // Start each component from a function with the minimum degree.
+      std::vector<size_t> Degrees = Adj.Degrees();
+      std::vector<FuncId> Seeds(NewToOld);
+      std::stable_sort(Seeds.begin(), Seeds.end(), [&](FuncId A, FuncId B) {
+        return Degrees[A] < Degrees[B];
+      });
+      NewToOld = BreadthFirstOrder(Adj, Seeds, true);
+      std::reverse(NewToOld.begin(), NewToOld.end());
+    }
+  });
+  std::vector<FuncId> OldToNew(Pcs.size());
+  for (FuncId F = 0; F < Pcs.size(); F++)
+    OldToNew[NewToOld[F]] = F;
+
+  // Fill the call site arrays in the new numbering, with the direct callers
+  // of each function, then the buckets. The ranges are set first, so that
+  // the functions and the buckets are then filled on any thread.
+  std::vector<CallerRange> BucketRange(Buckets.size(), CallerRange{0, 0});
+  Phases.Run("fill the arrays", [&] {
+    OwnedFuncPcs.resize(Pcs.size());
+    OwnedCallers.resize(Pcs.size());
+    uint32_t NumCallSites = 0;
+    for (FuncId F = 0; F < Pcs.size(); F++) {
+      FuncId Old = NewToOld[F];
+      OwnedCallers[F].First.Begin = NumCallSites;
+      if (CallSitesOf[Old])
+        NumCallSites += CallSitesOf[Old]->size();
+      OwnedCallers[F].First.End = NumCallSites;
+    }
+    for (uint32_t B = 0; B < Buckets.size(); B++) {
+      if (!Referenced[B])
+        continue;
+      BucketRange[B].Begin = NumCallSites;
+      NumCallSites += Buckets[B].size();
+      BucketRange[B].End = NumCallSites;
+    }
+    OwnedCallSitePcs.resize(NumCallSites);
+    OwnedCallSiteCallers.resize(NumCallSites);
+
+    ForEachChunk(Pool, Pcs.size(), NumChunks(Pool, Pcs.size()),
+                 [&](size_t, size_t Begin, size_t End) {
+      for (FuncId F = Begin; F < End; F++) {
+        FuncId Old = NewToOld[F];
+        OwnedFuncPcs[F] = Pcs[Old];
+        if (!CallSitesOf[Old])
+          continue;
+        const auto &CallSites = *CallSitesOf[Old];
+        uint32_t E = OwnedCallers[F].First.Begin;
+        for (size_t I = 0; I < CallSites.size(); I++, E++) {
+          OwnedCallSitePcs[E] = CallSites[I].CallSitePc;
+          OwnedCallSiteCallers[E] = OldToNew[CallerAdj.Own[Old][I]];
+        }
+      }
+    });
+    ForEachChunk(Pool, Buckets.size(), NumChunks(Pool, Buckets.size()),
+                 [&](size_t, size_t Begin, size_t End) {
+      for (size_t B = Begin; B < End; B++) {
+        if (!Referenced[B])
+          continue;
+        uint32_t E = BucketRange[B].Begin;
+        for (size_t I = 0; I < Buckets[B].size(); I++, E++) {
+          OwnedCallSitePcs[E] = Buckets[B][I].CallSitePc;
+          OwnedCallSiteCallers[E] = OldToNew[CallerAdj.Groups[B][I]];
+        }
+      }
+    });
+
+    // The first bucket of a function with no direct caller is its first
+    // range.
+    OwnedBucketRanges.push_back({0, 0});
+    for (FuncId F = 0; F < Pcs.size(); F++) {
+      const auto &BucketsOf = CallerAdj.GroupsOf[NewToOld[F]];
+      FuncCallers &C = OwnedCallers[F];
+      size_t NumInline = 0;
+      if (C.First.Begin == C.First.End && !BucketsOf.empty())
+        C.First = BucketRange[BucketsOf[NumInline++]];
+      C.Rest = 0;
+      if (NumInline == BucketsOf.size())
+        continue;
+      C.Rest = OwnedBucketRanges.size();
+      for (size_t I = NumInline; I < BucketsOf.size(); I++)
+        OwnedBucketRanges.push_back(BucketRange[BucketsOf[I]]);
+      OwnedBucketRanges.push_back({0, 0});
+    }
+  });
+  // The initial numbering is in ascending entry pc order.
+  OwnedIdsByPc = OldToNew;
+
+  FuncPcs = OwnedFuncPcs;
+  Callers = OwnedCallers;
+  BucketRanges = OwnedBucketRanges;
+  CallSitePcs = OwnedCallSitePcs;
+  CallSiteCallers = OwnedCallSiteCallers;
+  IdsByPc = OwnedIdsByPc;
+}
+
+CsrReverseCallGraph::CsrReverseCallGraph(ArrayRef<uint64_t> FuncPcs,
+                                         ArrayRef<FuncCallers> Callers,
+                                         ArrayRef<CallerRange> BucketRanges,
+                                         ArrayRef<uint64_t> CallSitePcs,
+                                         ArrayRef<FuncId> CallSiteCallers,
+                                         ArrayRef<FuncId> IdsByPc)
+  : FuncPcs(FuncPcs), Callers(Callers), BucketRanges(BucketRanges),
+    CallSitePcs(CallSitePcs), CallSiteCallers(CallSiteCallers),
+    IdsByPc(IdsByPc) {}
+
+bool CsrReverseCallGraph::FindFunc(uint64_t FuncPc, NodeRef &Node) const {
+  auto It = std::lower_bound(IdsByPc.begin(), IdsByPc.end(), FuncPc,
+                             [&](FuncId F, uint64_t Pc) {
+                               return FuncPcs[F] < Pc;
+                             });
+  if (It == IdsByPc.end() || FuncPcs[*It] != FuncPc)
+    return false;
+  Node = *It;
+  return true;
+}
+
+size_t CsrReverseCallGraph::NumEdges() const {
+  size_t Res = 0;
+  for (const FuncCallers &C : Callers)
+    Res += C.First.End - C.First.Begin;
+  for (const CallerRange &R : BucketRanges)
+    Res += R.End - R.Begin;
+  return Res;
+}
+
+size_t CsrReverseCallGraph::ArrayBytes() const {
+  return FuncPcs.size() * sizeof(uint64_t) +
+         Callers.size() * sizeof(FuncCallers) +
+         BucketRanges.size() * sizeof(CallerRange) +
+         CallSitePcs.size() * sizeof(uint64_t) +
+         CallSiteCallers.size() * sizeof(FuncId) +
+         IdsByPc.size() * sizeof(FuncId);
+}
+
+size_t CsrReverseCallGraph::ReorderCallers(const CallSiteProfile &Profile) {
+  if (Profile.empty())
+    return 0;
+  if (CallSitePcs.begin() != OwnedCallSitePcs.data()) {
+    OwnedCallSitePcs.assign(CallSitePcs.begin(), CallSitePcs.end());
+    OwnedCallSiteCallers.assign(CallSiteCallers.begin(),
+                                CallSiteCallers.end());
+    CallSitePcs = OwnedCallSitePcs;
+    CallSiteCallers = OwnedCallSiteCallers;
+  }
+
+  // A bucket is shared by the functions it may call, so the call sites are
+  // ordered by their counts over all the functions they called. Each range
+  // of the call site arrays is ordered once: the direct callers of each
+  // function, and each bucket.
+  std::unordered_map<uint64_t, uint64_t> Counts = Profile.CallSiteCounts();
+  std::vector<CallerRange> Distinct;
+  for (const FuncCallers &C : Callers)
+    if (C.First.Begin != C.First.End)
+      Distinct.push_back(C.First);
+  for (const CallerRange &R : BucketRanges)
+    if (R.Begin != R.End)
+      Distinct.push_back(R);
+  std::sort(Distinct.begin(), Distinct.end(),
+            [](const CallerRange &A, const CallerRange &B) {
+              return A.Begin < B.Begin;
+            });
+  Distinct.erase(std::unique(Distinct.begin(), Distinct.end(),
+                             [](const CallerRange &A, const CallerRange &B) {
+                               return A.Begin == B.Begin;
+                             }),
+                 Distinct.end());
+
+  size_t NumMoved = 0;
+  std::vector<std::pair<uint64_t, uint32_t>> Order; //< (count, call site).
+  std::vector<uint64_t> Pcs;
+  std::vector<FuncId> RangeCallers;
+  for (const CallerRange &R : Distinct) {
+    uint32_t Begin = R.Begin, End = R.End;
+    Order.clear();
+    for (uint32_t E = Begin; E < End; E++) {
+      auto It = Counts.find(CallSitePcs[E]);
+      Order.emplace_back(It == Counts.end() ? 0 : It->second, E);
+    }
+    std::stable_sort(Order.begin(), Order.end(),
+                     [](const std::pair<uint64_t, uint32_t> &A,
+                        const std::pair<uint64_t, uint32_t> &B) {
+                       return A.first > B.first;
+                     });
+    bool Moved = false;
+    for (uint32_t I = 0; I < Order.size(); I++)
+      Moved |= Order[I].second != Begin + I;
+    if (!Moved)
+      continue;
+    NumMoved++;
+    Pcs.clear();
+    RangeCallers.clear();
+    for (const auto &El : Order) {
+      Pcs.push_back(CallSitePcs[El.second]);
+      RangeCallers.push_back(CallSiteCallers[El.second]);
+    }
+    std::copy(Pcs.begin(), Pcs.end(), OwnedCallSitePcs.begin() + Begin);
+    std::copy(RangeCallers.begin(), RangeCallers.end(),
+              OwnedCallSiteCallers.begin() + Begin);
+  }
+  return NumMoved;
+}
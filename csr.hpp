@@ -0,0 +1,124 @@
+#ifndef __CSR_REVERSE_CALL_GRAPH_H__
+#define __CSR_REVERSE_CALL_GRAPH_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "array_ref.hpp"
+#include "call_site_profile.hpp"
+#include "caller_ranges.hpp"
+#include "cg.hpp"
+
+// Reverse call graph in compressed sparse row layout.
+//
+// Functions are numbered densely with 32-bit ids. The call site arrays hold
+// the pc of the call site and the id of the function containing it: first
+// the direct call sites calling each function in id order, then the buckets
+// of indirect call sites (see CallGraph::CallerBuckets), each stored once.
+// The call sites calling the function with id F are ranges of the call site
+// arrays: Callers[F].First, which is its direct call sites or, if it has
+// none, its first bucket, then its other buckets, listed from Callers[F].Rest
+// in BucketRanges up to an empty range. The empty range at 0 is the list of
+// the functions with no other bucket. The first range is kept inline as most
+// targets of indirect calls have no direct call site, and the search would
+// otherwise load the bucket list before the first call site of each caller.
+// Compared to ReverseCallGraph, the whole graph is in a few contiguous arrays
+// and the search walks indices instead of chasing pointers to separately
+// allocated nodes.
+//
+// The arrays are either owned by the graph when it is built from a CallGraph,
+// or point into a mapped snapshot file (see snapshot.hpp).
+struct CsrReverseCallGraph {
+  typedef uint32_t FuncId;
+  typedef ::CallerRange<uint32_t> CallerRange;
+
+  struct FuncCallers {
+    CallerRange First;
+    uint32_t Rest; //< Into BucketRanges, 0 if none.
+  };
+
+  // Function numbering. Renumbering places the functions that are visited
+  // together by the search nearby in the arrays.
+  enum class Order {
+    EntryPc, //< Ascending entry pc.
+    Bfs,     //< Breadth-first over the callers.
+    Rcm,     //< Reverse Cuthill-McKee over the callers and callees.
+  };
+
+  ArrayRef<uint64_t> FuncPcs;         //< Entry pc per function id.
+  ArrayRef<FuncCallers> Callers;      //< Per function id.
+  ArrayRef<CallerRange> BucketRanges; //< Lists of buckets.
+  ArrayRef<uint64_t> CallSitePcs;     //< Pc per call site.
+  ArrayRef<FuncId> CallSiteCallers;   //< Caller function per call site.
+  ArrayRef<FuncId> IdsByPc;           //< Function ids by ascending entry pc.
+
+  // Time of each phase of the build.
+  BuildPhases Phases;
+
+  // If Pool is given, the callers are looked up and the arrays are filled
+  // on its threads. The numbering orders run on the calling thread. The
+  // arrays are the same as built without a pool.
+  CsrReverseCallGraph(const CallGraph &RawCG, Order O = Order::EntryPc,
+                      WorkStealingPool *Pool = nullptr);
+
+  // View arrays owned elsewhere.
+  CsrReverseCallGraph(ArrayRef<uint64_t> FuncPcs,
+                      ArrayRef<FuncCallers> Callers,
+                      ArrayRef<CallerRange> BucketRanges,
+                      ArrayRef<uint64_t> CallSitePcs,
+                      ArrayRef<FuncId> CallSiteCallers,
+                      ArrayRef<FuncId> IdsByPc);
+
+  // The arrays may point into the owned vectors.
+  CsrReverseCallGraph(const CsrReverseCallGraph&) = delete;
+  CsrReverseCallGraph &operator=(const CsrReverseCallGraph&) = delete;
+
+  size_t NumFuncs() const { return FuncPcs.size(); }
+  size_t NumCallSites() const { return CallSitePcs.size(); }
+  // Number of edges, counting a call site once per function it may call.
+  size_t NumEdges() const;
+
+  // Bytes used by the arrays.
+  size_t ArrayBytes() const;
+
+  // Order the direct callers of each function and the call sites of each
+  // bucket by descending count in the profile, over all the functions they
+  // called as a bucket is shared, keeping the order of the ties. The call
+  // site arrays are copied first if they are not owned, e.g., mapped from a
+  // snapshot. Returns the number of caller lists that moved.
+  size_t ReorderCallers(const CallSiteProfile &Profile);
+
+  // Interface shared with ReverseCallGraph that the searches are written
+  // against. A function is referred by its id, and a call site calling it by
+  // its index in the call site arrays, walking the ranges of the function.
+  // The end of the callers is the same for all functions.
+  typedef FuncId NodeRef;
+  typedef CallerIterator<uint32_t> EdgeRef;
+
+  bool FindFunc(uint64_t FuncPc, NodeRef &Node) const;
+  uint64_t EntryPc(NodeRef Node) const { return FuncPcs[Node]; }
+  EdgeRef CallersBegin(NodeRef Node) const {
+    const FuncCallers &C = Callers[Node];
+    return EdgeRef::Begin(C.First.Begin, C.First.End,
+                          BucketRanges.begin() + C.Rest);
+  }
+  // The ranges of all functions end the same way (see CallerIterator); the
+  // function is kept for the searches over both layouts.
+  EdgeRef CallersEnd(NodeRef) const { return EdgeRef::End(); }
+  uint64_t CallSitePc(EdgeRef Edge) const { return CallSitePcs[Edge.Pos]; }
+  NodeRef Caller(EdgeRef Edge) const { return CallSiteCallers[Edge.Pos]; }
+  template<class FnT> void ForEachFunc(FnT Fn) const {
+    for (FuncId F = 0; F < NumFuncs(); F++)
+      Fn(F);
+  }
+
+private:
+  std::vector<uint64_t> OwnedFuncPcs;
+  std::vector<FuncCallers> OwnedCallers;
+  std::vector<CallerRange> OwnedBucketRanges;
+  std::vector<uint64_t> OwnedCallSitePcs;
+  std::vector<FuncId> OwnedCallSiteCallers;
+  std::vector<FuncId> OwnedIdsByPc;
+};
+
+#endif
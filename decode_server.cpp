@@ -0,0 +1,375 @@
+#include "decode_server.hpp"
+#include "hash_policy.hpp"
+#include "multi_search.hpp"
+#include "scan.hpp"
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+
+struct DecodeServer::Request {
+  uint64_t EntryPc = 0;
+  CompressedTrace Wanted;
+  std::string Error; //< If set, the request is not decoded.
+  bool Found = false;
+  StackTrace Frames;
+  bool IsDecode = false;
+  std::unique_ptr<CandidateSet> Candidates; //< Of a candidates request.
+};
+
+namespace {
+
+// The search of one worker on a graph, with the hash policy of the server.
+class GraphDecoder {
+public:
+  virtual ~GraphDecoder() {}
+
+  // Decode the requests, which share the entry function.
+  virtual void Decode(uint64_t EntryPc,
+                      const std::vector<DecodeServer::Request*> &Group) = 0;
+};
+
+template<class HashT>
+class HashDecoder : public GraphDecoder {
+  typedef MultiQuerySearch<CsrReverseCallGraph, HashT> SearchT;
+  SearchT Search;
+  std::vector<typename SearchT::Query> Queries;
+
+public:
+  HashDecoder(const CsrReverseCallGraph &G, const SearchParams &P)
+    : Search(G, P) {}
+
+  void Decode(uint64_t EntryPc,
+              const std::vector<DecodeServer::Request*> &Group) override {
+    Queries.clear();
+    for (DecodeServer::Request *R : Group)
+      Queries.push_back({&R->Wanted, nullptr, false, 0, &R->Frames,
+                         R->Candidates.get()});
+    Search.Reconstruct(EntryPc, Queries);
+    for (size_t I = 0; I < Group.size(); I++)
+      Group[I]->Found = Queries[I].Found;
+  }
+};
+
+// Write all of Data. Returns false on failure.
+bool WriteAll(int Fd, const std::string &Data) {
+  size_t Done = 0;
+  while (Done < Data.size()) {
+    ssize_t N = write(Fd, Data.data() + Done, Data.size() - Done);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Done += N;
+  }
+  return true;
+}
+
+} // namespace
+
+// A loaded graph and the searchers of the workers on it.
+struct DecodeServer::Generation {
+  std::string Path;
+  ResidentGraph RG;
+  std::vector<std::unique_ptr<GraphDecoder>> Decoders; //< Per worker.
+};
+
+// The requests of a batch grouped by the entry function, and the groups left
+// to decode.
+struct DecodeServer::Batch {
+  std::vector<uint64_t> EntryPcs;
+  std::vector<std::vector<Request*>> Groups;
+  std::mutex Lock;
+  std::condition_variable AllDone;
+  size_t Left = 0;
+};
+
+DecodeServer::DecodeServer(const SearchParams &P, unsigned NumThreads,
+                           Loader Load, size_t MaxCandidates,
+                           const CallSiteProfile *Ranking)
+  : P(P),
+    NumWorkers(NumThreads ? NumThreads : std::thread::hardware_concurrency()),
+    Load(Load), MaxCandidates(MaxCandidates), Ranking(Ranking),
+    Jobs(4 * (size_t)NumWorkers) {
+  if (!NumWorkers)
+    NumWorkers = 1;
+  for (unsigned W = 0; W < NumWorkers; W++)
+    Workers.emplace_back(&DecodeServer::WorkerLoop, this, W);
+}
+
+DecodeServer::~DecodeServer() {
+  Jobs.Close();
+  for (auto &T : Workers)
+    T.join();
+}
+
+std::shared_ptr<DecodeServer::Generation>
+DecodeServer::CurrentGeneration() const {
+  std::lock_guard<std::mutex> Guard(Lock);
+  return Current;
+}
+
+bool DecodeServer::Reload(const std::string &Path, std::string &Err) {
+  std::lock_guard<std::mutex> ReloadGuard(ReloadLock);
+  std::shared_ptr<Generation> Old = CurrentGeneration();
+  std::shared_ptr<Generation> New(new Generation());
+  New->Path = Path.empty() && Old ? Old->Path : Path;
+  if (New->Path.empty()) {
+    Err = "no graph to reload";
+    return false;
+  }
+  if (!Load(New->Path, New->RG, Err))
+    return false;
+  for (unsigned W = 0; W < NumWorkers; W++)
+    New->Decoders.push_back(WithHashPolicy(P.Kind, [&](auto Policy) {
+      return std::unique_ptr<GraphDecoder>(
+        new HashDecoder<decltype(Policy)>(*New->RG.Graph, P));
+    }));
+  std::lock_guard<std::mutex> Guard(Lock);
+  Current.swap(New);
+  // The old generation is freed here, or by the last batch still on it.
+  return true;
+}
+
+std::string DecodeServer::Describe() const {
+  std::shared_ptr<Generation> Gen = CurrentGeneration();
+  if (!Gen)
+    return "no graph";
+  return std::to_string(Gen->RG.Graph->NumFuncs()) + " functions, " +
+         std::to_string(Gen->RG.Graph->NumCallSites()) + " call sites from " +
+         Gen->Path;
+}
+
+void DecodeServer::WorkerLoop(unsigned WorkerId) {
+  Job J;
+  while (Jobs.Pop(J)) {
+    uint64_t EntryPc = J.B->EntryPcs[J.Group];
+    J.Gen->Decoders[WorkerId]->Decode(EntryPc, J.B->Groups[J.Group]);
+    for (Request *R : J.B->Groups[J.Group])
+      if (R->Candidates && R->Found)
+        R->Candidates->Rank(EntryPc, Ranking, *J.Gen->RG.Symbols);
+    std::lock_guard<std::mutex> Guard(J.B->Lock);
+    if (!--J.B->Left)
+      J.B->AllDone.notify_all();
+    // Drop the generation before waiting for the next job, so that a
+    // replaced graph is freed as soon as its batches are done.
+    J = Job();
+  }
+}
+
+void DecodeServer::DecodeBatch(std::vector<Request> &Requests) {
+  static const size_t QueriesPerSearch = 256;
+
+  std::shared_ptr<Generation> Gen = CurrentGeneration();
+  Batch B;
+  std::unordered_map<uint64_t, size_t> OpenGroup;
+  for (Request &R : Requests) {
+    if (!R.IsDecode || !R.Error.empty())
+      continue;
+    if (!Gen) {
+      R.Error = "no graph loaded";
+      continue;
+    }
+    // Large groups are split, so that they are spread among the workers.
+    auto It = OpenGroup.find(R.EntryPc);
+    if (It == OpenGroup.end() ||
+        B.Groups[It->second].size() == QueriesPerSearch) {
+      OpenGroup[R.EntryPc] = B.Groups.size();
+      B.EntryPcs.push_back(R.EntryPc);
+      B.Groups.emplace_back();
+      It = OpenGroup.find(R.EntryPc);
+    }
+    B.Groups[It->second].push_back(&R);
+  }
+  if (B.Groups.empty())
+    return;
+
+  B.Left = B.Groups.size();
+  for (size_t G = 0; G < B.Groups.size(); G++)
+    Jobs.Push({Gen, &B, G});
+  std::unique_lock<std::mutex> Guard(B.Lock);
+  B.AllDone.wait(Guard, [&] { return B.Left == 0; });
+}
+
+bool DecodeServer::ServeConnection(int InFd, int OutFd, std::string &Err) {
+  std::string Pending; //< Input after the last complete line.
+  std::vector<Request> Requests;
+  std::string Out;
+  char Buf[1 << 16];
+  bool AtEnd = false, Quit = false;
+
+  // Decode the requests read so far, and write their responses in order.
+  auto Flush = [&]() {
+    DecodeBatch(Requests);
+    char Hex[20];
+    for (const Request &R : Requests) {
+      if (!R.Error.empty()) {
+        Out += "error " + R.Error + "\n";
+      } else if (!R.Found) {
+        Out += "notfound\n";
+      } else if (R.Candidates) {
+        const CandidateSet &CS = *R.Candidates;
+        Out += "ok " + std::to_string(CS.size());
+        if (CS.IsTruncated())
+          Out += "+";
+        for (size_t C = 0; C < CS.size(); C++) {
+          ArrayRef<uint64_t> Frames = CS.Frames(CS[C]);
+          Out += Frames.empty() ? " -" : " ";
+          for (size_t F = 0; F < Frames.size(); F++) {
+            snprintf(Hex, sizeof(Hex), F ? ",%llx" : "%llx",
+                     (unsigned long long)Frames[F]);
+            Out += Hex;
+          }
+        }
+        Out += "\n";
+      } else {
+        Out += "ok";
+        for (uint64_t Pc : R.Frames) {
+          snprintf(Hex, sizeof(Hex), " %llx", (unsigned long long)Pc);
+          Out += Hex;
+        }
+        Out += "\n";
+      }
+    }
+    Requests.clear();
+    bool Written = WriteAll(OutFd, Out);
+    Out.clear();
+    if (!Written)
+      Err = std::string("cannot write the responses: ") + strerror(errno);
+    return Written;
+  };
+
+  while (!AtEnd && !Quit) {
+    ssize_t N = read(InFd, Buf, sizeof(Buf));
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0) {
+      Err = std::string("cannot read the requests: ") + strerror(errno);
+      return false;
+    }
+    AtEnd = N == 0;
+    Pending.append(Buf, N);
+    // The last line may lack the line break at the end of the input.
+    if (AtEnd && !Pending.empty() && Pending.back() != '\n')
+      Pending += '\n';
+
+    size_t LastBreak = Pending.rfind('\n');
+    size_t Complete = LastBreak == std::string::npos ? 0 : LastBreak + 1;
+    TextCursor In(Pending.data(), Pending.data() + Complete);
+    TextCursor Line(In);
+    while (In.NextLine(Line)) {
+      std::string_view Cmd;
+      if (!Line.ReadWord(Cmd))
+        continue;
+      if (Cmd == "decode" || Cmd == "candidates") {
+        Request R;
+        R.IsDecode = true;
+        if (Cmd == "candidates")
+          R.Candidates.reset(new CandidateSet(MaxCandidates));
+        uint64_t Words[2];
+        size_t NumWords = 0;
+        bool HasEntry = Line.ReadHex(R.EntryPc);
+        while (NumWords < 2 && Line.ReadHex(Words[NumWords]))
+          NumWords++;
+        Line.SkipSpaces();
+        if (!HasEntry || !NumWords || !Line.AtEnd())
+          R.Error = "expected the entry pc and one or two words";
+        else if (!CompressedTrace::Unpack(Words, NumWords, R.Wanted))
+          R.Error = "invalid compressed stack trace";
+        Requests.push_back(std::move(R));
+      } else if (Cmd == "reload" || Cmd == "quit") {
+        // The requests before are decoded on the graph they were sent for.
+        if (!Flush())
+          return false;
+        if (Cmd == "quit") {
+          Quit = true;
+          break;
+        }
+        std::string_view Path;
+        Line.ReadWord(Path);
+        std::string LoadErr;
+        if (Reload(std::string(Path), LoadErr))
+          Out += "ok reloaded " + Describe() + "\n";
+        else
+          Out += "error " + LoadErr + "\n";
+      } else {
+        Request R;
+        R.Error = "unknown request " + std::string(Cmd);
+        Requests.push_back(std::move(R));
+      }
+    }
+    Pending.erase(0, Complete);
+    if (!Flush())
+      return false;
+  }
+  return true;
+}
+
+bool DecodeServer::ServeSocket(const std::string &Path, std::string &Err) {
+  sockaddr_un Addr;
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (Path.size() >= sizeof(Addr.sun_path)) {
+    Err = "the socket path " + Path + " is too long";
+    return false;
+  }
+  memcpy(Addr.sun_path, Path.c_str(), Path.size() + 1);
+
+  // A socket left by an earlier server is replaced, any other file is not.
+  struct stat St;
+  if (stat(Path.c_str(), &St) == 0) {
+    if (!S_ISSOCK(St.st_mode)) {
+      Err = Path + " exists and is not a socket";
+      return false;
+    }
+    unlink(Path.c_str());
+  }
+  int Fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Fd < 0 || bind(Fd, (sockaddr*)&Addr, sizeof(Addr)) ||
+      listen(Fd, SOMAXCONN)) {
+    Err = "cannot listen on " + Path + ": " + strerror(errno);
+    if (Fd >= 0)
+      close(Fd);
+    return false;
+  }
+  // A client closing its connection early fails the write instead of
+  // killing the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Each connection is served by its own thread, which leaves the workers to
+  // the decoding. The threads are detached, and counted to be waited for.
+  std::mutex ConnLock;
+  std::condition_variable ConnDone;
+  size_t NumConns = 0;
+  while (true) {
+    int Conn = accept(Fd, nullptr, nullptr);
+    if (Conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      Err = std::string("cannot accept a connection: ") + strerror(errno);
+      break;
+    }
+    {
+      std::lock_guard<std::mutex> Guard(ConnLock);
+      NumConns++;
+    }
+    std::thread([&, Conn] {
+      std::string ConnErr;
+      ServeConnection(Conn, Conn, ConnErr);
+      close(Conn);
+      std::lock_guard<std::mutex> Guard(ConnLock);
+      if (!--NumConns)
+        ConnDone.notify_all();
+    }).detach();
+  }
+  close(Fd);
+  std::unique_lock<std::mutex> Guard(ConnLock);
+  ConnDone.wait(Guard, [&] { return NumConns == 0; });
+  return false;
+}
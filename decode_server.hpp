@@ -0,0 +1,133 @@
+#ifndef __DECODE_SERVER_H__
+#define __DECODE_SERVER_H__
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "call_site_profile.hpp"
+#include "candidates.hpp"
+#include "csr.hpp"
+#include "module_set.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
+#include "symtab.hpp"
+
+// A reverse call graph kept resident by the server, and whatever owns its
+// arrays: a mapped snapshot, the linked modules, or the graph built from a
+// call graph.
+struct ResidentGraph {
+  std::unique_ptr<Snapshot> Snap;
+  std::unique_ptr<ModuleSet> Modules;
+  std::unique_ptr<CsrReverseCallGraph> BuiltGraph;
+  std::unique_ptr<SymbolTable> BuiltSymbols;
+  const CsrReverseCallGraph *Graph = nullptr;
+  const SymbolTable *Symbols = nullptr;
+};
+
+// Serves the decoding of compressed stack traces on a reverse call graph that
+// is loaded once, so that a request costs the search alone.
+//
+// The protocol is line based. Each request line gets one response line, in
+// the order of the requests of the connection:
+//
+//   decode ENTRY_PC WORD0 [WORD1]  -> ok [PC...] | notfound | error MESSAGE
+//   candidates ENTRY_PC WORD0 [WORD1]
+//                                  -> ok COUNT[+] CANDIDATE... | notfound |
+//                                     error MESSAGE
+//   reload [PATH]                  -> ok reloaded ... | error MESSAGE
+//   quit                           -> (closes the connection)
+//
+// The words of a decode request are the packed compressed form in hex, as in
+// the records of a trace store (see CompressedTrace::Pack), and the frames of
+// the response are the call site pcs from the one calling the entry function
+// up, i.e., the frames after the entry point. Without the frames to compare
+// to, the first candidate matching the compressed form is returned.
+//
+// A candidates request gets all stack traces matching the compressed form
+// instead, up to the limit of the server and ranked from the most likely (see
+// CandidateSet::Rank). Each candidate is its frames joined by commas, or "-"
+// if it has none, and the count is followed by a "+" if there are more.
+//
+// The requests that have arrived on a connection together are decoded as a
+// batch: they are grouped by the entry function, and the groups are searched
+// by the worker threads with MultiQuerySearch, so that the connections share
+// the workers and a pipelining client gets its requests decoded together.
+//
+// A reload loads the new graph on the connection thread while the others keep
+// decoding on the old one. Each batch holds the graph it started on, which is
+// freed once the last batch on it is done, so no request in flight is
+// dropped or decoded on a mix of both.
+class DecodeServer {
+public:
+  // Load the graph at Path into RG. Returns false and sets Err on failure.
+  typedef std::function<bool(const std::string &Path, ResidentGraph &RG,
+                             std::string &Err)> Loader;
+
+  // Decode with the parameters the stack traces were compressed with, on
+  // NumThreads workers (0: all cores). The graph is loaded by Load. The
+  // candidates requests get at most MaxCandidates candidates, ranked by the
+  // profile Ranking if given.
+  DecodeServer(const SearchParams &P, unsigned NumThreads, Loader Load,
+               size_t MaxCandidates = 16,
+               const CallSiteProfile *Ranking = nullptr);
+
+  // Stops the workers. The connections must be closed.
+  ~DecodeServer();
+
+  DecodeServer(const DecodeServer&) = delete;
+  DecodeServer &operator=(const DecodeServer&) = delete;
+
+  // Load the graph at Path, replacing the current one for the batches that
+  // start after. Returns false and sets Err on failure, keeping the current
+  // graph. Thread-safe.
+  bool Reload(const std::string &Path, std::string &Err);
+
+  // Serve the requests read from InFd, writing the responses to OutFd, until
+  // the end of the input or a quit request. Returns false and sets Err if
+  // reading or writing fails.
+  bool ServeConnection(int InFd, int OutFd, std::string &Err);
+
+  // Accept connections on the Unix domain socket at Path, serving each on its
+  // own thread. Only returns on failure, with Err set.
+  bool ServeSocket(const std::string &Path, std::string &Err);
+
+  // Path and size of the current graph, to report.
+  std::string Describe() const;
+
+  // A request line, and its response once decoded.
+  struct Request;
+
+private:
+  struct Generation;
+  struct Batch;
+  struct Job {
+    std::shared_ptr<Generation> Gen;
+    Batch *B;
+    size_t Group;
+  };
+
+  SearchParams P;
+  unsigned NumWorkers;
+  Loader Load;
+  size_t MaxCandidates;
+  const CallSiteProfile *Ranking;
+
+  mutable std::mutex Lock;
+  std::shared_ptr<Generation> Current; //< Protected by Lock.
+  std::mutex ReloadLock; //< Held while loading, to load one graph at a time.
+
+  BoundedQueue<Job> Jobs;
+  std::vector<std::thread> Workers;
+
+  std::shared_ptr<Generation> CurrentGeneration() const;
+  void WorkerLoop(unsigned WorkerId);
+  void DecodeBatch(std::vector<Request> &Requests);
+};
+
+#endif
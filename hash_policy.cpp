@@ -0,0 +1,28 @@
+#include "hash_policy.hpp"
+
+const char *HashKindName(HashKind Kind) {
+  switch (Kind) {
+  case HashKind::Crc32Hw:
+    return "crc32-hw";
+  case HashKind::Crc32Sw:
+    return "crc32-sw";
+  case HashKind::MulXorShift:
+    return "mulxor";
+  }
+  return "unknown";
+}
+
+bool ParseHashKind(const std::string &Name, HashKind &Kind) {
+  for (HashKind K : {HashKind::Crc32Hw, HashKind::Crc32Sw,
+                     HashKind::MulXorShift}) {
+    if (Name != HashKindName(K))
+      continue;
+#ifndef __SSE4_2__
+    if (K == HashKind::Crc32Hw)
+      return false;
+#endif
+    Kind = K;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,144 @@
+#ifndef __HASH_POLICY_H__
+#define __HASH_POLICY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "crc32c.hpp"
+
+// The 32-bit state update of the stack trace hash, chosen at runtime.
+enum class HashKind {
+  Crc32Hw,     //< CRC32C with the SSE4.2 crc32 instruction.
+  Crc32Sw,     //< CRC32C with tables. Same values as Crc32Hw.
+  MulXorShift, //< Multiply-xorshift mixer.
+};
+
+#ifdef __SSE4_2__
+const HashKind DefaultHashKind = HashKind::Crc32Hw;
+#else
+const HashKind DefaultHashKind = HashKind::Crc32Sw;
+#endif
+
+// Name of the kind as given on the command line.
+const char *HashKindName(HashKind Kind);
+
+// Parse a name given by HashKindName. Returns false if unknown, or if the
+// kind is not supported by the build (Crc32Hw without SSE4.2).
+bool ParseHashKind(const std::string &Name, HashKind &Kind);
+
+// Hash policies. Step updates the state with a frame, and Unstep is its
+// inverse on the state for the same frame, which the meet-in-the-middle
+// search relies on. The searches are templates over the policy, so that the
+// step is inlined into the DFS.
+
+struct Crc32HwHash {
+  static const HashKind Kind = HashKind::Crc32Hw;
+  static uint32_t Step(uint32_t State, uint64_t PC) {
+#ifdef __SSE4_2__
+    return __builtin_ia32_crc32di(State, PC);
+#else
+    // Only reachable if instantiated; ParseHashKind rejects this kind.
+    return Crc32cStep(State, PC);
+#endif
+  }
+  static uint32_t Unstep(uint32_t State, uint64_t PC) {
+    return Crc32cUnstep(State, PC);
+  }
+};
+
+struct Crc32SwHash {
+  static const HashKind Kind = HashKind::Crc32Sw;
+  static uint32_t Step(uint32_t State, uint64_t PC) {
+    return Crc32cStep(State, PC);
+  }
+  static uint32_t Unstep(uint32_t State, uint64_t PC) {
+    return Crc32cUnstep(State, PC);
+  }
+};
+
+// The frame is folded into 32 bits and xor-ed into the state, which is then
+// mixed by the finalizer of MurmurHash3. Every operation of the finalizer is
+// a bijection on 32 bits, hence so is the step for a fixed frame.
+struct MulXorShiftHash {
+  static const HashKind Kind = HashKind::MulXorShift;
+  static const uint32_t Mul1 = 0x85ebca6b;
+  static const uint32_t Mul2 = 0xc2b2ae35;
+
+  // Inverse of an odd number modulo 2^32, by Newton's iteration.
+  static constexpr uint32_t Inverse(uint32_t A) {
+    uint32_t X = A; // Correct to 3 bits.
+    for (int I = 0; I < 4; I++)
+      X *= 2 - A * X;
+    return X;
+  }
+  static constexpr uint32_t Fold(uint64_t PC) {
+    uint64_t X = PC * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(X >> 32) ^ (uint32_t)X;
+  }
+  // Inverse of X ^= X >> Shift.
+  static constexpr uint32_t UnXorShift(uint32_t X, int Shift) {
+    uint32_t Res = X;
+    for (int I = Shift; I < 32; I += Shift)
+      Res = X ^ (Res >> Shift);
+    return Res;
+  }
+
+  static uint32_t Step(uint32_t State, uint64_t PC) {
+    uint32_t X = State ^ Fold(PC);
+    X ^= X >> 16;
+    X *= Mul1;
+    X ^= X >> 13;
+    X *= Mul2;
+    X ^= X >> 16;
+    return X;
+  }
+  static uint32_t Unstep(uint32_t State, uint64_t PC) {
+    uint32_t X = UnXorShift(State, 16);
+    X *= Inverse(Mul2);
+    X = UnXorShift(X, 13);
+    X *= Inverse(Mul1);
+    X = UnXorShift(X, 16);
+    return X ^ Fold(PC);
+  }
+};
+
+// Compute the hash after appending the frame at index Idx. The policy
+// updates the lower 32 bits, and the upper 32 bits hold the 16-bit buckets
+// that the pruning depths check: the lowest 16 bits of the state before the
+// frame at PruningDepth1 go to the highest bits, and the ones before the
+// frame at PruningDepth2 below them.
+template<class HashT>
+inline uint64_t HashStep(uint64_t Hash, uint64_t PC, size_t Idx,
+                         size_t PruningDepth1, size_t PruningDepth2) {
+  uint64_t State = HashT::Step((uint32_t)Hash, PC);
+  if (Idx == PruningDepth1) {
+    return State | (Hash << (48));
+  } else if (Idx == PruningDepth2) {
+    return State | ((Hash >> 48) << 48) | ((Hash & 0xFFFFll) << 32);
+  } else {
+    return State | ((Hash >> 32) << 32);
+  }
+}
+
+// The policies, for the explicit instantiations of the searches.
+#define FOR_EACH_HASH_POLICY(X) \
+  X(Crc32HwHash)                \
+  X(Crc32SwHash)                \
+  X(MulXorShiftHash)
+
+// Call Fn with a value of the policy type of the kind.
+template<class FnT>
+auto WithHashPolicy(HashKind Kind, FnT Fn) {
+  switch (Kind) {
+  case HashKind::Crc32Sw:
+    return Fn(Crc32SwHash());
+  case HashKind::MulXorShift:
+    return Fn(MulXorShiftHash());
+  case HashKind::Crc32Hw:
+  default:
+    return Fn(Crc32HwHash());
+  }
+}
+
+#endif
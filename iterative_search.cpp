@@ -0,0 +1,176 @@
+#include "iterative_search.hpp"
+#include "csr.hpp"
+#include "rcg.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// The DFS of SearchContext with an explicit stack, for constant depths.
+template<class GraphT, class HashT, size_t MaxDepth, size_t PruningDepth1,
+         size_t PruningDepth2>
+class IterativeSearch : public SpecializedSearch<GraphT> {
+  typedef typename GraphT::NodeRef NodeRef;
+  typedef typename GraphT::EdgeRef EdgeRef;
+
+  // A function on the current path, and the callers left to visit from it.
+  // The end of the callers is the same for all functions.
+  struct Frame {
+    EdgeRef Next;
+    uint64_t Hash; //< Hash of the path up to the function.
+  };
+
+  const GraphT &G;
+  std::array<Frame, MaxDepth + 1> Stack; //< Frame at each depth.
+  std::array<uint64_t, MaxDepth + 1> ST; //< Stack trace to fill.
+  BudgetMeter Meter;
+
+public:
+  explicit IterativeSearch(const GraphT &G) : G(G) {}
+
+  bool IsSpecialized() const override { return true; }
+
+  bool Reconstruct(uint64_t FuncEntryPc, const CompressedTrace &CT,
+                   const StackTrace &WantedST) override {
+    this->DoesNotMatchCount = 0;
+    this->BudgetExhausted = false;
+    NodeRef EntryFunc;
+    if (!G.FindFunc(FuncEntryPc, EntryFunc))
+      return false;
+
+    const uint64_t WantedHash = CT.Hash;
+    const uint64_t WantedHashMed1 = WantedHash >> 48;
+    const uint64_t WantedHashMed2 = (WantedHash >> 32) & 0xFFFFll;
+    size_t SearchEnd = MaxDepth + 1;
+    if (CT.HasDepth())
+      SearchEnd = std::min(SearchEnd, (size_t)CT.Depth);
+
+    Meter.Start(this->Budget);
+    if (!Meter.Step()) {
+      this->BudgetExhausted = true;
+      return false;
+    }
+    SearchStats *Stats = this->Stats;
+    if (Stats)
+      Stats->NodesPerDepth[0]++;
+
+    // The empty stack trace at the entry function.
+    if (WantedHash == 0 &&
+        CheckCandidate(CT, WantedST, ST.begin(), 0, this->DoesNotMatchCount))
+      return true;
+    if (SearchEnd == 0)
+      return false;
+    const EdgeRef End = G.CallersEnd(EntryFunc);
+    Stack[0] = {G.CallersBegin(EntryFunc), 0};
+    size_t Top = 1; //< Number of frames on the stack.
+
+    while (Top) {
+      Frame &F = Stack[Top - 1];
+      if (F.Next == End) {
+        Top--;
+        continue;
+      }
+      if (!Meter.Step()) {
+        this->BudgetExhausted = true;
+        return false;
+      }
+      EdgeRef E = F.Next;
+      ++F.Next;
+
+      // Fill the frame at the depth of F, and visit the caller one deeper.
+      size_t Depth = Top;
+      uint64_t CallSitePc = G.CallSitePc(E);
+      ST[Depth - 1] = CallSitePc;
+      uint64_t Hash = HashStep<HashT>(F.Hash, CallSitePc, Depth - 1,
+                                      PruningDepth1, PruningDepth2);
+
+      if (Stats)
+        Stats->NodesPerDepth[Depth]++;
+
+      // Check hash match
+      if (Hash == WantedHash &&
+          CheckCandidate(CT, WantedST, ST.begin(), Depth,
+                         this->DoesNotMatchCount))
+        return true;
+      if (Depth >= SearchEnd)
+        continue;
+      if (Depth == PruningDepth1 + 1) {
+        if ((Hash >> 48) != WantedHashMed1) {
+          if (Stats)
+            Stats->PrunedAtDepth1++;
+          continue;
+        }
+      } else if (Depth == PruningDepth2 + 1) {
+        if (((Hash >> 32) & 0xFFFFll) != WantedHashMed2) {
+          if (Stats)
+            Stats->PrunedAtDepth2++;
+          continue;
+        }
+      }
+
+      NodeRef Caller = G.Caller(E);
+      Stack[Top++] = {G.CallersBegin(Caller), Hash};
+    }
+    return false;
+  }
+};
+
+// The fallback for the other parameters.
+template<class GraphT, class HashT>
+class RecursiveSearch : public SpecializedSearch<GraphT> {
+  SearchContext<GraphT, HashT> Ctx;
+
+public:
+  RecursiveSearch(const GraphT &G, const SearchParams &P) : Ctx(G, P) {}
+
+  bool IsSpecialized() const override { return false; }
+
+  bool Reconstruct(uint64_t FuncEntryPc, const CompressedTrace &CT,
+                   const StackTrace &WantedST) override {
+    Ctx.Stats = this->Stats;
+    Ctx.Budget = this->Budget;
+    bool Ret = Ctx.Reconstruct(FuncEntryPc, CT, WantedST);
+    this->DoesNotMatchCount = Ctx.DoesNotMatchCount;
+    this->BudgetExhausted = Ctx.BudgetExhausted;
+    return Ret;
+  }
+};
+
+} // namespace
+
+// The combinations of (max_depth, pruning_depth_1, pruning_depth_2) that the
+// search is compiled for.
+#define SPECIALIZED_SEARCH_PARAMS(X) \
+  X(8, 3, 5)                         \
+  X(10, 3, 5)                        \
+  X(12, 3, 5)                        \
+  X(12, 4, 6)                        \
+  X(16, 4, 6)                        \
+  X(16, 4, 8)                        \
+  X(20, 4, 8)                        \
+  X(24, 6, 10)                       \
+  X(32, 6, 10)
+
+template<class GraphT, class HashT>
+std::unique_ptr<SpecializedSearch<GraphT>>
+MakeSpecializedSearch(const GraphT &G, const SearchParams &P) {
+#define X(MD, PD1, PD2)                                                      \
+  if (P.MaxDepth == MD && P.PruningDepth1 == PD1 && P.PruningDepth2 == PD2)  \
+    return std::unique_ptr<SpecializedSearch<GraphT>>(                       \
+      new IterativeSearch<GraphT, HashT, MD, PD1, PD2>(G));
+  SPECIALIZED_SEARCH_PARAMS(X)
+#undef X
+  return std::unique_ptr<SpecializedSearch<GraphT>>(
+    new RecursiveSearch<GraphT, HashT>(G, P));
+}
+
+#define X(HashT)                                                              \
+  template std::unique_ptr<SpecializedSearch<ReverseCallGraph>>              \
+  MakeSpecializedSearch<ReverseCallGraph, HashT>(const ReverseCallGraph &G,  \
+                                                 const SearchParams &P);     \
+  template std::unique_ptr<SpecializedSearch<CsrReverseCallGraph>>           \
+  MakeSpecializedSearch<CsrReverseCallGraph, HashT>(                         \
+    const CsrReverseCallGraph &G, const SearchParams &P);
+FOR_EACH_HASH_POLICY(X)
+#undef X
@@ -0,0 +1,41 @@
+#ifndef __ITERATIVE_SEARCH_H__
+#define __ITERATIVE_SEARCH_H__
+
+#include <cstdint>
+#include <memory>
+
+#include "search.hpp"
+
+// A reconstruction search picked at runtime by MakeSpecializedSearch. Same
+// interface as SearchContext.
+template<class GraphT>
+class SpecializedSearch {
+public:
+  int DoesNotMatchCount = 0; //< Count how many incorrect reconstructions
+                             //< were made in the last search.
+  SearchStats *Stats = nullptr; //< Same as SearchContext::Stats.
+  SearchBudget Budget;          //< Same as SearchContext::Budget.
+  bool BudgetExhausted = false; //< Same as SearchContext::BudgetExhausted.
+
+  virtual ~SpecializedSearch() {}
+
+  // Whether this is compiled for the search parameters, rather than the
+  // fallback to SearchContext.
+  virtual bool IsSpecialized() const = 0;
+
+  // Same as SearchContext::Reconstruct.
+  virtual bool Reconstruct(uint64_t FuncEntryPc, const CompressedTrace &CT,
+                           const StackTrace &WantedST) = 0;
+};
+
+// Create the search for the parameters. If the maximum depth and the pruning
+// depths are one of the common combinations, the search is a non-recursive
+// DFS compiled for them: the depths are constants, so the pruning checks and
+// the bucket placement in HashStep compare against immediates, and the DFS
+// stack is a fixed array. Otherwise, it is the recursive SearchContext. HashT
+// is the hash policy of the parameters.
+template<class GraphT, class HashT>
+std::unique_ptr<SpecializedSearch<GraphT>>
+MakeSpecializedSearch(const GraphT &G, const SearchParams &P);
+
+#endif
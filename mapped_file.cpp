@@ -0,0 +1,46 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+void MappedFile::Close() {
+  if (Size)
+    munmap(const_cast<char*>(Data), Size);
+  Data = nullptr;
+  Size = 0;
+}
+
+bool MappedFile::Open(const std::string &Path, std::string &Err) {
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0) {
+    Err = "cannot open " + Path + ": " + strerror(errno);
+    return false;
+  }
+  struct stat St;
+  if (fstat(Fd, &St)) {
+    Err = "cannot stat " + Path + ": " + strerror(errno);
+    close(Fd);
+    return false;
+  }
+  // An empty file cannot be mapped, and is left as an empty range.
+  if (St.st_size) {
+    void *Addr = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    if (Addr == MAP_FAILED) {
+      Err = "cannot map " + Path + ": " + strerror(errno);
+      close(Fd);
+      return false;
+    }
+    Data = static_cast<const char*>(Addr);
+    Size = St.st_size;
+  }
+  close(Fd);
+  return true;
+}
@@ -0,0 +1,29 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <cstddef>
+#include <string>
+
+// A file mapped read-only into memory. The mapping is released on
+// destruction.
+class MappedFile {
+  const char *Data;
+  size_t Size;
+
+public:
+  MappedFile() : Data(nullptr), Size(0) {}
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile &operator=(const MappedFile&) = delete;
+
+  // Map the file. Returns false and sets Err on failure.
+  bool Open(const std::string &Path, std::string &Err);
+
+  // Release the mapping early.
+  void Close();
+
+  const char *data() const { return Data; }
+  size_t size() const { return Size; }
+};
+
+#endif
@@ -0,0 +1,24 @@
+#include "memory_usage.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+bool ProcessMemory::Read() {
+  FILE *F = fopen("/proc/self/status", "r");
+  if (!F)
+    return false;
+  char Line[256];
+  size_t KiB;
+  int NumRead = 0;
+  while (fgets(Line, sizeof(Line), F)) {
+    if (sscanf(Line, "VmRSS: %zu kB", &KiB) == 1) {
+      RssBytes = KiB << 10;
+      NumRead++;
+    } else if (sscanf(Line, "VmHWM: %zu kB", &KiB) == 1) {
+      PeakRssBytes = KiB << 10;
+      NumRead++;
+    }
+  }
+  fclose(F);
+  return NumRead == 2;
+}
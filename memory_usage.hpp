@@ -0,0 +1,76 @@
+#ifndef __MEMORY_USAGE_H__
+#define __MEMORY_USAGE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Memory of the process, read from /proc/self/status.
+struct ProcessMemory {
+  size_t RssBytes = 0;     //< Resident set size now.
+  size_t PeakRssBytes = 0; //< Largest resident set size so far.
+
+  // Returns false if the status cannot be read, e.g., not on Linux.
+  bool Read();
+};
+
+// Estimated heap bytes of the containers, as laid out by libstdc++: a vector
+// is its capacity, and a hash table is its bucket array and a node per
+// element holding the next pointer and the element (and the hash of the
+// non-integral keys). The heap bytes of the elements are added, e.g., of the
+// nested vectors and of the strings beyond the small string buffer.
+template<class T>
+std::enable_if_t<std::is_trivially_copyable<T>::value, size_t>
+HeapBytes(const T &) { return 0; }
+inline size_t HeapBytes(const std::string &S) {
+  return S.capacity() > 15 ? S.capacity() + 1 : 0;
+}
+template<class... Ts> size_t HeapBytes(const std::tuple<Ts...> &);
+template<class A, class B> size_t HeapBytes(const std::pair<A, B> &P);
+template<class T> size_t HeapBytes(const std::vector<T> &V);
+template<class K, class V>
+size_t HeapBytes(const std::unordered_map<K, V> &M);
+template<class K> size_t HeapBytes(const std::unordered_set<K> &S);
+
+template<class... Ts>
+size_t HeapBytes(const std::tuple<Ts...> &) { return 0; }
+template<class A, class B>
+size_t HeapBytes(const std::pair<A, B> &P) {
+  return HeapBytes(P.first) + HeapBytes(P.second);
+}
+template<class T>
+size_t HeapBytes(const std::vector<T> &V) {
+  size_t Res = V.capacity() * sizeof(T);
+  for (const T &El : V)
+    Res += HeapBytes(El);
+  return Res;
+}
+
+template<class T>
+size_t HashTableBytes(const T &Table) {
+  typedef typename T::value_type V;
+  typedef typename T::key_type K;
+  size_t NodeBytes = sizeof(void*) + sizeof(V) +
+                     (std::is_integral<K>::value ? 0 : sizeof(size_t));
+  size_t Res = Table.bucket_count() * sizeof(void*) +
+               Table.size() * NodeBytes;
+  for (const V &El : Table)
+    Res += HeapBytes(El);
+  return Res;
+}
+template<class K, class V>
+size_t HeapBytes(const std::unordered_map<K, V> &M) {
+  return HashTableBytes(M);
+}
+template<class K>
+size_t HeapBytes(const std::unordered_set<K> &S) {
+  return HashTableBytes(S);
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "mitm.hpp"
+#include "csr.hpp"
+#include "rcg.hpp"
+
+#include <algorithm>
+
+template<class GraphT>
+CalleeIndex<GraphT>::CalleeIndex(const GraphT &G) {
+  // Group the edges by the caller.
+  std::unordered_map<NodeRef, std::vector<Edge>> Grouped;
+  G.ForEachFunc([&](NodeRef Callee) {
+    for (auto E = G.CallersBegin(Callee), End = G.CallersEnd(Callee);
+         E != End; ++E)
+      Grouped[G.Caller(E)].push_back({G.CallSitePc(E), Callee});
+  });
+
+  for (const auto &El : Grouped) {
+    size_t Begin = AllEdges.size();
+    AllEdges.insert(AllEdges.end(), El.second.begin(), El.second.end());
+    FuncToCallees[El.first] = std::make_pair(Begin, AllEdges.size());
+  }
+}
+
+template<class GraphT, class HashT>
+MeetInTheMiddleSearch<GraphT, HashT>::MeetInTheMiddleSearch(
+    const GraphT &G, const CalleeIndex<GraphT> &Callees, const SearchParams &P,
+    size_t ForwardDepth)
+  : G(G), Callees(Callees), P(P),
+    ForwardDepth(std::min(ForwardDepth, P.MaxDepth + 1)), WantedST(nullptr),
+    WantedHash(0), SearchEnd(0), BucketsOrdered(P.PruningDepth1 < P.PruningDepth2),
+    ST(P.MaxDepth + 1), DoesNotMatchCount(0), BudgetExhausted(false) {}
+
+// Fill the first Length frames of ST from the forward path.
+template<class GraphT, class HashT>
+void MeetInTheMiddleSearch<GraphT, HashT>::FillPath(uint32_t Path,
+                                                   size_t Length) {
+  for (size_t I = Length; I > 0; I--) {
+    ST[I - 1] = Paths[Path].CallSitePc;
+    Path = Paths[Path].Parent;
+  }
+}
+
+// Check the candidate stack trace of the given depth.
+template<class GraphT, class HashT>
+bool MeetInTheMiddleSearch<GraphT, HashT>::Verify(size_t Depth) {
+  uint64_t H = 0;
+  for (size_t I = 0; I < Depth; I++)
+    H = HashStep<HashT>(H, ST[I], I, P.PruningDepth1, P.PruningDepth2);
+  return H == WantedHash &&
+         CheckCandidate(Wanted, *WantedST, ST.begin(), Depth,
+                        DoesNotMatchCount);
+}
+
+// Enumerate the paths up to ForwardDepth. This is the same as the DFS of
+// SearchContext, except that the paths reaching ForwardDepth are recorded
+// instead of being searched further.
+template<class GraphT, class HashT>
+bool MeetInTheMiddleSearch<GraphT, HashT>::Forward(size_t CurrentDepth,
+                                                   uint64_t CurrentHash,
+                                                   NodeRef EntryFunc,
+                                                   uint32_t Path) {
+  if (!Meter.Step())
+    return false;
+
+  // Check hash match
+  if (CurrentHash == WantedHash) {
+    FillPath(Path, CurrentDepth);
+    if (CheckCandidate(Wanted, *WantedST, ST.begin(), CurrentDepth,
+                       DoesNotMatchCount))
+      return true;
+  }
+
+  if (CurrentDepth >= SearchEnd)
+    return false;
+  if (CurrentDepth == ForwardDepth) {
+    Meets.push_back({(uint32_t)CurrentHash, EntryFunc, Path});
+    return false;
+  }
+
+  // ForwardDepth <= MaxDepth+1, so the depth is within the maximum depth.
+  if (CurrentDepth == P.PruningDepth1+1) {
+    if ((CurrentHash >> 48) != (WantedHash >> 48))
+      return false;
+  } else if (CurrentDepth == P.PruningDepth2+1) {
+    if (((CurrentHash >> 32) & 0xFFFFll) != ((WantedHash >> 32) & 0xFFFFll))
+      return false;
+  }
+
+  for (auto E = G.CallersBegin(EntryFunc), End = G.CallersEnd(EntryFunc);
+       E != End; ++E) {
+    uint64_t CallSitePc = G.CallSitePc(E);
+    Paths.push_back({Path, CallSitePc});
+    if (Forward(CurrentDepth + 1,
+                HashStep<HashT>(CurrentHash, CallSitePc, CurrentDepth,
+                                P.PruningDepth1, P.PruningDepth2),
+                G.Caller(E), Paths.size() - 1))
+      return true;
+  }
+  return false;
+}
+
+// Take the edge as the frame at CurrentDepth-1 going backwards, given the
+// state after it.
+template<class GraphT, class HashT>
+bool MeetInTheMiddleSearch<GraphT, HashT>::BackwardStep(const Edge &E,
+                                                        size_t CurrentDepth,
+                                                        uint32_t State,
+                                                        size_t Depth) {
+  if (!Meter.Step())
+    return false;
+  size_t Idx = CurrentDepth - 1;
+  uint32_t PrevState = HashT::Unstep(State, E.CallSitePc);
+
+  // The buckets hold the lowest 16-bits of the states before the frames at
+  // the pruning depths.
+  if (BucketsOrdered) {
+    if (Idx == P.PruningDepth1 &&
+        (PrevState & 0xFFFF) != (WantedHash >> 48))
+      return false;
+    if (Idx == P.PruningDepth2 &&
+        (PrevState & 0xFFFF) != ((WantedHash >> 32) & 0xFFFFll))
+      return false;
+  }
+
+  ST[Idx] = E.CallSitePc;
+  return Backward(Idx, PrevState, E.Callee, Depth);
+}
+
+// Enumerate the frames below CurrentDepth backwards, down to ForwardDepth
+// where the forward paths are joined. Callee is the target of the frame at
+// CurrentDepth, hence the frame below is one of its call sites.
+template<class GraphT, class HashT>
+bool MeetInTheMiddleSearch<GraphT, HashT>::Backward(size_t CurrentDepth,
+                                                    uint32_t State,
+                                                    NodeRef Callee,
+                                                    size_t Depth) {
+  if (CurrentDepth == ForwardDepth) {
+    Meet Key = {State, Callee, 0};
+    auto Range = std::equal_range(Meets.begin(), Meets.end(), Key);
+    for (auto It = Range.first; It != Range.second; ++It) {
+      FillPath(It->Path, ForwardDepth);
+      if (Verify(Depth))
+        return true;
+    }
+    return false;
+  }
+
+  auto It = Callees.FuncToCallees.find(Callee);
+  if (It == Callees.FuncToCallees.end())
+    return false;
+  for (size_t I = It->second.first; I < It->second.second; I++)
+    if (BackwardStep(Callees.AllEdges[I], CurrentDepth, State, Depth))
+      return true;
+  return false;
+}
+
+template<class GraphT, class HashT>
+bool MeetInTheMiddleSearch<GraphT, HashT>::Reconstruct(
+    uint64_t FuncEntryPc, const CompressedTrace &CT,
+    const StackTrace &WantedST) {
+  NodeRef EntryFunc;
+  if (!G.FindFunc(FuncEntryPc, EntryFunc))
+    return false;
+  this->WantedST = &WantedST;
+  Wanted = CT;
+  WantedHash = CT.Hash;
+  SearchEnd = P.MaxDepth + 1;
+  if (CT.HasDepth())
+    SearchEnd = std::min(SearchEnd, (size_t)CT.Depth);
+  DoesNotMatchCount = 0;
+  BudgetExhausted = false;
+  Meter.Start(Budget);
+
+  // Forward half. This also covers the stack traces up to ForwardDepth.
+  Paths.assign(1, PathNode{0, 0});
+  Meets.clear();
+  if (Forward(/*CurrentDepth=*/0, /*CurrentHash=*/0, EntryFunc,
+              /*Path=*/0))
+    return true;
+  std::sort(Meets.begin(), Meets.end());
+
+  // Backward half, for each depth beyond ForwardDepth, or only the recorded
+  // depth if known.
+  uint64_t WantedUpper = WantedHash >> 32;
+  size_t FirstDepth = ForwardDepth + 1;
+  if (CT.HasDepth())
+    FirstDepth = std::max(FirstDepth, SearchEnd);
+  for (size_t Depth = FirstDepth; Depth <= SearchEnd && !Meter.Exhausted();
+       Depth++) {
+    // The buckets are zero unless the stack trace reaches past the pruning
+    // depths.
+    if (BucketsOrdered) {
+      if (Depth <= P.PruningDepth1 && WantedUpper)
+        continue;
+      if (Depth <= P.PruningDepth2 && (WantedUpper & 0xFFFF))
+        continue;
+    }
+
+    // The last frame can be any call site.
+    for (const auto &E : Callees.AllEdges)
+      if (BackwardStep(E, Depth, (uint32_t)WantedHash, Depth))
+        return true;
+  }
+  BudgetExhausted = Meter.Exhausted();
+  return false;
+}
+
+template struct CalleeIndex<ReverseCallGraph>;
+template struct CalleeIndex<CsrReverseCallGraph>;
+#define X(HashT)                                                  \
+  template class MeetInTheMiddleSearch<ReverseCallGraph, HashT>; \
+  template class MeetInTheMiddleSearch<CsrReverseCallGraph, HashT>;
+FOR_EACH_HASH_POLICY(X)
+#undef X
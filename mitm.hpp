@@ -0,0 +1,108 @@
+#ifndef __MEET_IN_THE_MIDDLE_H__
+#define __MEET_IN_THE_MIDDLE_H__
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "search.hpp"
+
+// Edges of the reverse call graph indexed by the function that contains the
+// call site, i.e., the call graph in the forward direction. Built once and
+// shared read-only by the meet-in-the-middle searches.
+template<class GraphT>
+struct CalleeIndex {
+  typedef typename GraphT::NodeRef NodeRef;
+
+  struct Edge {
+    uint64_t CallSitePc; //< Call site pc.
+    NodeRef Callee;      //< A potential target of the call site.
+  };
+
+  std::vector<Edge> AllEdges; //< Every edge, grouped by the caller.
+  std::unordered_map<NodeRef,
+                     std::pair<size_t, size_t>/*[Begin, End) in AllEdges*/
+                    > FuncToCallees;
+
+  CalleeIndex(const GraphT &G);
+};
+
+// Reconstruction search from both ends of the stack trace.
+//
+// The step of the hash policy HashT is bijective on its 32-bit state for a
+// given frame, so the state before the last frame can be computed from the
+// hash and the last frame with HashT::Unstep. The search enumerates the paths
+// from the entry function up to ForwardDepth, and records the state and the
+// function reached by each. Then, for each depth beyond, it enumerates the
+// last frames backwards from the wanted hash down to ForwardDepth, and joins
+// on the recorded states. The 16-bit buckets set at the pruning depths
+// constrain the states at those depths, and prune the enumeration in both
+// directions.
+//
+// The cost is about fan-in^ForwardDepth for the forward half, and the number
+// of edges times fan-out^(depth-ForwardDepth-1) pruned by the buckets for the
+// backward half, rather than fan-in^depth.
+template<class GraphT, class HashT>
+class MeetInTheMiddleSearch {
+  typedef typename GraphT::NodeRef NodeRef;
+  typedef typename CalleeIndex<GraphT>::Edge Edge;
+
+  const GraphT &G;
+  const CalleeIndex<GraphT> &Callees;
+  const SearchParams &P;
+  size_t ForwardDepth;
+
+  const StackTrace *WantedST; //< Wanted stack trace.
+  CompressedTrace Wanted;     //< The compressed WantedST.
+  uint64_t WantedHash;        //< The hash for WantedST.
+  size_t SearchEnd;           //< Depth not to search beyond.
+  bool BucketsOrdered;        //< Whether PruningDepth1 < PruningDepth2.
+
+  // Paths enumerated forward, as a tree of frames. Path 0 is the empty path.
+  struct PathNode {
+    uint32_t Parent;
+    uint64_t CallSitePc;
+  };
+  std::vector<PathNode> Paths;
+
+  // State and function at ForwardDepth per forward path, sorted to join.
+  struct Meet {
+    uint32_t State;
+    NodeRef Func;
+    uint32_t Path;
+
+    bool operator<(const Meet &O) const {
+      return State != O.State ? State < O.State : Func < O.Func;
+    }
+  };
+  std::vector<Meet> Meets;
+
+  std::vector<uint64_t> ST; //< Candidate stack trace.
+
+  // Counts the forward states and the backward steps.
+  BudgetMeter Meter;
+
+  bool Forward(size_t CurrentDepth, uint64_t CurrentHash, NodeRef EntryFunc,
+               uint32_t Path);
+  bool Backward(size_t CurrentDepth, uint32_t State, NodeRef Callee,
+                size_t Depth);
+  bool BackwardStep(const Edge &E, size_t CurrentDepth,
+                    uint32_t State, size_t Depth);
+  bool Verify(size_t Depth);
+  void FillPath(uint32_t Path, size_t Length);
+
+public:
+  int DoesNotMatchCount;      //< Count how many incorrect reconstructions
+                              //< were made in the last search.
+  SearchBudget Budget;        //< Same as SearchContext::Budget.
+  bool BudgetExhausted;       //< Same as SearchContext::BudgetExhausted.
+
+  MeetInTheMiddleSearch(const GraphT &G, const CalleeIndex<GraphT> &Callees,
+                        const SearchParams &P, size_t ForwardDepth);
+
+  // Same as SearchContext::Reconstruct.
+  bool Reconstruct(uint64_t FuncEntryPc, const CompressedTrace &CT,
+                   const StackTrace &WantedST);
+};
+
+#endif
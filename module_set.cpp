@@ -0,0 +1,383 @@
+#include "module_set.hpp"
+#include "hash_policy.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+namespace {
+
+const char ModuleMapHeader[] = "# st_reconst modules";
+
+#ifdef __SSE4_2__
+typedef Crc32HwHash KeyHash;
+#else
+typedef Crc32SwHash KeyHash;
+#endif
+
+// Key of the content of the file: its size and its CRC32C, so that a module
+// keeps its cached graph as long as its call graph is the same, wherever it
+// was copied from.
+bool ContentKey(const std::string &Path, uint64_t &Key, std::string &Err) {
+  MappedFile File;
+  if (!File.Open(Path, Err))
+    return false;
+  uint32_t Crc = ~0u;
+  size_t I = 0;
+  for (; I + 8 <= File.size(); I += 8) {
+    uint64_t Word;
+    memcpy(&Word, File.data() + I, 8);
+    Crc = KeyHash::Step(Crc, Word);
+  }
+  uint64_t Tail = 0;
+  memcpy(&Tail, File.data() + I, File.size() - I);
+  Crc = KeyHash::Step(Crc, Tail);
+  Key = (uint64_t)File.size() << 32 | Crc;
+  return true;
+}
+
+const char *OrderName(CsrReverseCallGraph::Order O) {
+  switch (O) {
+  case CsrReverseCallGraph::Order::EntryPc: return "pc";
+  case CsrReverseCallGraph::Order::Bfs: return "bfs";
+  case CsrReverseCallGraph::Order::Rcm: return "rcm";
+  }
+  return "";
+}
+
+} // namespace
+
+struct ModuleSet::Module {
+  ModuleSpec Spec;
+  uint64_t Key;
+  // Either the mapped snapshot, or the graph built from the call graph.
+  Snapshot Snap;
+  std::unique_ptr<CsrReverseCallGraph> BuiltGraph;
+  std::unique_ptr<SymbolTable> BuiltSymbols;
+  const CsrReverseCallGraph *G = nullptr;
+  const SymbolTable *Syms = nullptr;
+  // Lowest and highest pc of the module, if Low <= High.
+  uint64_t Low = UINT64_MAX;
+  uint64_t High = 0;
+
+  void SetGraph(const CsrReverseCallGraph &Graph, const SymbolTable &Table) {
+    G = &Graph;
+    Syms = &Table;
+    auto Extend = [&](uint64_t Pc) {
+      Low = std::min(Low, Pc);
+      High = std::max(High, Pc);
+    };
+    if (!G->IdsByPc.empty()) {
+      Extend(G->FuncPcs[G->IdsByPc[0]]);
+      Extend(G->FuncPcs[G->IdsByPc[G->IdsByPc.size() - 1]]);
+    }
+    if (!Syms->FuncPcs.empty()) {
+      Extend(Syms->FuncPcs[0]);
+      Extend(Syms->FuncPcs[Syms->FuncPcs.size() - 1]);
+    }
+    if (!Syms->CallSitePcs.empty()) {
+      Extend(Syms->CallSitePcs[0]);
+      Extend(Syms->CallSitePcs[Syms->CallSitePcs.size() - 1]);
+    }
+  }
+};
+
+bool ModuleSet::IsModuleMap(const std::string &Path) {
+  std::ifstream In(Path);
+  std::string Line;
+  return std::getline(In, Line) && Line == ModuleMapHeader;
+}
+
+bool ModuleSet::ReadModuleMap(const std::string &Path,
+                              std::vector<ModuleSpec> &Specs,
+                              std::string &Err) {
+  std::ifstream In(Path);
+  std::string Line;
+  if (!std::getline(In, Line) || Line != ModuleMapHeader) {
+    Err = Path + " is not a module map";
+    return false;
+  }
+  size_t Slash = Path.rfind('/');
+  std::string Dir = Slash == std::string::npos ? "" : Path.substr(0, Slash + 1);
+  for (size_t LineNo = 2; std::getline(In, Line); LineNo++) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream Fields(Line);
+    ModuleSpec Spec;
+    std::string Base;
+    Fields >> Spec.Name >> Base >> std::ws;
+    std::getline(Fields, Spec.Path);
+    char *End = nullptr;
+    Spec.Base = strtoull(Base.c_str(), &End, 16);
+    if (Spec.Path.empty() || Base.empty() || *End) {
+      Err = Path + ":" + std::to_string(LineNo) +
+            ": expected the name, the base in hex and the path of a module";
+      return false;
+    }
+    if (Spec.Path[0] != '/')
+      Spec.Path = Dir + Spec.Path;
+    Specs.push_back(Spec);
+  }
+  return true;
+}
+
+ModuleSet::ModuleSet(const CallGraphFilter &CGF, CsrReverseCallGraph::Order O,
+                     const std::string &CacheDir, WorkStealingPool *Pool)
+  : CGF(CGF), O(O), CacheDir(CacheDir), Pool(Pool) {}
+
+ModuleSet::~ModuleSet() {}
+
+std::unique_ptr<ModuleSet::Module>
+ModuleSet::OpenModule(const ModuleSpec &Spec, uint64_t Key,
+                      std::string &Err) {
+  std::unique_ptr<Module> M(new Module());
+  M->Spec = Spec;
+  M->Key = Key;
+  if (Snapshot::IsSnapshot(Spec.Path)) {
+    if (!M->Snap.Load(Spec.Path, Err))
+      return nullptr;
+    M->SetGraph(M->Snap.Graph(), M->Snap.Symbols());
+    Stats.NumCached++;
+    return M;
+  }
+
+  // The cached graph of the same content, unless it is of an older version.
+  std::string CachePath;
+  if (!CacheDir.empty()) {
+    std::string Name = Spec.Name;
+    std::replace(Name.begin(), Name.end(), '/', '_');
+    char KeyHex[17];
+    snprintf(KeyHex, sizeof(KeyHex), "%016llx", (unsigned long long)Key);
+    CachePath = CacheDir + "/" + Name + "." + OrderName(O) + "." + KeyHex +
+                ".snap";
+    std::string LoadErr;
+    if (Snapshot::IsSnapshot(CachePath) && M->Snap.Load(CachePath, LoadErr)) {
+      M->SetGraph(M->Snap.Graph(), M->Snap.Symbols());
+      Stats.NumCached++;
+      return M;
+    }
+  }
+
+  MappedFile File;
+  if (!File.Open(Spec.Path, Err))
+    return nullptr;
+  {
+    CallGraph CG(std::string_view(File.data(), File.size()), CGF,
+                 /*LowMemory=*/false, /*MeasureMemory=*/false, Pool);
+    M->BuiltSymbols.reset(new SymbolTable(CG));
+    M->BuiltGraph.reset(new CsrReverseCallGraph(CG, O, Pool));
+  }
+  M->SetGraph(*M->BuiltGraph, *M->BuiltSymbols);
+  Stats.NumBuilt++;
+
+  // Written aside and renamed, so that a concurrent run never maps a partial
+  // file. A module that cannot be cached is still used.
+  if (!CachePath.empty()) {
+    std::string TmpPath = CachePath + ".tmp" + std::to_string(getpid());
+    std::string WriteErr;
+    if (!Snapshot::Write(TmpPath, *M->G, *M->Syms, WriteErr) ||
+        rename(TmpPath.c_str(), CachePath.c_str())) {
+      remove(TmpPath.c_str());
+      std::cerr << "WARNING: Cannot cache the graph of " << Spec.Name << ": "
+                << (WriteErr.empty() ? strerror(errno) : WriteErr)
+                << std::endl;
+    }
+  }
+  return M;
+}
+
+bool ModuleSet::Update(const std::vector<ModuleSpec> &Specs,
+                       std::string &Err) {
+  Stats = UpdateStats();
+  // The modules that did not change are moved over once all others are open,
+  // so that the set is left as it was on failure.
+  std::vector<std::unique_ptr<Module>> Opened(Specs.size());
+  std::vector<size_t> KeptIndex(Specs.size(), SIZE_MAX);
+  for (size_t I = 0; I < Specs.size(); I++) {
+    for (size_t J = 0; J < I; J++)
+      if (Specs[J].Name == Specs[I].Name) {
+        Err = "module " + Specs[I].Name + " is given twice";
+        return false;
+      }
+    uint64_t Key;
+    if (!ContentKey(Specs[I].Path, Key, Err))
+      return false;
+    for (size_t J = 0; J < Modules.size(); J++)
+      if (Modules[J]->Spec.Name == Specs[I].Name &&
+          Modules[J]->Spec.Path == Specs[I].Path && Modules[J]->Key == Key)
+        KeptIndex[I] = J;
+    if (KeptIndex[I] != SIZE_MAX) {
+      Stats.NumKept++;
+      continue;
+    }
+    Opened[I] = OpenModule(Specs[I], Key, Err);
+    if (!Opened[I]) {
+      Err = "module " + Specs[I].Name + ": " + Err;
+      return false;
+    }
+  }
+
+  // The modules must not overlap at their bases, so that the linked arrays
+  // are sorted by pc as those of each module.
+  std::vector<std::pair<const ModuleSpec*, const Module*>> ByBase;
+  for (size_t I = 0; I < Specs.size(); I++)
+    ByBase.emplace_back(&Specs[I], Opened[I] ? Opened[I].get()
+                                             : Modules[KeptIndex[I]].get());
+  std::stable_sort(ByBase.begin(), ByBase.end(), [](auto &A, auto &B) {
+    return A.first->Base < B.first->Base;
+  });
+  uint64_t NumFuncs = 0, NumCallSites = 0;
+  const ModuleSpec *Prev = nullptr;
+  uint64_t PrevHigh = 0;
+  for (const auto &El : ByBase) {
+    const Module &M = *El.second;
+    NumFuncs += M.G->NumFuncs();
+    NumCallSites += M.G->NumCallSites();
+    if (M.Low > M.High)
+      continue;
+    if (M.High > UINT64_MAX - El.first->Base) {
+      Err = "module " + El.first->Name + " does not fit at its base";
+      return false;
+    }
+    if (Prev && El.first->Base + M.Low <= PrevHigh) {
+      Err = "modules " + Prev->Name + " and " + El.first->Name + " overlap";
+      return false;
+    }
+    Prev = El.first;
+    PrevHigh = El.first->Base + M.High;
+  }
+  if (NumFuncs > UINT32_MAX || NumCallSites > UINT32_MAX) {
+    Err = "the modules have too many functions or call sites to be linked";
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Module>> NewModules;
+  for (size_t I = 0; I < Specs.size(); I++) {
+    if (!Opened[I])
+      Opened[I] = std::move(Modules[KeptIndex[I]]);
+    Opened[I]->Spec.Base = Specs[I].Base;
+    NewModules.push_back(std::move(Opened[I]));
+  }
+  std::stable_sort(NewModules.begin(), NewModules.end(),
+                   [](const auto &A, const auto &B) {
+                     return A->Spec.Base < B->Spec.Base;
+                   });
+  Modules.swap(NewModules);
+
+  auto LinkStart = std::chrono::steady_clock::now();
+  Link();
+  Stats.LinkSeconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - LinkStart).count();
+  return true;
+}
+
+void ModuleSet::Link() {
+  // The views of the old arrays go first.
+  G.reset();
+  Syms.reset();
+  FuncPcs.clear();
+  Callers.clear();
+  BucketRanges.clear();
+  CallSitePcs.clear();
+  CallSiteCallers.clear();
+  IdsByPc.clear();
+  SymFuncPcs.clear();
+  SymNameOffsets.clear();
+  SymNames.clear();
+  SymFuncsByName.clear();
+  SymCallSitePcs.clear();
+  SymCallerPcs.clear();
+
+  // The ranges of each module are moved by the call sites of the modules
+  // before it, and its lists of buckets by their lists, sharing the empty
+  // range at 0. The ids are moved by the functions before it.
+  BucketRanges.push_back({0, 0});
+  std::vector<size_t> NameBounds; //< First function of each module by name.
+  for (const auto &M : Modules) {
+    const CsrReverseCallGraph &MG = *M->G;
+    const SymbolTable &MS = *M->Syms;
+    uint64_t Base = M->Spec.Base;
+    uint32_t FuncOff = FuncPcs.size();
+    uint32_t SiteOff = CallSitePcs.size();
+    uint32_t RangeOff = BucketRanges.size() - 1;
+    auto Move = [&](CsrReverseCallGraph::CallerRange R) {
+      if (R.Begin == R.End)
+        return CsrReverseCallGraph::CallerRange{0, 0};
+      return CsrReverseCallGraph::CallerRange{R.Begin + SiteOff,
+                                              R.End + SiteOff};
+    };
+    for (uint64_t Pc : MG.FuncPcs)
+      FuncPcs.push_back(Base + Pc);
+    for (const auto &C : MG.Callers)
+      Callers.push_back({Move(C.First), C.Rest ? C.Rest + RangeOff : 0});
+    for (size_t I = 1; I < MG.BucketRanges.size(); I++)
+      BucketRanges.push_back(Move(MG.BucketRanges[I]));
+    for (uint64_t Pc : MG.CallSitePcs)
+      CallSitePcs.push_back(Base + Pc);
+    for (uint32_t F : MG.CallSiteCallers)
+      CallSiteCallers.push_back(F + FuncOff);
+    for (uint32_t F : MG.IdsByPc)
+      IdsByPc.push_back(F + FuncOff);
+
+    uint32_t SymFuncOff = SymFuncPcs.size();
+    uint32_t NameOff = SymNames.size();
+    NameBounds.push_back(SymFuncOff);
+    for (uint64_t Pc : MS.FuncPcs)
+      SymFuncPcs.push_back(Base + Pc);
+    for (size_t F = 0; F < MS.FuncPcs.size(); F++)
+      SymNameOffsets.push_back(MS.NameOffsets[F] + NameOff);
+    SymNames.insert(SymNames.end(), MS.Names.begin(), MS.Names.end());
+    for (uint32_t F : MS.FuncsByName)
+      SymFuncsByName.push_back(F + SymFuncOff);
+    for (uint64_t Pc : MS.CallSitePcs)
+      SymCallSitePcs.push_back(Base + Pc);
+    for (uint64_t Pc : MS.CallerPcs)
+      SymCallerPcs.push_back(Base + Pc);
+  }
+  SymNameOffsets.push_back(SymNames.size());
+
+  // Merge the functions sorted by name of each module. The merge is stable,
+  // so functions sharing a name stay in entry pc order, as the modules are.
+  auto NameAt = [&](uint32_t F) {
+    return std::string_view(SymNames.data() + SymNameOffsets[F],
+                            SymNameOffsets[F + 1] - SymNameOffsets[F] - 1);
+  };
+  for (size_t I = 1; I < NameBounds.size(); I++)
+    std::inplace_merge(SymFuncsByName.begin(),
+                       SymFuncsByName.begin() + NameBounds[I],
+                       I + 1 < NameBounds.size()
+                         ? SymFuncsByName.begin() + NameBounds[I + 1]
+                         : SymFuncsByName.end(),
+                       [&](uint32_t A, uint32_t B) {
+                         return NameAt(A) < NameAt(B);
+                       });
+
+  G.reset(new CsrReverseCallGraph(FuncPcs, Callers, BucketRanges,
+                                  CallSitePcs, CallSiteCallers, IdsByPc));
+  Syms.reset(new SymbolTable(SymFuncPcs, SymNameOffsets, SymNames,
+                             SymFuncsByName, SymCallSitePcs, SymCallerPcs));
+}
+
+bool ModuleSet::Locate(uint64_t Pc, const ModuleSpec *&M,
+                       uint64_t &ModulePc) const {
+  auto It = std::upper_bound(Modules.begin(), Modules.end(), Pc,
+                             [](uint64_t Pc, const auto &Mod) {
+                               return Pc < Mod->Spec.Base;
+                             });
+  if (It == Modules.begin())
+    return false;
+  const Module &Mod = **--It;
+  ModulePc = Pc - Mod.Spec.Base;
+  if (ModulePc < Mod.Low || ModulePc > Mod.High)
+    return false;
+  M = &Mod.Spec;
+  return true;
+}
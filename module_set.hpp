@@ -0,0 +1,115 @@
+#ifndef __MODULE_SET_H__
+#define __MODULE_SET_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cg.hpp"
+#include "csr.hpp"
+#include "snapshot.hpp"
+#include "symtab.hpp"
+
+// A module loaded by the traced process, e.g., a PIE executable or a shared
+// object, and the call graph of its binary. The pcs of the call graph are
+// the link-time addresses, which are the offsets into the module for a
+// position-independent binary.
+struct ModuleSpec {
+  std::string Name; //< Unique among the modules, names its cached graph.
+  uint64_t Base;    //< Address the module is loaded at in the process.
+  std::string Path; //< Call graph disassembly or snapshot of the module.
+};
+
+// The reverse call graphs of the modules of a process, each built and cached
+// on its own, and linked into one graph at the load addresses of the run.
+//
+// A module graph is built from its call graph once and saved as a snapshot
+// to the cache directory, keyed by the content of the call graph. A module
+// given as a snapshot is used as is. Linking relocates the pcs of each module
+// by its base and concatenates the arrays, which takes time linear in the
+// graph size, so that the stack traces of the process, whose pcs are the run
+// time addresses, are reconstructed as on a single binary. Modules are
+// swapped, added and moved without rebuilding the others: a redeploy costs
+// the build of the changed modules and the link.
+//
+// There are no edges between the modules, as the call graph of a module only
+// has the calls to the PLT stubs of the others, which are filtered out.
+class ModuleSet {
+public:
+  // Whether the first line of the file is the module map header.
+  static bool IsModuleMap(const std::string &Path);
+
+  // Read a module map: the header line, then a module per line, as the name,
+  // the base in hex and the path, separated by spaces. Lines starting with
+  // '#' are ignored, and relative paths are relative to the map. Returns
+  // false and sets Err on failure.
+  static bool ReadModuleMap(const std::string &Path,
+                            std::vector<ModuleSpec> &Specs, std::string &Err);
+
+  // The graphs are built with the filter and the numbering order, on the
+  // threads of Pool if given. Without a cache directory, the built graphs are
+  // only kept in memory.
+  ModuleSet(const CallGraphFilter &CGF, CsrReverseCallGraph::Order O,
+            const std::string &CacheDir, WorkStealingPool *Pool = nullptr);
+  ~ModuleSet();
+
+  ModuleSet(const ModuleSet&) = delete;
+  ModuleSet &operator=(const ModuleSet&) = delete;
+
+  // Make the set the modules of Specs: build or load the modules that are new
+  // or whose file changed, drop the ones not in Specs, and link. The modules
+  // that did not change are kept as they are, even if they moved. Returns
+  // false and sets Err on failure, leaving the set as it was.
+  bool Update(const std::vector<ModuleSpec> &Specs, std::string &Err);
+
+  // Counts of the last Update.
+  struct UpdateStats {
+    size_t NumKept = 0;   //< Modules that did not change.
+    size_t NumCached = 0; //< Loaded from a snapshot or the cache.
+    size_t NumBuilt = 0;  //< Built from the call graph.
+    double LinkSeconds = 0;
+  };
+  const UpdateStats &LastUpdate() const { return Stats; }
+
+  // Find the module containing the run time pc, and the pc in the module.
+  bool Locate(uint64_t Pc, const ModuleSpec *&M, uint64_t &ModulePc) const;
+
+  size_t NumModules() const { return Modules.size(); }
+
+  // The linked graph and symbol table. Valid until the next Update.
+  CsrReverseCallGraph &Graph() { return *G; }
+  const CsrReverseCallGraph &Graph() const { return *G; }
+  const SymbolTable &Symbols() const { return *Syms; }
+
+private:
+  struct Module;
+
+  const CallGraphFilter &CGF;
+  CsrReverseCallGraph::Order O;
+  std::string CacheDir;
+  WorkStealingPool *Pool;
+  std::vector<std::unique_ptr<Module>> Modules; //< By ascending base.
+  UpdateStats Stats;
+
+  std::unique_ptr<Module> OpenModule(const ModuleSpec &Spec, uint64_t Key,
+                                     std::string &Err);
+  void Link();
+
+  std::unique_ptr<CsrReverseCallGraph> G;
+  std::unique_ptr<SymbolTable> Syms;
+  std::vector<uint64_t> FuncPcs;
+  std::vector<CsrReverseCallGraph::FuncCallers> Callers;
+  std::vector<CsrReverseCallGraph::CallerRange> BucketRanges;
+  std::vector<uint64_t> CallSitePcs;
+  std::vector<CsrReverseCallGraph::FuncId> CallSiteCallers;
+  std::vector<CsrReverseCallGraph::FuncId> IdsByPc;
+  std::vector<uint64_t> SymFuncPcs;
+  std::vector<uint32_t> SymNameOffsets;
+  std::vector<char> SymNames;
+  std::vector<uint32_t> SymFuncsByName;
+  std::vector<uint64_t> SymCallSitePcs;
+  std::vector<uint64_t> SymCallerPcs;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "multi_search.hpp"
+#include "csr.hpp"
+#include "rcg.hpp"
+
+#include <algorithm>
+
+template<class GraphT, class HashT>
+MultiQuerySearch<GraphT, HashT>::MultiQuerySearch(const GraphT &G,
+                                                  const SearchParams &P)
+  : G(G), P(P), Queries(nullptr), LowFilter(new std::bitset<1 << 16>),
+    Med1Filter(new std::bitset<1 << 16>), Med2Filter(new std::bitset<1 << 16>),
+    BucketsOrdered(P.PruningDepth1 < P.PruningDepth2), SearchEnd(0),
+    NumLeft(0), ST(P.MaxDepth + 1) {}
+
+template<class GraphT, class HashT>
+size_t MultiQuerySearch<GraphT, HashT>::Reconstruct(
+    uint64_t FuncEntryPc, std::vector<Query> &Queries) {
+  for (Query &Q : Queries) {
+    Q.Found = false;
+    Q.DoesNotMatchCount = 0;
+    if (Q.Candidates)
+      Q.Candidates->Clear();
+  }
+  NodeRef EntryFunc;
+  if (Queries.empty() || !G.FindFunc(FuncEntryPc, EntryFunc))
+    return 0;
+
+  this->Queries = &Queries;
+  WantedHashes.clear();
+  WantedUpper.clear();
+  LowFilter->reset();
+  Med1Filter->reset();
+  Med2Filter->reset();
+  SearchEnd = 0;
+  for (size_t I = 0; I < Queries.size(); I++) {
+    const CompressedTrace &CT = *Queries[I].Wanted;
+    WantedHashes.emplace_back(CT.Hash, I);
+    LowFilter->set(CT.Hash & 0xFFFF);
+    Med1Filter->set(CT.Hash >> 48);
+    Med2Filter->set((CT.Hash >> 32) & 0xFFFF);
+    WantedUpper.push_back(CT.Hash >> 32);
+    size_t QueryEnd = P.MaxDepth + 1;
+    if (CT.HasDepth())
+      QueryEnd = std::min(QueryEnd, (size_t)CT.Depth);
+    SearchEnd = std::max(SearchEnd, QueryEnd);
+  }
+  std::sort(WantedHashes.begin(), WantedHashes.end());
+  std::sort(WantedUpper.begin(), WantedUpper.end());
+  NumLeft = Queries.size();
+
+  DFS(/*CurrentDepth=*/0, /*CurrentHash=*/0, EntryFunc);
+  return Queries.size() - NumLeft;
+}
+
+// Same as SearchContext::DFS, but for all queries at once. Returns whether
+// all of them are found.
+template<class GraphT, class HashT>
+bool MultiQuerySearch<GraphT, HashT>::DFS(size_t CurrentDepth,
+                                          uint64_t CurrentHash,
+                                          NodeRef EntryFunc) {
+  // Check hash match against the queries not found yet.
+  if (LowFilter->test(CurrentHash & 0xFFFF)) {
+    auto It = std::lower_bound(WantedHashes.begin(), WantedHashes.end(),
+                               std::make_pair(CurrentHash, (uint32_t)0));
+    for (; It != WantedHashes.end() && It->first == CurrentHash; ++It) {
+      Query &Q = (*Queries)[It->second];
+      if (Q.Found && (!Q.Candidates || Q.Candidates->IsTruncated()))
+        continue;
+      bool Match = Q.WantedST
+        ? CheckCandidate(*Q.Wanted, *Q.WantedST, ST.begin(), CurrentDepth,
+                         Q.DoesNotMatchCount)
+        : CheckCompressed(*Q.Wanted, ST.begin(), CurrentDepth,
+                          Q.DoesNotMatchCount);
+      if (Match) {
+        if (!Q.Found && Q.Decoded)
+          Q.Decoded->assign(ST.begin(), ST.begin() + CurrentDepth);
+        Q.Found = true;
+        // The candidates are enumerated until there are too many.
+        if (Q.Candidates && Q.Candidates->Add(ST.data(), CurrentDepth))
+          continue;
+        if (--NumLeft == 0)
+          return true;
+      }
+    }
+  }
+
+  if (CurrentDepth >= SearchEnd)
+    return false;
+
+  // Prune unless the bucket is wanted by any of the queries.
+  if (CurrentDepth == P.PruningDepth1+1) {
+    if (!Med1Filter->test(CurrentHash >> 48))
+      return false;
+  } else if (CurrentDepth == P.PruningDepth2+1) {
+    if (!Med2Filter->test((CurrentHash >> 32) & 0xFFFF))
+      return false;
+    if (BucketsOrdered &&
+        !std::binary_search(WantedUpper.begin(), WantedUpper.end(),
+                            (uint32_t)(CurrentHash >> 32)))
+      return false;
+  }
+
+  for (auto E = G.CallersBegin(EntryFunc), End = G.CallersEnd(EntryFunc);
+       E != End; ++E) {
+    uint64_t CallSitePc = G.CallSitePc(E);
+    ST[CurrentDepth] = CallSitePc;
+    if (DFS(CurrentDepth + 1,
+            HashStep<HashT>(CurrentHash, CallSitePc, CurrentDepth,
+                            P.PruningDepth1, P.PruningDepth2),
+            G.Caller(E)))
+      return true;
+  }
+  return false;
+}
+
+#define X(HashT)                                             \
+  template class MultiQuerySearch<ReverseCallGraph, HashT>; \
+  template class MultiQuerySearch<CsrReverseCallGraph, HashT>;
+FOR_EACH_HASH_POLICY(X)
+#undef X
@@ -0,0 +1,75 @@
+#ifndef __MULTI_SEARCH_H__
+#define __MULTI_SEARCH_H__
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "candidates.hpp"
+#include "search.hpp"
+
+// Reconstructs many stack traces with the same entry function in a single
+// traversal.
+//
+// The stack traces of a batch often share the entry function, e.g., malloc
+// or free, and searching them one by one walks the same upper levels of the
+// reverse call graph again for each. Instead, the DFS here checks each
+// visited state against all wanted hashes at once, and prunes at the pruning
+// depths with the union of the wanted 16-bit buckets. The traversal stops as
+// soon as all stack traces are found, or at the deepest recorded depth. The
+// queries enumerating their candidates keep it going until they have too
+// many, which costs the whole pruned traversal for the ones that do not.
+//
+// Like SearchContext, a searcher is owned by one thread at a time.
+template<class GraphT, class HashT>
+class MultiQuerySearch {
+  typedef typename GraphT::NodeRef NodeRef;
+
+public:
+  // A stack trace to reconstruct, and the result of the search for it. If
+  // WantedST is null, the first candidate that matches the compressed form
+  // is taken, as when decoding stored records, and it is copied to Decoded
+  // if given. If Candidates is given as well, all candidates matching the
+  // compressed form are added to it, and the query is only done once the set
+  // is truncated.
+  struct Query {
+    const CompressedTrace *Wanted;
+    const StackTrace *WantedST;
+    bool Found;
+    int DoesNotMatchCount;
+    StackTrace *Decoded = nullptr;
+    CandidateSet *Candidates = nullptr;
+  };
+
+  MultiQuerySearch(const GraphT &G, const SearchParams &P);
+
+  // Search for all queries from the entry function, filling their results.
+  // Returns the number of queries found.
+  size_t Reconstruct(uint64_t FuncEntryPc, std::vector<Query> &Queries);
+
+private:
+  const GraphT &G;
+  const SearchParams &P;
+
+  // Followings are set before each traversal based on the queries.
+  std::vector<Query> *Queries;
+  // Wanted hashes and the index of their query, sorted to look up.
+  std::vector<std::pair<uint64_t, uint32_t>> WantedHashes;
+  // Filters on the lowest 16 bits of the wanted hashes, and on the two
+  // buckets. Most visited states are rejected by a single bit test.
+  std::unique_ptr<std::bitset<1 << 16>> LowFilter, Med1Filter, Med2Filter;
+  // If PruningDepth1 < PruningDepth2, both buckets are final at the second
+  // pruning depth. Then the pair of the buckets is checked instead, as the
+  // union of the second buckets alone prunes little for many queries.
+  bool BucketsOrdered;
+  std::vector<uint32_t> WantedUpper; //< Upper 32 bits of the wanted hashes.
+  size_t SearchEnd; //< Deepest depth to search.
+  size_t NumLeft;   //< Queries not done yet.
+
+  std::vector<uint64_t> ST; //< Stack trace to fill by reconstruction.
+
+  bool DFS(size_t CurrentDepth, uint64_t CurrentHash, NodeRef EntryFunc);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __OPTIONS_H__
+#define __OPTIONS_H__
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Parsers of the optional command line arguments shared by the tools.
+
+// Read an option in "--Name=Value" form. Returns whether Arg is the option.
+template<class T>
+inline bool ReadOption(const char *Arg, const char *Name, T &Value) {
+  size_t Len = strlen(Name);
+  if (strncmp(Arg, Name, Len) || Arg[Len] != '=')
+    return false;
+  Value = strtoll(Arg + Len + 1, nullptr, 0);
+  return true;
+}
+inline bool ReadOption(const char *Arg, const char *Name, double &Value) {
+  size_t Len = strlen(Name);
+  if (strncmp(Arg, Name, Len) || Arg[Len] != '=')
+    return false;
+  Value = atof(Arg + Len + 1);
+  return true;
+}
+inline bool ReadOption(const char *Arg, const char *Name, std::string &Value) {
+  size_t Len = strlen(Name);
+  if (strncmp(Arg, Name, Len) || Arg[Len] != '=')
+    return false;
+  Value = Arg + Len + 1;
+  return true;
+}
+
+// Read an option in "--Name=V1,V2,..." form. Returns whether Arg is the
+// option.
+inline bool ReadListOption(const char *Arg, const char *Name,
+                           std::vector<std::string> &Values) {
+  std::string List;
+  if (!ReadOption(Arg, Name, List))
+    return false;
+  Values.clear();
+  size_t Begin = 0;
+  while (true) {
+    size_t End = List.find(',', Begin);
+    Values.push_back(List.substr(Begin, End - Begin));
+    if (End == std::string::npos)
+      break;
+    Begin = End + 1;
+  }
+  return true;
+}
+
+// Read an option in "--Name" form. Returns whether Arg is the option.
+inline bool ReadFlag(const char *Arg, const char *Name, bool &Value) {
+  if (strcmp(Arg, Name))
+    return false;
+  Value = true;
+  return true;
+}
+
+#endif
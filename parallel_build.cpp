@@ -0,0 +1,40 @@
+#include "parallel_build.hpp"
+
+#include <cstring>
+
+void BuildPhases::Add(const char *Name, double Sec) {
+  for (auto &El : Seconds)
+    if (!strcmp(El.first, Name)) {
+      El.second += Sec;
+      return;
+    }
+  Seconds.emplace_back(Name, Sec);
+}
+
+void RunTasks(WorkStealingPool *Pool,
+              const std::vector<std::function<void()>> &Tasks) {
+  if (!Pool || Pool->NumThreads() == 1) {
+    for (const auto &Task : Tasks)
+      Task();
+    return;
+  }
+  Pool->ParallelFor(Tasks.size(), [&](unsigned, size_t I) { Tasks[I](); });
+}
+
+size_t NumChunks(const WorkStealingPool *Pool, size_t N) {
+  size_t Res = Pool ? 4 * (size_t)Pool->NumThreads() : 1;
+  return N < Res ? (N ? N : 1) : Res;
+}
+
+void ForEachChunk(WorkStealingPool *Pool, size_t N, size_t NumChunks,
+                  const std::function<void(size_t, size_t, size_t)> &Body) {
+  auto Chunk = [&](size_t C) {
+    Body(C, N * C / NumChunks, N * (C + 1) / NumChunks);
+  };
+  if (!Pool || Pool->NumThreads() == 1) {
+    for (size_t C = 0; C < NumChunks; C++)
+      Chunk(C);
+    return;
+  }
+  Pool->ParallelFor(NumChunks, [&](unsigned, size_t C) { Chunk(C); });
+}
@@ -0,0 +1,48 @@
+#ifndef __PARALLEL_BUILD_H__
+#define __PARALLEL_BUILD_H__
+
+#include "pool.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Helpers for building the graphs on the threads of a pool. The builds only
+// split work whose result does not depend on the order it is done in, and
+// merge the partial results in the order of the serial build, so that the
+// graphs are the same with any number of threads. Without a pool, everything
+// runs in order on the calling thread.
+
+// Seconds of each phase of a build, in order.
+struct BuildPhases {
+  std::vector<std::pair<const char*, double>> Seconds;
+
+  // Run Fn as the phase Name, and note its time. The time of a phase run
+  // again, e.g., per section, is added to the first run.
+  template<class FnT> void Run(const char *Name, FnT Fn) {
+    auto Start = std::chrono::steady_clock::now();
+    Fn();
+    Add(Name, std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - Start).count());
+  }
+  void Add(const char *Name, double Sec);
+};
+
+// Run the tasks, which must not depend on each other, and return once all of
+// them are done.
+void RunTasks(WorkStealingPool *Pool,
+              const std::vector<std::function<void()>> &Tasks);
+
+// Number of chunks to split N iterations into: a few per thread, so that
+// stealing evens out the chunks of different costs.
+size_t NumChunks(const WorkStealingPool *Pool, size_t N);
+
+// Run Body(Chunk, Begin, End) for each of the NumChunks chunks splitting
+// [0, N) evenly, in ascending order of the chunks without a pool. The
+// results of each chunk are merged in chunk order to get the serial order.
+void ForEachChunk(WorkStealingPool *Pool, size_t N, size_t NumChunks,
+                  const std::function<void(size_t, size_t, size_t)> &Body);
+
+#endif
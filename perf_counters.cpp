@@ -0,0 +1,60 @@
+#include "perf_counters.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int OpenCounter(uint64_t Config, int GroupFd) {
+  struct perf_event_attr Attr;
+  memset(&Attr, 0, sizeof(Attr));
+  Attr.type = PERF_TYPE_HARDWARE;
+  Attr.size = sizeof(Attr);
+  Attr.config = Config;
+  Attr.disabled = GroupFd < 0; //< Members follow the leader.
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+  Attr.read_format = PERF_FORMAT_GROUP;
+  return syscall(SYS_perf_event_open, &Attr, /*pid=*/0, /*cpu=*/-1, GroupFd,
+                 /*flags=*/0);
+}
+
+PerfCounters::~PerfCounters() {
+  if (CacheMissesFd >= 0)
+    close(CacheMissesFd);
+  if (GroupFd >= 0)
+    close(GroupFd);
+}
+
+bool PerfCounters::Open(std::string &Err) {
+  GroupFd = OpenCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+  if (GroupFd >= 0)
+    CacheMissesFd = OpenCounter(PERF_COUNT_HW_CACHE_MISSES, GroupFd);
+  if (GroupFd < 0 || CacheMissesFd < 0) {
+    Err = std::string("perf_event_open: ") + strerror(errno);
+    if (GroupFd >= 0)
+      close(GroupFd);
+    GroupFd = -1;
+    return false;
+  }
+  return true;
+}
+
+void PerfCounters::Start() {
+  ioctl(GroupFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(GroupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounters::Sample PerfCounters::Stop() {
+  ioctl(GroupFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  // The number of counters, followed by their values in the order opened.
+  uint64_t Values[3] = {0, 0, 0};
+  Sample S;
+  if (read(GroupFd, Values, sizeof(Values)) == sizeof(Values)) {
+    S.Cycles = Values[1];
+    S.CacheMisses = Values[2];
+  }
+  return S;
+}
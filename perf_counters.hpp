@@ -0,0 +1,35 @@
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include <cstdint>
+#include <string>
+
+// Hardware counters of the calling thread, read with perf_event_open. The
+// counters only count while started, in user space. They are opened by the
+// thread that uses them, and are closed on destruction.
+class PerfCounters {
+  int GroupFd; //< The cycles counter, leading the group.
+  int CacheMissesFd;
+
+public:
+  struct Sample {
+    uint64_t Cycles = 0;
+    uint64_t CacheMisses = 0;
+  };
+
+  PerfCounters() : GroupFd(-1), CacheMissesFd(-1) {}
+  ~PerfCounters();
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters &operator=(const PerfCounters&) = delete;
+
+  // Open the counters for the calling thread. Returns false and sets Err if
+  // they are not available, e.g., in a VM or by perf_event_paranoid.
+  bool Open(std::string &Err);
+
+  // Reset and start counting.
+  void Start();
+  // Stop counting, and read the counts since Start.
+  Sample Stop();
+};
+
+#endif
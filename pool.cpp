@@ -0,0 +1,125 @@
+#include "pool.hpp"
+
+WorkStealingPool::WorkStealingPool(unsigned NumThreads)
+  : NumWorkers(NumThreads ? NumThreads : std::thread::hardware_concurrency()) {
+  if (!NumWorkers)
+    NumWorkers = 1;
+  Ranges.reset(new Range[NumWorkers]);
+  for (unsigned I = 1; I < NumWorkers; I++)
+    Threads.emplace_back(&WorkStealingPool::WorkerLoop, this, I);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Stopping = true;
+  }
+  WakeUp.notify_all();
+  for (auto &T : Threads)
+    T.join();
+}
+
+void WorkStealingPool::ParallelFor(size_t N, const LoopBody &Body) {
+  if (!N)
+    return;
+
+  // Split the iterations evenly. Workers are idle here, so ranges can be set
+  // without racing with them.
+  for (unsigned W = 0; W < NumWorkers; W++) {
+    Ranges[W].Begin = N * W / NumWorkers;
+    Ranges[W].End = N * (W + 1) / NumWorkers;
+  }
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    this->Body = &Body;
+    Running = NumWorkers;
+    Generation++;
+  }
+  WakeUp.notify_all();
+
+  Run(/*WorkerId=*/0);
+
+  std::unique_lock<std::mutex> Guard(Lock);
+  LoopDone.wait(Guard, [&] { return !Running; });
+  this->Body = nullptr;
+}
+
+void WorkStealingPool::WorkerLoop(unsigned WorkerId) {
+  uint64_t SeenGeneration = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> Guard(Lock);
+      WakeUp.wait(Guard, [&] {
+        return Stopping || Generation != SeenGeneration;
+      });
+      if (Stopping)
+        return;
+      SeenGeneration = Generation;
+    }
+    Run(WorkerId);
+  }
+}
+
+void WorkStealingPool::Run(unsigned WorkerId) {
+  size_t I;
+  while (true) {
+    if (Pop(WorkerId, I))
+      (*Body)(WorkerId, I);
+    else if (!Steal(WorkerId))
+      break;
+  }
+
+  std::lock_guard<std::mutex> Guard(Lock);
+  if (!--Running)
+    LoopDone.notify_one();
+}
+
+bool WorkStealingPool::Pop(unsigned WorkerId, size_t &I) {
+  Range &R = Ranges[WorkerId];
+  std::lock_guard<std::mutex> Guard(R.Lock);
+  if (R.Begin == R.End)
+    return false;
+  I = R.Begin++;
+  return true;
+}
+
+// Steal the upper half of the largest range of the other workers. Returns
+// false if there is nothing left to steal, i.e., the loop is about to finish.
+bool WorkStealingPool::Steal(unsigned WorkerId) {
+  while (true) {
+    // The sizes may change once a lock is released, so the chosen victim is
+    // verified again below.
+    unsigned Victim = WorkerId;
+    size_t VictimSize = 0;
+    for (unsigned W = 0; W < NumWorkers; W++) {
+      if (W == WorkerId)
+        continue;
+      std::lock_guard<std::mutex> Guard(Ranges[W].Lock);
+      size_t Size = Ranges[W].End - Ranges[W].Begin;
+      if (Size > VictimSize) {
+        Victim = W;
+        VictimSize = Size;
+      }
+    }
+    if (!VictimSize)
+      return false;
+
+    size_t Begin, End;
+    {
+      Range &R = Ranges[Victim];
+      std::lock_guard<std::mutex> Guard(R.Lock);
+      if (R.Begin == R.End)
+        continue; //< Drained in the meantime, look for another victim.
+      End = R.End;
+      Begin = R.Begin + (R.End - R.Begin) / 2;
+      R.End = Begin;
+    }
+
+    Range &Own = Ranges[WorkerId];
+    std::lock_guard<std::mutex> Guard(Own.Lock);
+    Own.Begin = Begin;
+    Own.End = End;
+    return true;
+  }
+}
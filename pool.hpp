@@ -0,0 +1,67 @@
+#ifndef __WORK_STEALING_POOL_H__
+#define __WORK_STEALING_POOL_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run parallel loops.
+//
+// The iterations of a loop are split into one contiguous range per worker.
+// Each worker takes iterations from the front of its own range. A worker that
+// runs out of iterations steals the upper half of the largest range left to
+// another worker, so that a few expensive iterations do not keep the other
+// workers idle.
+class WorkStealingPool {
+public:
+  // Body of a parallel loop: called with the id of the worker running it
+  // (in [0, NumThreads)) and the iteration index.
+  typedef std::function<void(unsigned /*WorkerId*/, size_t /*I*/)> LoopBody;
+
+  // NumThreads includes the calling thread, i.e., NumThreads-1 threads are
+  // spawned. Zero means one thread per hardware thread.
+  explicit WorkStealingPool(unsigned NumThreads);
+
+  // Joins the worker threads.
+  ~WorkStealingPool();
+
+  unsigned NumThreads() const { return NumWorkers; }
+
+  // Run Body for every iteration in [0, N), and return once all of them are
+  // done. The calling thread takes part as worker 0. Must not be called
+  // from within a loop body.
+  void ParallelFor(size_t N, const LoopBody &Body);
+
+private:
+  // Iterations left to a worker. Aligned to avoid false sharing between the
+  // workers.
+  struct alignas(64) Range {
+    std::mutex Lock;
+    size_t Begin = 0;
+    size_t End = 0;
+  };
+
+  unsigned NumWorkers;
+  std::vector<std::thread> Threads;
+  std::unique_ptr<Range[]> Ranges;
+
+  // Followings are protected by Lock.
+  std::mutex Lock;
+  std::condition_variable WakeUp;   //< Signals a new loop or stopping.
+  std::condition_variable LoopDone; //< Signals that all workers finished.
+  const LoopBody *Body = nullptr;   //< Body of the current loop.
+  uint64_t Generation = 0;          //< Incremented for each loop.
+  unsigned Running = 0;             //< Workers still running the loop.
+  bool Stopping = false;
+
+  void WorkerLoop(unsigned WorkerId);
+  void Run(unsigned WorkerId);
+  bool Pop(unsigned WorkerId, size_t &I);
+  bool Steal(unsigned WorkerId);
+};
+
+#endif
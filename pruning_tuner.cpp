@@ -0,0 +1,169 @@
+#include "pruning_tuner.hpp"
+#include "csr.hpp"
+#include "rcg.hpp"
+
+#include <algorithm>
+#include <memory>
+
+template<class GraphT>
+PruningTuner<GraphT>::PruningTuner(const GraphT &G, size_t MaxDepth,
+                                   bool HashOnly)
+  : G(G), MaxDepth(MaxDepth), HashOnly(HashOnly), TotalWeight(0) {}
+
+template<class GraphT>
+bool PruningTuner<GraphT>::AddTrace(uint64_t EntryPc, size_t Depth) {
+  auto It = Entry.find(EntryPc);
+  if (It == Entry.end()) {
+    NodeRef Func;
+    if (!G.FindFunc(EntryPc, Func))
+      return false;
+    // Count the paths level by level, summing the paths reaching each
+    // function. Recursion is followed as the search does.
+    EntryInfo Info;
+    Info.Paths.assign(MaxDepth + 2, 0);
+    Info.Traces.assign(MaxDepth + 2, 0);
+    std::unordered_map<NodeRef, double> Level{{Func, 1}}, Next;
+    for (size_t D = 0; D < MaxDepth + 2 && !Level.empty(); D++) {
+      for (const auto &El : Level)
+        Info.Paths[D] += El.second;
+      Next.clear();
+      for (const auto &El : Level)
+        for (auto E = G.CallersBegin(El.first), End = G.CallersEnd(El.first);
+             E != End; ++E)
+          Next[G.Caller(E)] += El.second;
+      Level.swap(Next);
+    }
+    It = Entry.emplace(EntryPc, std::move(Info)).first;
+  }
+  It->second.Traces[std::min(Depth, MaxDepth)]++;
+  TotalWeight++;
+  return true;
+}
+
+template<class GraphT>
+std::vector<std::pair<uint64_t, size_t>>
+PruningTuner<GraphT>::Entries() const {
+  std::vector<std::pair<uint64_t, size_t>> Res;
+  for (const auto &El : Entry) {
+    size_t N = 0;
+    for (size_t T : El.second.Traces)
+      N += T;
+    Res.emplace_back(El.first, N);
+  }
+  std::sort(Res.begin(), Res.end(), [](const auto &A, const auto &B) {
+    return A.second != B.second ? A.second > B.second : A.first < B.first;
+  });
+  return Res;
+}
+
+template<class GraphT>
+double PruningTuner<GraphT>::Predict(uint64_t P1, uint64_t P2) const {
+  static const double BucketPass = 1.0 / (1 << 16);
+  if (!TotalWeight)
+    return 0;
+  double Sum = 0;
+  for (const auto &El : Entry) {
+    const std::vector<double> &Paths = El.second.Paths;
+    for (size_t Depth = 0; Depth <= MaxDepth; Depth++) {
+      size_t Weight = El.second.Traces[Depth];
+      if (!Weight)
+        continue;
+      // Fractions of the paths surviving the first check, and both. The
+      // paths sharing the prefix of the stack trace survive only if it
+      // reaches the check.
+      double Pass1 = BucketPass;
+      if (Depth > P1 && Paths[P1] > 0)
+        Pass1 += 1 / Paths[P1];
+      Pass1 = std::min(Pass1, 1.0);
+      double Pass2 = Pass1;
+      if (P2 > P1) {
+        Pass2 = Pass1 * BucketPass;
+        if (Depth > P2 && Paths[P2] > 0)
+          Pass2 += 1 / Paths[P2];
+        Pass2 = std::min(Pass2, Pass1);
+      }
+      size_t End = HashOnly ? MaxDepth + 1 : Depth;
+      double Nodes = 0;
+      for (size_t D = 0; D <= End; D++)
+        Nodes += Paths[D] * (D <= P1 + 1 ? 1 : D <= P2 + 1 ? Pass1 : Pass2);
+      // The stack trace itself is visited in any case.
+      Sum += Weight * std::max(Nodes, (double)Depth + 1);
+    }
+  }
+  return Sum / TotalWeight;
+}
+
+template<class GraphT>
+std::vector<typename PruningTuner<GraphT>::Choice>
+PruningTuner<GraphT>::RankAll() const {
+  std::vector<Choice> Res;
+  for (uint64_t P1 = 0; P1 <= MaxDepth; P1++)
+    for (uint64_t P2 = P1; P2 <= MaxDepth; P2++)
+      Res.push_back({P1, P2, Predict(P1, P2)});
+  // Ties keep the shallower depths, which prune sooner.
+  std::stable_sort(Res.begin(), Res.end(), [](const Choice &A,
+                                              const Choice &B) {
+    return A.PredictedNodes < B.PredictedNodes;
+  });
+  return Res;
+}
+
+template<class GraphT>
+void PruningTuner<GraphT>::Measure(Choice &C, const TraceBatch &Sample,
+                                   HashKind Kind, WorkStealingPool &Pool,
+                                   const SearchBudget &Budget) const {
+  WithHashPolicy(Kind, [&](auto Policy) {
+    this->template MeasureWith<decltype(Policy)>(C, Sample, Kind, Pool,
+                                                 Budget);
+  });
+}
+
+template<class GraphT>
+template<class HashT>
+void PruningTuner<GraphT>::MeasureWith(Choice &C, const TraceBatch &Sample,
+                                       HashKind Kind, WorkStealingPool &Pool,
+                                       const SearchBudget &Budget) const {
+  SearchParams P(MaxDepth, C.PruningDepth1, C.PruningDepth2, Kind);
+  std::vector<std::unique_ptr<SearchContext<GraphT, HashT>>> Contexts;
+  std::vector<SearchStats> Stats(Pool.NumThreads());
+  std::vector<uint64_t> Nodes(Pool.NumThreads(), 0);
+  std::vector<size_t> Searched(Pool.NumThreads(), 0);
+  std::vector<size_t> Exhausted(Pool.NumThreads(), 0);
+  for (unsigned W = 0; W < Pool.NumThreads(); W++) {
+    Contexts.emplace_back(new SearchContext<GraphT, HashT>(G, P));
+    Contexts.back()->Stats = &Stats[W];
+    Contexts.back()->Budget = Budget;
+  }
+
+  // The stack traces are compressed again, as the hash depends on the
+  // pruning depths.
+  Pool.ParallelFor(Sample.size(), [&](unsigned WorkerId, size_t I) {
+    const TraceRecord &R = Sample[I];
+    if (!Entry.count(R.EntryPc))
+      return;
+    CompressedTrace CT;
+    if (HashOnly)
+      CT.Hash = Hash<HashT>(R.ST, P);
+    else
+      CT = Compress(R.ST, P);
+    SearchContext<GraphT, HashT> &Ctx = *Contexts[WorkerId];
+    Stats[WorkerId].Reset(MaxDepth);
+    Ctx.Reconstruct(R.EntryPc, CT, R.ST);
+    Nodes[WorkerId] += Stats[WorkerId].NumNodes();
+    Searched[WorkerId]++;
+    Exhausted[WorkerId] += Ctx.BudgetExhausted;
+  });
+
+  uint64_t TotalNodes = 0;
+  size_t TotalSearched = 0;
+  C.NumExhausted = 0;
+  for (unsigned W = 0; W < Pool.NumThreads(); W++) {
+    TotalNodes += Nodes[W];
+    TotalSearched += Searched[W];
+    C.NumExhausted += Exhausted[W];
+  }
+  C.MeasuredNodes = TotalSearched ? (double)TotalNodes / TotalSearched : 0;
+}
+
+template class PruningTuner<ReverseCallGraph>;
+template class PruningTuner<CsrReverseCallGraph>;
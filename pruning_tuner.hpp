@@ -0,0 +1,93 @@
+#ifndef __PRUNING_TUNER_H__
+#define __PRUNING_TUNER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "pool.hpp"
+#include "search.hpp"
+#include "trace_stream.hpp"
+
+// Picks the pruning depths that minimize the cost of the searches on a
+// reverse call graph, for the stack traces it is used for.
+//
+// The cost is predicted from the number of paths per depth from each entry
+// function, which grows with the fan-in of the functions on the way. The
+// search visits every path up to the first pruning depth P1 and one more
+// level, where the 16-bit bucket of the first P1 frames is checked. Beyond,
+// the paths survive if they share the first P1 frames with the stack trace,
+// or if their bucket matches by chance, i.e., a fraction 1/paths(P1) +
+// 2^-16 of them. The second pruning depth P2 filters the survivors the same
+// way. Hence, a P1 too shallow leaves many paths sharing the prefix, and one
+// too deep visits many paths before the first check. The prediction is the
+// complete pruned traversal up to the depth of each stack trace, or up to
+// the maximum depth without the recorded depth, while the search stops at
+// the match: the measured nodes are usually below it.
+//
+// The prediction only depends on the paths per depth of the entry functions
+// and on the depths of the stack traces, so it is computed for all pairs of
+// depths at once. The few best pairs can then be measured by replaying a
+// sample of the stack traces, compressed with each pair.
+template<class GraphT>
+class PruningTuner {
+  typedef typename GraphT::NodeRef NodeRef;
+
+public:
+  struct Choice {
+    uint64_t PruningDepth1;
+    uint64_t PruningDepth2;
+    double PredictedNodes;     //< Per stack trace, on average.
+    double MeasuredNodes = -1; //< Per replayed stack trace, once measured.
+    size_t NumExhausted = 0;   //< Replayed ones that ran out of budget, so
+                               //< that the measured nodes are a lower bound.
+  };
+
+  // Tune for the searches up to MaxDepth, on the stack traces compressed as
+  // the bare hash if HashOnly.
+  PruningTuner(const GraphT &G, size_t MaxDepth, bool HashOnly);
+
+  // Count a stack trace of the given depth from the entry function. Returns
+  // false if the entry function is not in the graph.
+  bool AddTrace(uint64_t EntryPc, size_t Depth);
+
+  size_t NumTraces() const { return TotalWeight; }
+
+  // Entry functions seen, by descending number of stack traces, and their
+  // paths per depth from 0 to MaxDepth+1.
+  std::vector<std::pair<uint64_t, size_t>> Entries() const;
+  const std::vector<double> &PathsPerDepth(uint64_t EntryPc) const {
+    return Entry.at(EntryPc).Paths;
+  }
+
+  // Predicted nodes per stack trace with the pruning depths. P1 == P2 prunes
+  // at P1 only.
+  double Predict(uint64_t P1, uint64_t P2) const;
+
+  // All pairs P1 <= P2 <= MaxDepth, from the lowest predicted nodes.
+  std::vector<Choice> RankAll() const;
+
+  // Replay the stack traces of Sample with the pruning depths of C on the
+  // workers of Pool, each search within Budget, and fill the measured nodes.
+  void Measure(Choice &C, const TraceBatch &Sample, HashKind Kind,
+               WorkStealingPool &Pool, const SearchBudget &Budget) const;
+
+private:
+  struct EntryInfo {
+    std::vector<double> Paths;   //< Per depth.
+    std::vector<size_t> Traces;  //< Stack traces per depth.
+  };
+
+  const GraphT &G;
+  size_t MaxDepth;
+  bool HashOnly;
+  std::unordered_map<uint64_t, EntryInfo> Entry;
+  size_t TotalWeight;
+
+  template<class HashT>
+  void MeasureWith(Choice &C, const TraceBatch &Sample, HashKind Kind,
+                   WorkStealingPool &Pool, const SearchBudget &Budget) const;
+};
+
+#endif
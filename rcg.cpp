@@ -1,48 +1,197 @@
 #include "rcg.hpp"
 #include "cg.hpp"
+#include "memory_usage.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
 ReverseCallGraph::~ReverseCallGraph() {
   for (auto &El : FuncPcToNode) {
     if (El.second->NumCallers)
       delete[] El.second->Callers;
     El.second->Callers = nullptr;
+    if (El.second->NumBuckets)
+      delete[] El.second->Buckets;
+    El.second->Buckets = CallSiteRange::NoBuckets;
 
     delete El.second;
   }
+  for (CallSiteRange &Bucket : Buckets)
+    delete[] Bucket.Begin;
   FuncPcToNode.clear();
   CallSitePcToNode.clear();
+  Buckets.clear();
 }
 
-ReverseCallGraph::ReverseCallGraph(const CallGraph& RawCG) {
+ReverseCallGraph::ReverseCallGraph(const CallGraph& RawCG,
+                                   WorkStealingPool *Pool) {
   // Get the filtered target to callers mapping.
   auto &TargetToCallers = RawCG.TargetsToCallers;
 
   // Create function nodes.
-  for (const auto &El : TargetToCallers) {
-    uint64_t FuncPc = El.first;
-    FuncPcToNode[FuncPc] = new FunctionNode(FuncPc);
+  Phases.Run("create the function nodes", [&] {
+    for (const auto &El : TargetToCallers) {
+      uint64_t FuncPc = El.first;
+      FuncPcToNode[FuncPc] = new FunctionNode(FuncPc);
+    }
+  });
+
+  // The call site lists, in the order their nodes are mapped: the direct
+  // callers of each function, then each bucket once.
+  std::vector<const std::vector<CallSite>*> Lists;
+  std::vector<CallSiteNode*> Nodes;
+  std::vector<uint32_t> BucketIndex(RawCG.CallerBuckets.size(), UINT32_MAX);
+  Phases.Run("allocate the call site nodes", [&] {
+    for (const auto &El : TargetToCallers)
+      Lists.push_back(&El.second);
+    for (const auto &El : RawCG.TargetsToBuckets)
+      for (uint32_t B : El.second)
+        if (BucketIndex[B] == UINT32_MAX) {
+          BucketIndex[B] = Buckets.size();
+          Buckets.push_back({nullptr, nullptr});
+          Lists.push_back(&RawCG.CallerBuckets[B]);
+        }
+    Nodes.resize(Lists.size(), nullptr);
+    ForEachChunk(Pool, Lists.size(), NumChunks(Pool, Lists.size()),
+                 [&](size_t, size_t Begin, size_t End) {
+      for (size_t I = Begin; I < End; I++)
+        if (!Lists[I]->empty())
+          Nodes[I] = new CallSiteNode[Lists[I]->size()];
+    });
+  });
+
+  // Fill the call site nodes from the call sites. The callers are only
+  // looked up here, so that the lists can be filled at the same time.
+  Phases.Run("fill the call site nodes", [&] {
+    ForEachChunk(Pool, Lists.size(), NumChunks(Pool, Lists.size()),
+                 [&](size_t, size_t Begin, size_t End) {
+      for (size_t I = Begin; I < End; I++)
+        for (size_t J = 0; J < Lists[I]->size(); J++) {
+          const CallSite CS = (*Lists[I])[J]; //< Get info from.
+          CallSiteNode &CSN = Nodes[I][J];    //< Fill info to.
+          // Set caller.
+          CSN.CallSitePc = CS.CallSitePc;
+          auto It = FuncPcToNode.find(CS.CallerPc);
+          if (It != FuncPcToNode.end())
+            CSN.Caller = It->second;
+        }
+    });
+  });
+
+  // Set direct callers and buckets, and the CallSiteToPcNode mapping for
+  // reverse call graph, in order as a call site may be in many lists.
+  Phases.Run("map the call sites", [&] {
+    size_t I = 0;
+    for (const auto &El : TargetToCallers) {
+      FunctionNode *FuncNode = FuncPcToNode[El.first];
+      FuncNode->NumCallers = Lists[I]->size();
+      if (FuncNode->NumCallers)
+        FuncNode->Callers = Nodes[I];
+      I++;
+    }
+    for (CallSiteRange &Bucket : Buckets) {
+      Bucket = {Nodes[I], Nodes[I] + Lists[I]->size()};
+      I++;
+    }
+    for (I = 0; I < Lists.size(); I++)
+      for (size_t J = 0; J < Lists[I]->size(); J++) {
+        const CallSite &CS = (*Lists[I])[J];
+        CallSiteNode &CSN = Nodes[I][J];
+        // A caller that is not a target gets no node.
+        if (!CSN.Caller)
+          CSN.Caller = FuncPcToNode[CS.CallerPc];
+        CallSitePcToNode[CS.CallSitePc] = &CSN;
+      }
+
+    // Refer to the buckets from the functions they may call.
+    for (const auto &El : RawCG.TargetsToBuckets) {
+      FunctionNode *FuncNode = FuncPcToNode[El.first];
+      CallSiteRange *List = new CallSiteRange[El.second.size() + 1];
+      for (size_t I = 0; I < El.second.size(); I++)
+        List[I] = Buckets[BucketIndex[El.second[I]]];
+      List[El.second.size()] = {nullptr, nullptr};
+      FuncNode->Buckets = List;
+      FuncNode->NumBuckets = El.second.size();
+    }
+  });
+}
+
+size_t ReverseCallGraph::HeapBytes() const {
+  size_t Res = ::HeapBytes(FuncPcToNode) + ::HeapBytes(CallSitePcToNode) +
+               Buckets.capacity() * sizeof(CallSiteRange) +
+               NumCallSites() * sizeof(CallSiteNode);
+  for (const auto &El : FuncPcToNode)
+    Res += sizeof(FunctionNode) +
+           (El.second->NumBuckets ? El.second->NumBuckets + 1 : 0) *
+             sizeof(CallSiteRange);
+  return Res;
+}
+
+size_t ReverseCallGraph::NumCallSites() const {
+  size_t Res = 0;
+  for (const auto &El : FuncPcToNode)
+    Res += El.second->NumCallers;
+  for (const CallSiteRange &Bucket : Buckets)
+    Res += Bucket.End - Bucket.Begin;
+  return Res;
+}
+
+size_t ReverseCallGraph::NumEdges() const {
+  size_t Res = 0;
+  for (const auto &El : FuncPcToNode) {
+    Res += El.second->NumCallers;
+    for (uint64_t I = 0; I < El.second->NumBuckets; I++)
+      Res += El.second->Buckets[I].End - El.second->Buckets[I].Begin;
   }
+  return Res;
+}
+
+size_t ReverseCallGraph::ReorderCallers(const CallSiteProfile &Profile) {
+  if (Profile.empty())
+    return 0;
+  // Each array of call site nodes once: the direct callers of a function, or
+  // a bucket shared by the functions it may call.
+  std::vector<CallSiteRange> Arrays(Buckets);
+  for (auto &El : FuncPcToNode)
+    if (El.second->NumCallers)
+      Arrays.push_back({El.second->Callers,
+                        El.second->Callers + El.second->NumCallers});
+
+  std::unordered_map<uint64_t, uint64_t> Counts = Profile.CallSiteCounts();
+  size_t NumMoved = 0;
+  std::vector<std::pair<uint64_t, uint64_t>> Order; //< (count, index).
+  std::vector<CallSiteNode> Nodes;
+  for (const CallSiteRange &Array : Arrays) {
+    CallSiteNode *Callers = Array.Begin;
+    uint64_t NumCallers = Array.End - Array.Begin;
+    Order.clear();
+    for (uint64_t I = 0; I < NumCallers; I++) {
+      auto It = Counts.find(Callers[I].CallSitePc);
+      Order.emplace_back(It == Counts.end() ? 0 : It->second, I);
+    }
+    std::stable_sort(Order.begin(), Order.end(),
+                     [](const std::pair<uint64_t, uint64_t> &A,
+                        const std::pair<uint64_t, uint64_t> &B) {
+                       return A.first > B.first;
+                     });
+    bool Moved = false;
+    for (uint64_t I = 0; I < Order.size(); I++)
+      Moved |= Order[I].second != I;
+    if (!Moved)
+      continue;
+    NumMoved++;
 
-  // Set callers.
-  for (const auto &El : TargetToCallers) {
-    uint64_t FuncPc = El.first;
-    FunctionNode *FuncNode = FuncPcToNode[FuncPc];
-    const std::vector<CallSite> &Callers = El.second;
-    uint64_t NumCallers = Callers.size();
-    // Allocate for callers.
-    FuncNode->NumCallers = NumCallers;
-    if (NumCallers)
-      FuncNode->Callers = new CallSiteNode[NumCallers];
-
-    // Set callers.
-    for (int I = 0; I < NumCallers; I++) {
-      const CallSite CS = Callers[I];           //< Get info from.
-      CallSiteNode &CSN = FuncNode->Callers[I]; //< Fill info to.
-      // Set caller.
-      CSN.CallSitePc = CS.CallSitePc;
-      CSN.Caller = FuncPcToNode[CS.CallerPc];
-      // Set CallSiteToPcNode mapping for reverse call graph.
-      CallSitePcToNode[CS.CallSitePc] = &CSN;
+    Nodes.assign(Callers, Callers + NumCallers);
+    for (uint64_t I = 0; I < Order.size(); I++) {
+      const CallSiteNode *Old = Callers + Order[I].second;
+      // The pc maps to one of the nodes of the call site, which may be this.
+      auto It = CallSitePcToNode.find(Old->CallSitePc);
+      if (It != CallSitePcToNode.end() && It->second == Old)
+        It->second = Callers + I;
     }
+    for (uint64_t I = 0; I < Order.size(); I++)
+      Callers[I] = Nodes[Order[I].second];
   }
+  return NumMoved;
 }
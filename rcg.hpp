@@ -1,8 +1,12 @@
 #ifndef __REVERSE_CALL_GRAPH_H__
 #define __REVERSE_CALL_GRAPH_H__
 
+#include "call_site_profile.hpp"
+#include "caller_ranges.hpp"
 #include "cg.hpp"
 
+#include <vector>
+
 struct FunctionNode;
 
 struct CallSiteNode {
@@ -12,24 +16,82 @@ struct CallSiteNode {
   CallSiteNode() : Caller(nullptr), CallSitePc(0) {}
 };
 
+typedef CallerRange<CallSiteNode*> CallSiteRange;
+
 struct FunctionNode {
   uint64_t EntryPc;      //< Function entry pc.
-  CallSiteNode* Callers; //< Callers of this function.
+  CallSiteNode* Callers; //< Direct callers of this function.
   uint64_t NumCallers;   //< Length of the num callers.
+  const CallSiteRange* Buckets; //< Buckets that may call this function,
+                                //< ended by an empty range.
+  uint64_t NumBuckets;          //< Length of the buckets.
 
   FunctionNode(uint64_t EntryPc) 
-    : EntryPc(EntryPc), Callers(nullptr), NumCallers(0) {}
+    : EntryPc(EntryPc), Callers(nullptr), NumCallers(0),
+      Buckets(CallSiteRange::NoBuckets), NumBuckets(0) {}
 };
 
-// A compact and efficient reverse call graph representation.
+// A compact and efficient reverse call graph representation. The call site
+// nodes of a bucket of indirect call sites (see CallGraph::CallerBuckets) are
+// allocated once, and the functions it may call refer to them by a range.
 struct ReverseCallGraph {
   std::unordered_map<uint64_t, FunctionNode*> FuncPcToNode;
   std::unordered_map<uint64_t, CallSiteNode*> CallSitePcToNode;
+  std::vector<CallSiteRange> Buckets; //< Owned call site nodes of buckets.
 
-  ReverseCallGraph(const CallGraph&);
+  // Time of each phase of the build.
+  BuildPhases Phases;
+
+  // If Pool is given, the call site nodes are allocated and filled on its
+  // threads. The maps are filled in order, so that they are the same.
+  ReverseCallGraph(const CallGraph&, WorkStealingPool *Pool = nullptr);
 
   // Deallocate for FunctionNode and CallSiteNode instances.
   ~ReverseCallGraph();
+
+  // Estimated heap bytes of the nodes and the maps.
+  size_t HeapBytes() const;
+
+  // Number of call site nodes, and of edges, counting a call site once per
+  // function it may call.
+  size_t NumCallSites() const;
+  size_t NumEdges() const;
+
+  // Same as CsrReverseCallGraph::ReorderCallers. The call site nodes move
+  // within the callers arrays and the buckets, and CallSitePcToNode follows
+  // them.
+  size_t ReorderCallers(const CallSiteProfile &Profile);
+
+  // Interface shared with CsrReverseCallGraph that the searches are written
+  // against. A function is referred by its node, and a call site calling it
+  // by its node, walking the ranges of the function. The end of the callers
+  // is the same for all functions.
+  typedef const FunctionNode *NodeRef;
+  typedef CallerIterator<CallSiteNode*> EdgeRef;
+
+  // Find the node of the function. Does not insert, so that the graph stays
+  // read-only.
+  bool FindFunc(uint64_t FuncPc, NodeRef &Node) const {
+    auto It = FuncPcToNode.find(FuncPc);
+    if (It == FuncPcToNode.end())
+      return false;
+    Node = It->second;
+    return true;
+  }
+  uint64_t EntryPc(NodeRef Node) const { return Node->EntryPc; }
+  EdgeRef CallersBegin(NodeRef Node) const {
+    return EdgeRef::Begin(Node->Callers, Node->Callers + Node->NumCallers,
+                          Node->Buckets);
+  }
+  // The ranges of all functions end the same way (see CallerIterator); the
+  // function is kept for the searches over both layouts.
+  EdgeRef CallersEnd(NodeRef) const { return EdgeRef::End(); }
+  uint64_t CallSitePc(EdgeRef Edge) const { return Edge.Pos->CallSitePc; }
+  NodeRef Caller(EdgeRef Edge) const { return Edge.Pos->Caller; }
+  template<class FnT> void ForEachFunc(FnT Fn) const {
+    for (const auto &El : FuncPcToNode)
+      Fn(NodeRef(El.second));
+  }
 };
 
 #endif
@@ -0,0 +1,159 @@
+#include "result_cache.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+namespace {
+
+const char Magic[8] = {'S', 'T', 'R', 'C', 'A', 'C', 'H', 'E'};
+
+// The file is the header followed by NumEntries records, each followed by
+// the STSize frames of its stack trace. All in host byte order.
+struct Header {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Kind; //< Hash policy.
+  uint64_t Fingerprint;
+  uint64_t NumEntries;
+};
+
+struct Record {
+  uint64_t EntryPc;
+  uint64_t Hash;
+  uint64_t MaxDepth;
+  uint64_t PruningDepth1;
+  uint64_t PruningDepth2;
+  uint32_t Found;
+  int32_t DoesNotMatchCount;
+  uint64_t STSize;
+  uint8_t RecordVersion;
+  uint8_t Reserved[7];
+};
+
+// Bounds a corrupted size before allocating for it.
+const uint64_t MaxSTSize = 1 << 20;
+
+} // namespace
+
+bool ResultCache::Lookup(uint64_t EntryPc, const CompressedTrace &CT,
+                         const StackTrace &WantedST, Result &R) {
+  {
+    std::shared_lock<std::shared_mutex> Guard(Lock);
+    auto It = Entries.find(MakeKey(EntryPc, CT));
+    if (It != Entries.end() && It->second.ST == WantedST) {
+      R = It->second.R;
+      Hits++;
+      return true;
+    }
+  }
+  Misses++;
+  return false;
+}
+
+void ResultCache::Insert(uint64_t EntryPc, const CompressedTrace &CT,
+                         const StackTrace &WantedST, const Result &R) {
+  // A larger budget may find it.
+  if (R.BudgetExhausted)
+    return;
+  std::unique_lock<std::shared_mutex> Guard(Lock);
+  Entries[MakeKey(EntryPc, CT)] = Entry{R, WantedST};
+}
+
+size_t ResultCache::size() const {
+  std::shared_lock<std::shared_mutex> Guard(Lock);
+  return Entries.size();
+}
+
+bool ResultCache::Load(const std::string &Path, std::string &Err) {
+  std::ifstream In(Path, std::ios::binary);
+  if (!In) {
+    Err = "cannot open " + Path + ": " + strerror(errno);
+    return false;
+  }
+  Header H;
+  if (!In.read((char*)&H, sizeof(H)) ||
+      memcmp(H.Magic, Magic, sizeof(Magic))) {
+    Err = Path + " is not a result cache";
+    return false;
+  }
+  if (H.Version != Version) {
+    Err = Path + " has version " + std::to_string(H.Version) +
+          ", expected " + std::to_string(Version);
+    return false;
+  }
+  if (H.Fingerprint != Fingerprint) {
+    Err = Path + " was saved for a different call graph";
+    return false;
+  }
+  if (H.Kind != (uint32_t)P.Kind) {
+    Err = Path + " was saved with a different hash than " +
+          HashKindName(P.Kind);
+    return false;
+  }
+
+  // The entries are only added once all of them are read, so that a corrupt
+  // file leaves the cache as it was.
+  std::unordered_map<Key, Entry, KeyHash> Loaded;
+  for (uint64_t I = 0; I < H.NumEntries; I++) {
+    Record Rec;
+    if (!In.read((char*)&Rec, sizeof(Rec)) || Rec.STSize > MaxSTSize) {
+      Err = Path + " is truncated or corrupted";
+      return false;
+    }
+    Entry E;
+    E.R = Result{Rec.Found != 0, Rec.DoesNotMatchCount};
+    E.ST.resize(Rec.STSize);
+    if (!In.read((char*)E.ST.data(), Rec.STSize * sizeof(uint64_t))) {
+      Err = Path + " is truncated or corrupted";
+      return false;
+    }
+    Loaded[Key{Rec.EntryPc, Rec.Hash, Rec.MaxDepth, Rec.PruningDepth1,
+               Rec.PruningDepth2, Rec.RecordVersion}] = std::move(E);
+  }
+
+  std::unique_lock<std::shared_mutex> Guard(Lock);
+  for (auto &El : Loaded)
+    Entries[El.first] = std::move(El.second);
+  return true;
+}
+
+bool ResultCache::Save(const std::string &Path, std::string &Err) const {
+  std::ofstream Out(Path, std::ios::binary | std::ios::trunc);
+  if (!Out) {
+    Err = "cannot create " + Path + ": " + strerror(errno);
+    return false;
+  }
+  std::shared_lock<std::shared_mutex> Guard(Lock);
+  Header H;
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.Kind = (uint32_t)P.Kind;
+  H.Fingerprint = Fingerprint;
+  H.NumEntries = Entries.size();
+  Out.write((const char*)&H, sizeof(H));
+  for (const auto &El : Entries) {
+    const Key &K = El.first;
+    const Entry &E = El.second;
+    Record Rec;
+    memset(&Rec, 0, sizeof(Rec));
+    Rec.EntryPc = K.EntryPc;
+    Rec.Hash = K.Hash;
+    Rec.MaxDepth = K.MaxDepth;
+    Rec.PruningDepth1 = K.PruningDepth1;
+    Rec.PruningDepth2 = K.PruningDepth2;
+    Rec.Found = E.R.Found;
+    Rec.DoesNotMatchCount = E.R.DoesNotMatchCount;
+    Rec.STSize = E.ST.size();
+    Rec.RecordVersion = K.RecordVersion;
+    Out.write((const char*)&Rec, sizeof(Rec));
+    Out.write((const char*)E.ST.data(), E.ST.size() * sizeof(uint64_t));
+  }
+  if (!Out.flush()) {
+    Err = "cannot write " + Path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
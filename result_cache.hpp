@@ -0,0 +1,127 @@
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "search.hpp"
+
+// Fingerprint of the reverse call graph, identifying the graph a cache file
+// was filled on. It only depends on the functions and the call sites, not on
+// the layout or the numbering of the functions.
+template<class GraphT>
+uint64_t GraphFingerprint(const GraphT &G) {
+  // Finalizer of splitmix64.
+  auto Mix = [](uint64_t X) {
+    X = (X ^ (X >> 30)) * 0xbf58476d1ce4e5b9ull;
+    X = (X ^ (X >> 27)) * 0x94d049bb133111ebull;
+    return X ^ (X >> 31);
+  };
+  // Summing makes it independent of the visiting order.
+  uint64_t Res = 0;
+  G.ForEachFunc([&](typename GraphT::NodeRef F) {
+    uint64_t FuncHash = Mix(G.EntryPc(F));
+    Res += FuncHash;
+    for (auto E = G.CallersBegin(F), End = G.CallersEnd(F); E != End; ++E)
+      Res += Mix(Mix(FuncHash ^ G.CallSitePc(E)) ^ G.EntryPc(G.Caller(E)));
+  });
+  return Res;
+}
+
+// Results of the past reconstructions, so that a stack trace seen before
+// costs a lookup instead of a search.
+//
+// Results are keyed on the entry function, the compressed form and the
+// search parameters, and both found and not found results are kept. The
+// version of the compressed form is part of the key, as the bare hash has
+// the same hash word as a version 1 record but meets more collisions. As this tool
+// knows the wanted stack trace, the result is only valid for the same wanted
+// stack trace: the one cached is compared on lookup, and a different one
+// with the same key (i.e., a hash collision) is a miss that replaces it.
+//
+// The cache can be saved to a file and loaded in later runs on the same
+// reverse call graph, which is checked by its fingerprint, and with the same
+// hash policy, as the collisions met depend on it. Lookups and
+// inserts are safe to call from many threads.
+class ResultCache {
+public:
+  // Incremented on any change to the file layout.
+  static const uint32_t Version = 3;
+
+  struct Result {
+    bool Found;            //< Whether the stack trace was reconstructed.
+    int DoesNotMatchCount; //< Collisions met by the search.
+    bool BudgetExhausted = false; //< The search gave up before it was
+                                  //< complete. Never cached.
+  };
+
+  ResultCache(const SearchParams &P, uint64_t Fingerprint)
+    : P(P), Fingerprint(Fingerprint) {}
+
+  // Get the result for the stack trace. Returns whether it is cached.
+  bool Lookup(uint64_t EntryPc, const CompressedTrace &CT,
+              const StackTrace &WantedST, Result &R);
+
+  // Cache the result, unless the search was cut short by its budget.
+  void Insert(uint64_t EntryPc, const CompressedTrace &CT,
+              const StackTrace &WantedST, const Result &R);
+
+  // Add the results in the file at Path. Returns false and sets Err if the
+  // file is not a cache of the same graph and hash policy, or is corrupt,
+  // adding none.
+  bool Load(const std::string &Path, std::string &Err);
+
+  // Write all results to Path. Returns false and sets Err on failure.
+  bool Save(const std::string &Path, std::string &Err) const;
+
+  size_t NumHits() const { return Hits; }
+  size_t NumMisses() const { return Misses; }
+  size_t size() const;
+
+private:
+  struct Key {
+    uint64_t EntryPc;
+    uint64_t Hash;
+    uint64_t MaxDepth;
+    uint64_t PruningDepth1;
+    uint64_t PruningDepth2;
+    uint8_t RecordVersion; //< Of the compressed form.
+
+    bool operator==(const Key &Other) const {
+      return EntryPc == Other.EntryPc && Hash == Other.Hash &&
+             MaxDepth == Other.MaxDepth &&
+             PruningDepth1 == Other.PruningDepth1 &&
+             PruningDepth2 == Other.PruningDepth2 &&
+             RecordVersion == Other.RecordVersion;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &K) const {
+      // The stack trace hash is already well mixed.
+      return K.Hash ^ (K.EntryPc * 0x9e3779b97f4a7c15ull) ^
+             (K.MaxDepth << 16) ^ (K.PruningDepth1 << 8) ^ K.PruningDepth2 ^
+             ((uint64_t)K.RecordVersion << 56);
+    }
+  };
+  struct Entry {
+    Result R;
+    StackTrace ST; //< Wanted stack trace of the result.
+  };
+
+  const SearchParams &P;
+  uint64_t Fingerprint;
+  mutable std::shared_mutex Lock; //< Protects Entries.
+  std::unordered_map<Key, Entry, KeyHash> Entries;
+  std::atomic<size_t> Hits{0};
+  std::atomic<size_t> Misses{0};
+
+  Key MakeKey(uint64_t EntryPc, const CompressedTrace &CT) const {
+    return {EntryPc, CT.Hash, P.MaxDepth, P.PruningDepth1, P.PruningDepth2,
+            CT.Version};
+  }
+};
+
+#endif
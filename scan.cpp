@@ -0,0 +1,14 @@
+#include "scan.hpp"
+
+// Written out rather than computed at startup, so that it can be used during
+// static initialization too.
+const int8_t HexDigitValue[256] = {
+#define X16 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+  X16, X16, X16,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,           // '0'-'9'
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, // 'A'-'F'
+  X16,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, // 'a'-'f'
+  X16, X16, X16, X16, X16, X16, X16, X16, X16,
+#undef X16
+};
@@ -0,0 +1,81 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Value of each hex digit character, and -1 for any other character.
+extern const int8_t HexDigitValue[256];
+
+// Cursor over a text buffer, e.g., a mapped file. Scanning does not copy or
+// allocate: lines and words are returned as views into the buffer.
+struct TextCursor {
+  const char *Cur;
+  const char *End;
+
+  TextCursor(const char *Begin, const char *End) : Cur(Begin), End(End) {}
+  TextCursor(std::string_view S) : Cur(S.data()), End(S.data() + S.size()) {}
+
+  bool AtEnd() const { return Cur == End; }
+
+  // Get the next line without the line break, and advance past it. The line
+  // break is found by memchr, which libc vectorizes.
+  bool NextLine(TextCursor &Line) {
+    if (Cur == End)
+      return false;
+    const char *Eol = (const char*)memchr(Cur, '\n', End - Cur);
+    const char *LineEnd = Eol ? Eol : End;
+    Line = TextCursor(Cur, LineEnd);
+    Cur = Eol ? Eol + 1 : End;
+    // Drop the carriage return of CRLF line breaks.
+    if (Line.End != Line.Cur && Line.End[-1] == '\r')
+      Line.End--;
+    return true;
+  }
+
+  void SkipSpaces() {
+    while (Cur != End && (*Cur == ' ' || *Cur == '\t'))
+      Cur++;
+  }
+
+  // Read the next whitespace separated word.
+  bool ReadWord(std::string_view &Word) {
+    SkipSpaces();
+    const char *Begin = Cur;
+    while (Cur != End && *Cur != ' ' && *Cur != '\t')
+      Cur++;
+    Word = std::string_view(Begin, Cur - Begin);
+    return Cur != Begin;
+  }
+
+  // Read the next hex value with an optional 0x prefix, as `>> std::hex`
+  // does. Returns false, without advancing past the word, if the next word
+  // does not start with a hex digit.
+  bool ReadHex(uint64_t &Value) {
+    SkipSpaces();
+    const char *P = Cur;
+    if (End - P > 2 && P[0] == '0' && (P[1] == 'x' || P[1] == 'X') &&
+        HexDigitValue[(uint8_t)P[2]] >= 0)
+      P += 2;
+    uint64_t V = 0;
+    const char *Begin = P;
+    int8_t D;
+    while (P != End && (D = HexDigitValue[(uint8_t)*P]) >= 0) {
+      V = (V << 4) | D;
+      P++;
+    }
+    if (P == Begin)
+      return false;
+    Value = V;
+    Cur = P;
+    return true;
+  }
+
+  bool StartsWith(std::string_view Prefix) const {
+    return (size_t)(End - Cur) >= Prefix.size() &&
+           !memcmp(Cur, Prefix.data(), Prefix.size());
+  }
+};
+
+#endif
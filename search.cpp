@@ -0,0 +1,371 @@
+#include "search.hpp"
+#include "csr.hpp"
+#include "rcg.hpp"
+
+#include <algorithm>
+
+uint64_t HashStep(uint64_t Hash, uint64_t PC, size_t Idx,
+                  const SearchParams &P) {
+  return WithHashPolicy(P.Kind, [&](auto Policy) {
+    return HashStep<decltype(Policy)>(Hash, PC, Idx, P.PruningDepth1,
+                                      P.PruningDepth2);
+  });
+}
+
+uint64_t Hash(const StackTrace &ST, const SearchParams &P) {
+  return WithHashPolicy(P.Kind, [&](auto Policy) {
+    return Hash<decltype(Policy)>(ST, P);
+  });
+}
+
+void CompressedTrace::Pack(uint64_t Words[2]) const {
+  Words[0] = Hash;
+  Words[1] = ((uint64_t)Version << 56) | ((uint64_t)Depth << 48) | Verifier;
+}
+
+bool CompressedTrace::Unpack(const uint64_t *Words, size_t NumWords,
+                             CompressedTrace &CT) {
+  CT = CompressedTrace();
+  if (NumWords < 1 || NumWords > 2)
+    return false;
+  CT.Hash = Words[0];
+  if (NumWords == 1)
+    return true;
+  CT.Version = Words[1] >> 56;
+  CT.Depth = (Words[1] >> 48) & 0xFF;
+  CT.Verifier = (uint32_t)Words[1];
+  if (CT.Version > LatestVersion || ((Words[1] >> 32) & 0xFFFF))
+    return false;
+  // A version 0 record carries nothing besides the hash.
+  return CT.Version || !Words[1];
+}
+
+CompressedTrace Compress(const StackTrace &ST, const SearchParams &P) {
+  CompressedTrace CT;
+  CT.Hash = Hash(ST, P);
+  if (ST.size() <= 0xFF) {
+    CT.Version = CompressedTrace::LatestVersion;
+    CT.Depth = ST.size();
+    CT.Verifier = VerifierHash(ST.begin(), ST.size());
+  }
+  return CT;
+}
+
+void SearchStats::Reset(size_t MaxDepth) {
+  NodesPerDepth.assign(MaxDepth + 2, 0);
+  PrunedAtDepth1 = PrunedAtDepth2 = 0;
+}
+
+void SearchStats::Add(const SearchStats &Other) {
+  if (NodesPerDepth.size() < Other.NodesPerDepth.size())
+    NodesPerDepth.resize(Other.NodesPerDepth.size(), 0);
+  for (size_t I = 0; I < Other.NodesPerDepth.size(); I++)
+    NodesPerDepth[I] += Other.NodesPerDepth[I];
+  PrunedAtDepth1 += Other.PrunedAtDepth1;
+  PrunedAtDepth2 += Other.PrunedAtDepth2;
+}
+
+uint64_t SearchStats::NumNodes() const {
+  uint64_t Sum = 0;
+  for (uint64_t N : NodesPerDepth)
+    Sum += N;
+  return Sum;
+}
+
+void BudgetMeter::Start(const SearchBudget &B, Shared *S) {
+  Budget = B;
+  SharedState = S;
+  Used = 0;
+  IsExhausted = false;
+  if (Budget.MaxSeconds > 0)
+    Deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double>(B.MaxSeconds));
+  // Without limits, the counter does not run out in practice.
+  Left = Budget.IsLimited() ? 0 : UINT64_MAX;
+}
+
+// Grant the states up to the next check, including the one of this step.
+bool BudgetMeter::Refill() {
+  Left = 0;
+  if (IsExhausted)
+    return false;
+  if (SharedState && SharedState->Exhausted.load(std::memory_order_relaxed))
+    return Exhaust();
+  if (Budget.MaxSeconds > 0 && Clock::now() >= Deadline)
+    return Exhaust();
+  uint64_t Grant = CheckInterval;
+  if (Budget.MaxNodes) {
+    uint64_t Prev;
+    if (SharedState) {
+      Prev = SharedState->NodesUsed.fetch_add(Grant,
+                                              std::memory_order_relaxed);
+    } else {
+      Prev = Used;
+      Used += Grant;
+    }
+    if (Prev >= Budget.MaxNodes)
+      return Exhaust();
+    Grant = std::min(Grant, Budget.MaxNodes - Prev);
+  }
+  Left = Grant - 1;
+  return true;
+}
+
+bool BudgetMeter::Exhaust() {
+  IsExhausted = true;
+  if (SharedState)
+    SharedState->Exhausted.store(true, std::memory_order_relaxed);
+  Left = 0;
+  return false;
+}
+
+template<class GraphT, class HashT>
+SearchContext<GraphT, HashT>::SearchContext(const GraphT &G,
+                                            const SearchParams &P)
+  : G(G), P(P), WantedST(nullptr), WantedHash(0), WantedHashMed1(0),
+    WantedHashMed2(0), SearchEnd(0), ST(P.MaxDepth + 1), Cancel(nullptr),
+    DoesNotMatchCount(0), Stats(nullptr), BudgetExhausted(false) {}
+
+template<class GraphT, class HashT>
+void SearchContext<GraphT, HashT>::SetWanted(const CompressedTrace &CT,
+                                             const StackTrace &WantedST) {
+  this->WantedST = &WantedST;
+  Wanted = CT;
+  WantedHash = CT.Hash;
+  SearchEnd = P.MaxDepth + 1;
+  if (CT.HasDepth())
+    SearchEnd = std::min(SearchEnd, (size_t)CT.Depth);
+  WantedHashMed1 = WantedHash >> 48;
+  WantedHashMed2 = (WantedHash >> 32) & 0xFFFFll;
+  DoesNotMatchCount = 0;
+  BudgetExhausted = false;
+}
+
+template<class GraphT, class HashT>
+bool SearchContext<GraphT, HashT>::Reconstruct(uint64_t FuncEntryPc,
+                                               const CompressedTrace &CT,
+                                               const StackTrace &WantedST) {
+  NodeRef EntryFunc;
+  if (!G.FindFunc(FuncEntryPc, EntryFunc))
+    return false;
+  SetWanted(CT, WantedST);
+  Meter.Start(Budget);
+  bool Found = DFS(/*CurrentDepth=*/0, /*CurrentHash=*/0, EntryFunc);
+  BudgetExhausted = !Found && Meter.Exhausted();
+  return Found;
+}
+
+// Returns whether the stack trace is found.
+template<class GraphT, class HashT>
+bool SearchContext<GraphT, HashT>::DFS(size_t CurrentDepth,
+                                       uint64_t CurrentHash,
+                                       NodeRef EntryFunc) {
+  if (Cancel && Cancel->load(std::memory_order_relaxed))
+    return false;
+  if (!Meter.Step())
+    return false;
+  if (Stats)
+    Stats->NodesPerDepth[CurrentDepth]++;
+
+  // Check hash match
+  if (CurrentHash == WantedHash &&
+      CheckCandidate(Wanted, *WantedST, ST.begin(), CurrentDepth,
+                     DoesNotMatchCount))
+    return true;
+
+  // Stop at the maximum depth, or at the recorded depth if known.
+  if (CurrentDepth >= SearchEnd)
+    return false;
+
+  // If the current depth is one of the pruning depths, check the hash against
+  // the pruning hashes.
+  if (CurrentDepth == P.PruningDepth1+1) {
+    // Pruning depth 1: prune based on the highest 16-bits bucket
+    if ((CurrentHash >> 48) != WantedHashMed1) {
+      if (Stats)
+        Stats->PrunedAtDepth1++;
+      return false;
+    }
+  } else if (CurrentDepth == P.PruningDepth2+1) {
+    // Pruning depth 2: prune based on the second highest 16-bits bucket
+    if (((CurrentHash >> 32) & 0xFFFFll) != WantedHashMed2) {
+      if (Stats)
+        Stats->PrunedAtDepth2++;
+      return false;
+    }
+  }
+
+  // Continue search from the callers of the current function.
+  for (auto E = G.CallersBegin(EntryFunc), End = G.CallersEnd(EntryFunc);
+       E != End; ++E) {
+    uint64_t CallSitePc = G.CallSitePc(E);
+
+    // Fill one frame in the stack trace.
+    ST[CurrentDepth] = CallSitePc;
+    bool Found = DFS(
+      CurrentDepth + 1,
+      HashStep<HashT>(CurrentHash, CallSitePc, CurrentDepth,
+                      P.PruningDepth1, P.PruningDepth2),
+      G.Caller(E)
+    );
+
+    if (Found)
+      return true;
+  }
+  return false;
+}
+
+template<class GraphT, class HashT>
+ParallelSearch<GraphT, HashT>::ParallelSearch(const GraphT &G,
+                                              const SearchParams &P,
+                                              WorkStealingPool &Pool,
+                                              size_t SplitDepth)
+  : Pool(Pool), SplitDepth(std::min(SplitDepth, P.MaxDepth + 1)),
+    Collector(G, P), Found(false), DoesNotMatchCount(0), Stats(nullptr),
+    BudgetExhausted(false) {
+  for (unsigned W = 0; W < Pool.NumThreads(); W++) {
+    Contexts.emplace_back(new SearchContext<GraphT, HashT>(G, P));
+    Contexts.back()->Cancel = &Found;
+  }
+}
+
+template<class GraphT, class HashT>
+bool ParallelSearch<GraphT, HashT>::IsPruned(size_t CurrentDepth,
+                                             uint64_t CurrentHash) {
+  SearchContext<GraphT, HashT> &Ctx = Collector;
+  if (CurrentDepth == Ctx.P.PruningDepth1+1) {
+    if ((CurrentHash >> 48) != Ctx.WantedHashMed1) {
+      if (Ctx.Stats)
+        Ctx.Stats->PrunedAtDepth1++;
+      return true;
+    }
+  } else if (CurrentDepth == Ctx.P.PruningDepth2+1) {
+    if (((CurrentHash >> 32) & 0xFFFFll) != Ctx.WantedHashMed2) {
+      if (Ctx.Stats)
+        Ctx.Stats->PrunedAtDepth2++;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Same as SearchContext::DFS, but stops at SplitDepth and records a task
+// for each path reaching there. Returns whether the stack trace is found,
+// either above SplitDepth or by a batch of tasks run meanwhile.
+template<class GraphT, class HashT>
+bool ParallelSearch<GraphT, HashT>::CollectTasks(size_t CurrentDepth,
+                                                 uint64_t CurrentHash,
+                                                 NodeRef EntryFunc) {
+  SearchContext<GraphT, HashT> &Ctx = Collector;
+  const GraphT &G = Ctx.G;
+  if (CurrentDepth == SplitDepth) {
+    // The bucket check at the split depth is applied before making the task,
+    // so that with K=pruning_depth_1+1 only the paths passing the first
+    // check become tasks. A path pruned here is counted as visited, as by
+    // the worker that would have taken it.
+    if (CurrentHash != Ctx.WantedHash && CurrentDepth < Ctx.SearchEnd &&
+        IsPruned(CurrentDepth, CurrentHash)) {
+      if (Ctx.Meter.Step() && Ctx.Stats)
+        Ctx.Stats->NodesPerDepth[CurrentDepth]++;
+      return false;
+    }
+    Tasks.push_back({EntryFunc, CurrentHash});
+    Prefixes.insert(Prefixes.end(), Ctx.ST.begin(),
+                    Ctx.ST.begin() + SplitDepth);
+    return Tasks.size() == MaxPendingTasks && RunTasks();
+  }
+  if (!Ctx.Meter.Step())
+    return false;
+  if (Ctx.Stats)
+    Ctx.Stats->NodesPerDepth[CurrentDepth]++;
+
+  // Check hash match
+  if (CurrentHash == Ctx.WantedHash &&
+      CheckCandidate(Ctx.Wanted, *Ctx.WantedST, Ctx.ST.begin(), CurrentDepth,
+                     Ctx.DoesNotMatchCount))
+    return true;
+
+  if (CurrentDepth >= Ctx.SearchEnd || IsPruned(CurrentDepth, CurrentHash))
+    return false;
+
+  for (auto E = G.CallersBegin(EntryFunc), End = G.CallersEnd(EntryFunc);
+       E != End; ++E) {
+    uint64_t CallSitePc = G.CallSitePc(E);
+    Ctx.ST[CurrentDepth] = CallSitePc;
+    if (CollectTasks(CurrentDepth + 1,
+                     HashStep<HashT>(CurrentHash, CallSitePc, CurrentDepth,
+                                     Ctx.P.PruningDepth1,
+                                     Ctx.P.PruningDepth2),
+                     G.Caller(E)))
+      return true;
+  }
+  return false;
+}
+
+// Search the subtrees of the pending tasks in parallel. Returns whether any
+// of them found the stack trace.
+template<class GraphT, class HashT>
+bool ParallelSearch<GraphT, HashT>::RunTasks() {
+  Pool.ParallelFor(Tasks.size(), [&](unsigned WorkerId, size_t I) {
+    SearchContext<GraphT, HashT> &Ctx = *Contexts[WorkerId];
+    std::copy(Prefixes.begin() + I * SplitDepth,
+              Prefixes.begin() + (I + 1) * SplitDepth, Ctx.ST.begin());
+    if (Ctx.DFS(SplitDepth, Tasks[I].Hash, Tasks[I].Func))
+      Found.store(true, std::memory_order_relaxed);
+  });
+  Tasks.clear();
+  Prefixes.clear();
+  return Found.load();
+}
+
+template<class GraphT, class HashT>
+bool ParallelSearch<GraphT, HashT>::Reconstruct(uint64_t FuncEntryPc,
+                                                const CompressedTrace &CT,
+                                                const StackTrace &WantedST) {
+  NodeRef EntryFunc;
+  if (!Collector.G.FindFunc(FuncEntryPc, EntryFunc))
+    return false;
+
+  Found.store(false);
+  Collector.SetWanted(CT, WantedST);
+  for (auto &Ctx : Contexts)
+    Ctx->SetWanted(CT, WantedST);
+  // The collector counts the levels above SplitDepth, and each worker the
+  // subtrees it searches.
+  Collector.Stats = Stats;
+  ContextStats.resize(Contexts.size());
+  for (size_t W = 0; W < Contexts.size(); W++) {
+    Contexts[W]->Stats = Stats ? &ContextStats[W] : nullptr;
+    if (Stats)
+      ContextStats[W].Reset(Collector.P.MaxDepth);
+  }
+
+  // The collector and the workers draw from the same budget.
+  SharedBudget.NodesUsed.store(0);
+  SharedBudget.Exhausted.store(false);
+  Collector.Meter.Start(Budget, &SharedBudget);
+  for (auto &Ctx : Contexts)
+    Ctx->Meter.Start(Budget, &SharedBudget);
+
+  Tasks.clear();
+  Prefixes.clear();
+  bool Ret = CollectTasks(/*CurrentDepth=*/0, /*CurrentHash=*/0,
+                          EntryFunc) || RunTasks();
+
+  DoesNotMatchCount = Collector.DoesNotMatchCount;
+  for (auto &Ctx : Contexts)
+    DoesNotMatchCount += Ctx->DoesNotMatchCount;
+  if (Stats)
+    for (const auto &S : ContextStats)
+      Stats->Add(S);
+  BudgetExhausted = !Ret && SharedBudget.Exhausted.load();
+  return Ret;
+}
+
+#define X(HashT)                                          \
+  template class SearchContext<ReverseCallGraph, HashT>;    \
+  template class SearchContext<CsrReverseCallGraph, HashT>; \
+  template class ParallelSearch<ReverseCallGraph, HashT>;   \
+  template class ParallelSearch<CsrReverseCallGraph, HashT>;
+FOR_EACH_HASH_POLICY(X)
+#undef X
@@ -0,0 +1,318 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "hash_policy.hpp"
+#include "pool.hpp"
+
+typedef std::vector<uint64_t> StackTrace;
+
+// Parameters of the compression and the reconstruction search. These are set
+// once on program initialization from CLI and shared by all searches.
+struct SearchParams {
+  size_t MaxDepth;        //< Maximum depth to search for.
+  uint64_t PruningDepth1; //< Pruning depth 1.
+  uint64_t PruningDepth2; //< Pruning depth 2.
+  HashKind Kind;          //< Hash policy of the compression.
+
+  SearchParams(size_t MaxDepth, uint64_t PruningDepth1, uint64_t PruningDepth2,
+               HashKind Kind = DefaultHashKind)
+    : MaxDepth(MaxDepth), PruningDepth1(PruningDepth1),
+      PruningDepth2(PruningDepth2), Kind(Kind) {}
+};
+
+// Check whether two stack traces are the same.
+template<class T1, class T2>
+bool AreSTSame(T1 it1_begin, size_t size1, T2 it2_begin, size_t size2) {
+  if (size1 != size2)
+      return false;
+
+  for (size_t I = 0; I < size1; I++) {
+    if (*it1_begin != *it2_begin)
+      return false;
+    it1_begin++;
+    it2_begin++;
+  }
+  return true;
+}
+
+// Compute the hash after appending the frame at index Idx, with the policy
+// and the pruning depths of the parameters. The searches call the template
+// HashStep of hash_policy.hpp instead, so that the step is inlined.
+uint64_t HashStep(uint64_t Hash, uint64_t PC, size_t Idx,
+                  const SearchParams &P);
+
+// Compute the hash of a full stack trace.
+template<class HashT>
+uint64_t Hash(const StackTrace &ST, const SearchParams &P) {
+  uint64_t Res = 0;
+  for (size_t I = 0; I < ST.size(); I++)
+    Res = HashStep<HashT>(Res, ST[I], I, P.PruningDepth1, P.PruningDepth2);
+  return Res;
+}
+
+// Same as above, with the policy of the parameters.
+uint64_t Hash(const StackTrace &ST, const SearchParams &P);
+
+// Compute the verifier after appending a frame. The verifier is a
+// multiply-xorshift hash, so that its collisions are independent of the
+// collisions of the CRC32 based hash.
+inline uint32_t VerifierStep(uint32_t Verifier, uint64_t PC) {
+  uint64_t X = (PC + Verifier) * 0x9e3779b97f4a7c15ull;
+  X ^= X >> 29;
+  X *= 0xbf58476d1ce4e5b9ull;
+  return (uint32_t)(X ^ (X >> 32));
+}
+
+// Compute the verifier of the first Depth frames.
+template<class T>
+uint32_t VerifierHash(T it_begin, size_t Depth) {
+  uint32_t Res = 0;
+  for (size_t I = 0; I < Depth; I++, it_begin++)
+    Res = VerifierStep(Res, *it_begin);
+  return Res;
+}
+
+// Compressed form of a stack trace.
+//
+// Version 0 is the bare hash. Version 1 also records the number of frames
+// and the verifier, so that the search only checks for a match at the
+// recorded depth, does not search any deeper, and rejects most of the hash
+// collisions without knowing the stack trace.
+//
+// A record is stored as two 64-bit words: the hash, and
+// Version (bits 56-63) | Depth (bits 48-55) | Verifier (bits 0-31).
+// A version 0 record may be stored as the hash alone.
+struct CompressedTrace {
+  static const uint8_t LatestVersion = 1;
+
+  uint64_t Hash = 0;     //< Hash() of the stack trace.
+  uint32_t Verifier = 0; //< VerifierHash() of the stack trace. Version 1.
+  uint8_t Depth = 0;     //< Number of frames. Version 1.
+  uint8_t Version = 0;
+
+  bool HasDepth() const { return Version >= 1; }
+
+  void Pack(uint64_t Words[2]) const;
+
+  // Read a record of NumWords (1 or 2) words. Returns false if it is not
+  // valid, e.g., of an unknown version.
+  static bool Unpack(const uint64_t *Words, size_t NumWords,
+                     CompressedTrace &CT);
+};
+
+// Compress a stack trace in the latest version. Falls back to version 0 if
+// the depth does not fit.
+CompressedTrace Compress(const StackTrace &ST, const SearchParams &P);
+
+// Check a candidate stack trace of the given depth whose hash matches the
+// wanted one against the rest of the compressed form, i.e., all that the
+// decoder of stored records has. A mismatch at the recorded depth is counted
+// in DoesNotMatchCount.
+template<class T>
+bool CheckCompressed(const CompressedTrace &Wanted, T it_begin, size_t Depth,
+                     int &DoesNotMatchCount) {
+  if (Wanted.HasDepth()) {
+    if (Depth != Wanted.Depth)
+      return false;
+    if (VerifierHash(it_begin, Depth) != Wanted.Verifier) {
+      DoesNotMatchCount++;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Same as CheckCompressed, and then compare to the wanted stack trace. Only
+// the candidates passing the former are compared.
+template<class T>
+bool CheckCandidate(const CompressedTrace &Wanted, const StackTrace &WantedST,
+                    T it_begin, size_t Depth, int &DoesNotMatchCount) {
+  if (!CheckCompressed(Wanted, it_begin, Depth, DoesNotMatchCount))
+    return false;
+  if (AreSTSame(WantedST.begin(), WantedST.size(), it_begin, Depth))
+    return true;
+  DoesNotMatchCount++;
+  return false;
+}
+
+// Counters of a search, filled by the searches that are given one.
+struct SearchStats {
+  std::vector<uint64_t> NodesPerDepth; //< Visited states per depth.
+  uint64_t PrunedAtDepth1 = 0; //< Subtrees pruned at PruningDepth1+1.
+  uint64_t PrunedAtDepth2 = 0; //< Subtrees pruned at PruningDepth2+1.
+
+  // Clear the counters for a search up to the maximum depth.
+  void Reset(size_t MaxDepth);
+  // Add the counters of a part of the same search.
+  void Add(const SearchStats &Other);
+  uint64_t NumNodes() const;
+};
+
+// Limits of a single reconstruction search, so that a pathological stack
+// trace cannot stall a whole batch. Zero is no limit.
+struct SearchBudget {
+  uint64_t MaxNodes = 0;  //< Visited states.
+  double MaxSeconds = 0;  //< Wall-clock time.
+
+  bool IsLimited() const { return MaxNodes || MaxSeconds > 0; }
+};
+
+// Accounts the states visited by a search against its budget. The searches
+// call Step() on each state, which only decrements a counter; the budget is
+// checked once per CheckInterval states, so the time limit is overrun by at
+// most that many states. The contexts of a ParallelSearch share the node
+// count and the exhaustion through a Shared, and grab the states in chunks,
+// hence they may give up slightly before MaxNodes states in total.
+class BudgetMeter {
+public:
+  typedef std::chrono::steady_clock Clock;
+  static const uint64_t CheckInterval = 4096;
+
+  struct Shared {
+    std::atomic<uint64_t> NodesUsed{0};
+    std::atomic<bool> Exhausted{false};
+  };
+
+  // Start metering a search. S is reset by the owner before each search.
+  void Start(const SearchBudget &B, Shared *S = nullptr);
+
+  // Whether the search may visit one more state. Once it returns false, it
+  // returns false until the next Start.
+  bool Step() { return Left-- != 0 || Refill(); }
+
+  bool Exhausted() const { return IsExhausted; }
+
+private:
+  SearchBudget Budget;
+  Clock::time_point Deadline;
+  Shared *SharedState = nullptr;
+  uint64_t Used = 0;        //< States granted so far, without SharedState.
+  uint64_t Left = 0;        //< States granted and not visited yet.
+  bool IsExhausted = false;
+
+  bool Refill();
+  bool Exhaust();
+};
+
+// State of a single reconstruction search. The reverse call graph and the
+// parameters are shared read-only, and everything that DFS mutates lives in
+// the context. Hence, each worker thread owns one context and many contexts
+// can search on the same reverse call graph concurrently.
+//
+// GraphT is the reverse call graph layout: ReverseCallGraph or
+// CsrReverseCallGraph. HashT is the hash policy (see hash_policy.hpp), which
+// must be the one of the parameters.
+template<class GraphT, class HashT>
+class SearchContext {
+  typedef typename GraphT::NodeRef NodeRef;
+
+  const GraphT &G;
+  const SearchParams &P;
+
+  // Followings are set everytime before calling DFS based on the stack trace
+  // to reconstruct.
+  const StackTrace *WantedST; //< Wanted stack trace.
+  CompressedTrace Wanted;     //< The compressed WantedST.
+  uint64_t WantedHash;        //< The hash for WantedST.
+  uint64_t WantedHashMed1;    //< Pruning hash 1.
+  uint64_t WantedHashMed2;    //< Pruning hash 2.
+  size_t SearchEnd;           //< Depth not to search beyond.
+
+  std::vector<uint64_t> ST;   //< Stack trace to fill by reconstruction.
+                              //< Allocated based on the maximum depth.
+
+  // Set when the search is shared by many contexts. Once any of them finds
+  // the stack trace, the rest stop searching.
+  const std::atomic<bool> *Cancel;
+
+  BudgetMeter Meter;
+
+  bool DFS(size_t CurrentDepth, uint64_t CurrentHash, NodeRef EntryFunc);
+
+  void SetWanted(const CompressedTrace &CT, const StackTrace &WantedST);
+
+  template<class, class> friend class ParallelSearch;
+
+public:
+  int DoesNotMatchCount;      //< Count how many incorrect reconstructions
+                              //< were made in the last search.
+  SearchStats *Stats;         //< If set, counts the search. The caller resets
+                              //< it before each search.
+  SearchBudget Budget;        //< Limits of each search.
+  bool BudgetExhausted;       //< Whether the last search gave up on the
+                              //< budget. It is not found, but may exist.
+
+  SearchContext(const GraphT &G, const SearchParams &P);
+
+  // Search for the stack trace with the given compressed form, starting from
+  // the entry function. Returns whether WantedST is found. If not found,
+  // BudgetExhausted tells whether the search was complete.
+  bool Reconstruct(uint64_t FuncEntryPc, const CompressedTrace &CT,
+                   const StackTrace &WantedST);
+};
+
+// Reconstructs a single stack trace on all workers of a pool.
+//
+// The search tree is split at SplitDepth: the paths from the entry function
+// up to SplitDepth are enumerated first, and each of them becomes a task
+// that searches the subtree below it. Tasks are run in parallel and the
+// remaining tasks are cancelled as soon as one of them verifies a match.
+// This bounds the latency of the searches with a large fan-in rather than
+// the throughput of many searches.
+template<class GraphT, class HashT>
+class ParallelSearch {
+  typedef typename GraphT::NodeRef NodeRef;
+
+  WorkStealingPool &Pool;
+  size_t SplitDepth;
+  SearchContext<GraphT, HashT> Collector; //< Enumerates the tasks.
+  // Per worker.
+  std::vector<std::unique_ptr<SearchContext<GraphT, HashT>>> Contexts;
+  std::atomic<bool> Found; //< Cancels the tasks once set.
+  BudgetMeter::Shared SharedBudget; //< Budget of all contexts.
+
+  // A subtree to search: its root function and the hash of the path leading
+  // to it. The frames of the path are kept in Prefixes at index
+  // I*SplitDepth for the Ith task.
+  struct Task {
+    NodeRef Func;
+    uint64_t Hash;
+  };
+  std::vector<Task> Tasks;
+  std::vector<uint64_t> Prefixes;
+
+  // Tasks are run in batches of at most this many, to bound the memory for
+  // the deep splits.
+  static const size_t MaxPendingTasks = 1 << 16;
+
+  bool CollectTasks(size_t CurrentDepth, uint64_t CurrentHash,
+                    NodeRef EntryFunc);
+  // Whether the bucket check at the depth prunes the path, counting it.
+  bool IsPruned(size_t CurrentDepth, uint64_t CurrentHash);
+  bool RunTasks();
+
+  std::vector<SearchStats> ContextStats; //< Per worker, if Stats is set.
+
+public:
+  int DoesNotMatchCount; //< Summed over all tasks of the last search.
+  SearchStats *Stats;    //< Same as SearchContext::Stats.
+  SearchBudget Budget;   //< Same as SearchContext::Budget, for the tasks of
+                         //< a search in total.
+  bool BudgetExhausted;  //< Same as SearchContext::BudgetExhausted.
+
+  ParallelSearch(const GraphT &G, const SearchParams &P,
+                 WorkStealingPool &Pool, size_t SplitDepth);
+
+  // Same as SearchContext::Reconstruct.
+  bool Reconstruct(uint64_t FuncEntryPc, const CompressedTrace &CT,
+                   const StackTrace &WantedST);
+};
+
+#endif
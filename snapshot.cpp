@@ -0,0 +1,185 @@
+#include "snapshot.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+const char Magic[8] = {'S', 'T', 'R', 'C', 'G', 'S', 'N', 'P'};
+
+enum SectionId {
+  FuncPcs,
+  Callers,
+  BucketRanges,
+  CallSitePcs,
+  CallSiteCallers,
+  IdsByPc,
+  SymFuncPcs,
+  SymNameOffsets,
+  SymNames,
+  SymFuncsByName,
+  SymCallSitePcs,
+  SymCallerPcs,
+  NumSectionIds
+};
+
+struct Section {
+  uint64_t Offset; //< From the start of the file.
+  uint64_t Count;  //< Number of elements.
+};
+
+struct Header {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t NumSections;
+  Section Sections[NumSectionIds];
+};
+
+uint64_t AlignTo8(uint64_t Offset) { return (Offset + 7) & ~7ull; }
+
+} // namespace
+
+bool Snapshot::IsSnapshot(const std::string &Path) {
+  std::ifstream In(Path, std::ios::binary);
+  char Buf[sizeof(Magic)];
+  return In.read(Buf, sizeof(Buf)) && !memcmp(Buf, Magic, sizeof(Magic));
+}
+
+bool Snapshot::Write(const std::string &Path, const CsrReverseCallGraph &G,
+                     const SymbolTable &Symbols, std::string &Err) {
+  // Raw bytes of each section.
+  std::vector<std::pair<const void*, size_t/*ElemSize*/>> Data(NumSectionIds);
+  Header H;
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.NumSections = NumSectionIds;
+  auto Set = [&](SectionId Id, const auto &Array) {
+    Data[Id] = std::make_pair((const void*)Array.begin(), sizeof(Array[0]));
+    H.Sections[Id].Count = Array.size();
+  };
+  Set(FuncPcs, G.FuncPcs);
+  Set(Callers, G.Callers);
+  Set(BucketRanges, G.BucketRanges);
+  Set(CallSitePcs, G.CallSitePcs);
+  Set(CallSiteCallers, G.CallSiteCallers);
+  Set(IdsByPc, G.IdsByPc);
+  Set(SymFuncPcs, Symbols.FuncPcs);
+  Set(SymNameOffsets, Symbols.NameOffsets);
+  Set(SymNames, Symbols.Names);
+  Set(SymFuncsByName, Symbols.FuncsByName);
+  Set(SymCallSitePcs, Symbols.CallSitePcs);
+  Set(SymCallerPcs, Symbols.CallerPcs);
+
+  uint64_t Offset = AlignTo8(sizeof(H));
+  for (int I = 0; I < NumSectionIds; I++) {
+    H.Sections[I].Offset = Offset;
+    Offset = AlignTo8(Offset + H.Sections[I].Count * Data[I].second);
+  }
+
+  std::ofstream Out(Path, std::ios::binary | std::ios::trunc);
+  const char Zeros[8] = {0};
+  Out.write((const char*)&H, sizeof(H));
+  uint64_t Written = sizeof(H);
+  for (int I = 0; I < NumSectionIds; I++) {
+    Out.write(Zeros, H.Sections[I].Offset - Written);
+    Out.write((const char*)Data[I].first, H.Sections[I].Count * Data[I].second);
+    Written = H.Sections[I].Offset + H.Sections[I].Count * Data[I].second;
+  }
+  if (!Out) {
+    Err = "cannot write " + Path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool Snapshot::Load(const std::string &Path, std::string &Err) {
+  if (!File.Open(Path, Err))
+    return false;
+
+  Header H;
+  if (File.size() < sizeof(H)) {
+    Err = Path + " is too small to be a snapshot";
+    return false;
+  }
+  memcpy(&H, File.data(), sizeof(H));
+  if (memcmp(H.Magic, Magic, sizeof(Magic))) {
+    Err = Path + " is not a snapshot";
+    return false;
+  }
+  if (H.Version != Version || H.NumSections != NumSectionIds) {
+    Err = Path + " is a snapshot of version " + std::to_string(H.Version) +
+          ", expected version " + std::to_string(Version);
+    return false;
+  }
+
+  // Check the bounds and the alignment before viewing the sections.
+  bool Valid = true;
+  auto Get = [&](SectionId Id, auto *Type) {
+    typedef std::remove_pointer_t<decltype(Type)> T;
+    const Section &S = H.Sections[Id];
+    if (S.Offset % alignof(T) || S.Offset > File.size() ||
+        S.Count > (File.size() - S.Offset) / sizeof(T)) {
+      Valid = false;
+      return ArrayRef<T>();
+    }
+    return ArrayRef<T>((const T*)(File.data() + S.Offset), S.Count);
+  };
+  auto GFuncPcs = Get(FuncPcs, (uint64_t*)nullptr);
+  auto GCallers = Get(Callers, (CsrReverseCallGraph::FuncCallers*)nullptr);
+  auto GBucketRanges = Get(BucketRanges,
+                           (CsrReverseCallGraph::CallerRange*)nullptr);
+  auto GCallSitePcs = Get(CallSitePcs, (uint64_t*)nullptr);
+  auto GCallSiteCallers = Get(CallSiteCallers, (uint32_t*)nullptr);
+  auto GIdsByPc = Get(IdsByPc, (uint32_t*)nullptr);
+  auto SFuncPcs = Get(SymFuncPcs, (uint64_t*)nullptr);
+  auto SNameOffsets = Get(SymNameOffsets, (uint32_t*)nullptr);
+  auto SNames = Get(SymNames, (char*)nullptr);
+  auto SFuncsByName = Get(SymFuncsByName, (uint32_t*)nullptr);
+  auto SCallSitePcs = Get(SymCallSitePcs, (uint64_t*)nullptr);
+  auto SCallerPcs = Get(SymCallerPcs, (uint64_t*)nullptr);
+
+  // Check the sizes that the lookups rely on.
+  Valid = Valid && GCallers.size() == GFuncPcs.size() &&
+          GCallSiteCallers.size() == GCallSitePcs.size() &&
+          GIdsByPc.size() == GFuncPcs.size() &&
+          !GBucketRanges.empty() &&
+          GBucketRanges[GBucketRanges.size() - 1].Begin ==
+            GBucketRanges[GBucketRanges.size() - 1].End &&
+          SNameOffsets.size() == SFuncPcs.size() + 1 &&
+          SFuncsByName.size() == SFuncPcs.size() &&
+          SNameOffsets[SFuncPcs.size()] == SNames.size() &&
+          SCallerPcs.size() == SCallSitePcs.size();
+  // The walk over the callers relies on the ranges being within the call
+  // site arrays, and the lists of buckets being ended before the last range,
+  // which is empty.
+  for (size_t F = 0; Valid && F < GFuncPcs.size(); F++)
+    Valid = GCallers[F].First.Begin <= GCallers[F].First.End &&
+            GCallers[F].First.End <= GCallSitePcs.size() &&
+            GCallers[F].Rest < GBucketRanges.size();
+  for (size_t I = 0; Valid && I < GBucketRanges.size(); I++)
+    Valid = GBucketRanges[I].Begin <= GBucketRanges[I].End &&
+            GBucketRanges[I].End <= GCallSitePcs.size();
+  // The function ids index the arrays of the functions, and the name offsets
+  // delimit the names.
+  for (size_t I = 0; Valid && I < GCallSiteCallers.size(); I++)
+    Valid = GCallSiteCallers[I] < GFuncPcs.size();
+  for (size_t I = 0; Valid && I < GIdsByPc.size(); I++)
+    Valid = GIdsByPc[I] < GFuncPcs.size();
+  for (size_t I = 0; Valid && I < SFuncsByName.size(); I++)
+    Valid = SFuncsByName[I] < SFuncPcs.size();
+  for (size_t I = 0; Valid && I + 1 < SNameOffsets.size(); I++)
+    Valid = SNameOffsets[I] <= SNameOffsets[I + 1];
+  if (!Valid) {
+    Err = Path + " is a corrupted snapshot";
+    return false;
+  }
+
+  G.reset(new CsrReverseCallGraph(GFuncPcs, GCallers, GBucketRanges,
+                                  GCallSitePcs, GCallSiteCallers, GIdsByPc));
+  Syms.reset(new SymbolTable(SFuncPcs, SNameOffsets, SNames, SFuncsByName,
+                                SCallSitePcs, SCallerPcs));
+  return true;
+}
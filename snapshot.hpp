@@ -0,0 +1,45 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "csr.hpp"
+#include "mapped_file.hpp"
+#include "symtab.hpp"
+
+// Binary snapshot of the filtered reverse call graph and the symbol table, to
+// skip parsing the call graph disassembly on repeated runs.
+//
+// The file is a fixed header followed by the arrays of CsrReverseCallGraph
+// and SymbolTable, each aligned to 8 bytes. The header holds the file offset
+// and the element count of each array. The arrays are stored in host byte
+// order exactly as they are kept in memory, so that a loaded snapshot is the
+// mapped file itself and there is no deserialization step.
+class Snapshot {
+  MappedFile File;
+  std::unique_ptr<CsrReverseCallGraph> G;
+  std::unique_ptr<SymbolTable> Syms;
+
+public:
+  // Incremented on any change to the layout.
+  static const uint32_t Version = 2;
+
+  // Whether the file starts with the snapshot magic.
+  static bool IsSnapshot(const std::string &Path);
+
+  // Write the graph and the table to Path. Returns false and sets Err on
+  // failure.
+  static bool Write(const std::string &Path, const CsrReverseCallGraph &G,
+                    const SymbolTable &Symbols, std::string &Err);
+
+  // Map the snapshot at Path. Returns false and sets Err on failure.
+  bool Load(const std::string &Path, std::string &Err);
+
+  const CsrReverseCallGraph &Graph() const { return *G; }
+  CsrReverseCallGraph &Graph() { return *G; }
+  const SymbolTable &Symbols() const { return *Syms; }
+};
+
+#endif
@@ -0,0 +1,236 @@
+// Benchmark runner over a sweep of synthetic workloads.
+//
+// For each combination of the generator parameters, st_gen writes a call
+// graph and stack traces, and st_reconst is run on them for each combination
+// of the search parameters. The runner reports the parse and graph build
+// times and the reconstruction throughput printed by st_reconst, and the
+// peak RSS of the st_reconst process, as a tab-separated table on stdout.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "options.hpp"
+
+namespace {
+
+struct BenchOptions {
+  std::string GenPath = "./st_gen";
+  std::string ReconstPath = "./st_reconst";
+  std::string Dir = "/tmp";
+  std::vector<std::string> Funcs = {"10000"};
+  std::vector<std::string> FanIns = {"zipf"};
+  std::vector<std::string> BucketSizes = {"8"};
+  std::vector<std::string> Depths = {"1-16"};
+  std::vector<std::string> Params = {"12:4:6"}; //< max:pd1:pd2.
+  std::string NumTraces = "1000";
+  std::string Seed = "1";
+  std::vector<std::string> ReconstArgs; //< Passed to st_reconst as they are.
+};
+
+// Measurements of a st_reconst run.
+struct RunResult {
+  bool Ok = false;
+  double ParseSeconds = -1;
+  double BuildSeconds = -1;
+  long PeakRssKiB = 0;
+  size_t NumFound = 0;
+  size_t NumTraces = 0;
+  double TracesPerSec = 0;
+};
+
+// Run the program with the arguments, and wait for it. If Lines is given, the
+// standard error of the program is read from a pipe and passed to Lines line
+// by line; otherwise, it is inherited. Returns whether the program exited
+// with 0, and its resource usage.
+bool Run(const std::vector<std::string> &Args, struct rusage &Usage,
+         const std::function<void(const std::string &)> &Lines = nullptr) {
+  int Pipe[2] = {-1, -1};
+  if (Lines && pipe(Pipe) != 0)
+    return false;
+  pid_t Pid = fork();
+  if (Pid < 0)
+    return false;
+  if (Pid == 0) {
+    if (Lines) {
+      dup2(Pipe[1], STDERR_FILENO);
+      close(Pipe[0]);
+      close(Pipe[1]);
+    }
+    std::vector<char *> Argv;
+    for (const auto &A : Args)
+      Argv.push_back(const_cast<char *>(A.c_str()));
+    Argv.push_back(nullptr);
+    execv(Argv[0], Argv.data());
+    fprintf(stderr, "ERROR: cannot run %s: %s\n", Argv[0], strerror(errno));
+    _exit(127);
+  }
+
+  if (Lines) {
+    close(Pipe[1]);
+    FILE *In = fdopen(Pipe[0], "r");
+    char *Line = nullptr;
+    size_t Cap = 0;
+    ssize_t Len;
+    while ((Len = getline(&Line, &Cap, In)) > 0)
+      Lines(std::string(Line, Len));
+    free(Line);
+    fclose(In);
+  }
+  int Status = 0;
+  if (wait4(Pid, &Status, 0, &Usage) < 0)
+    return false;
+  return WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+}
+
+// The number following the last " in " of the line.
+double SecondsOf(const std::string &Line) {
+  size_t Pos = Line.rfind(" in ");
+  return Pos == std::string::npos ? -1 : atof(Line.c_str() + Pos + 4);
+}
+
+RunResult RunReconstruction(const BenchOptions &Opts, const std::string &CG,
+                            const std::string &ST, const std::string &Params) {
+  std::vector<std::string> Args = {Opts.ReconstPath, CG, ST};
+  size_t Begin = 0;
+  for (int I = 0; I < 3; I++) {
+    size_t End = Params.find(':', Begin);
+    Args.push_back(Params.substr(Begin, End - Begin));
+    Begin = End == std::string::npos ? End : End + 1;
+  }
+  Args.insert(Args.end(), Opts.ReconstArgs.begin(), Opts.ReconstArgs.end());
+
+  RunResult R;
+  auto Lines = [&](const std::string &Line) {
+    if (Line.compare(0, 20, "Read the call graph:") == 0)
+      R.ParseSeconds = SecondsOf(Line);
+    else if (Line.compare(0, 27, "Built the reverse call grap") == 0)
+      R.BuildSeconds = SecondsOf(Line);
+    else if (Line.compare(0, 13, "Reconstructed") == 0)
+      sscanf(Line.c_str(), "Reconstructed %zu/%zu stack traces in %*f sec "
+                           "(%lf", &R.NumFound, &R.NumTraces, &R.TracesPerSec);
+    else if (Line.compare(0, 6, "ERROR:") == 0)
+      std::cerr << Line;
+  };
+  struct rusage Usage;
+  R.Ok = Run(Args, Usage, Lines);
+  R.PeakRssKiB = Usage.ru_maxrss;
+  return R;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  BenchOptions Opts;
+  bool BadOptions = false;
+  for (int I = 1; I < argc; I++) {
+    if (!strcmp(argv[I], "--")) {
+      Opts.ReconstArgs.assign(argv + I + 1, argv + argc);
+      break;
+    }
+    if (!ReadOption(argv[I], "--gen", Opts.GenPath) &&
+        !ReadOption(argv[I], "--reconst", Opts.ReconstPath) &&
+        !ReadOption(argv[I], "--dir", Opts.Dir) &&
+        !ReadListOption(argv[I], "--funcs", Opts.Funcs) &&
+        !ReadListOption(argv[I], "--fan-in", Opts.FanIns) &&
+        !ReadListOption(argv[I], "--bucket-size", Opts.BucketSizes) &&
+        !ReadListOption(argv[I], "--depth", Opts.Depths) &&
+        !ReadListOption(argv[I], "--params", Opts.Params) &&
+        !ReadOption(argv[I], "--traces", Opts.NumTraces) &&
+        !ReadOption(argv[I], "--seed", Opts.Seed)) {
+      std::cerr << "Unknown option: " << argv[I] << std::endl;
+      BadOptions = true;
+    }
+  }
+  for (const auto &P : Opts.Params) {
+    unsigned MaxDepth, PD1, PD2;
+    if (sscanf(P.c_str(), "%u:%u:%u", &MaxDepth, &PD1, &PD2) != 3) {
+      std::cerr << "Bad search parameters: " << P << std::endl;
+      BadOptions = true;
+    }
+  }
+
+  if (BadOptions) {
+    std::cerr << "OVERVIEW: benchmark of st_reconst over synthetic workloads"
+              << std::endl;
+    std::cerr << "USAGE: " << argv[0]
+              << " [options] [-- st_reconst options]\n\n";
+    std::cerr << "Options taking a LIST sweep over its comma-separated "
+                 "values.\n\n";
+    std::cerr << "OPTIONS:\n"
+              << " --gen=PATH                 "
+              << "Generator binary (default: ./st_gen)\n"
+              << " --reconst=PATH             "
+              << "Reconstruction binary (default: ./st_reconst)\n"
+              << " --dir=DIR                  "
+              << "Directory of the generated files (default: /tmp)\n"
+              << " --funcs=LIST               "
+              << "Functions of the call graphs (default: 10000)\n"
+              << " --fan-in=LIST              "
+              << "Distributions of the call targets (default: zipf)\n"
+              << " --bucket-size=LIST         "
+              << "Indirect targets per type id (default: 8)\n"
+              << " --depth=LIST               "
+              << "Depths of the stack traces, D or MIN-MAX (default: 1-16)\n"
+              << " --params=LIST              "
+              << "Search parameters max_depth:pruning_depth_1:"
+                 "pruning_depth_2\n"
+              << "                            "
+              << "(default: 12:4:6)\n"
+              << " --traces=N                 "
+              << "Stack traces per workload (default: 1000)\n"
+              << " --seed=N                   "
+              << "Seed of the generator (default: 1)\n"
+              << std::endl;
+    return -1;
+  }
+
+  printf("funcs\tfan_in\tbucket_size\tdepth\tparams\tparse_sec\tbuild_sec"
+         "\tpeak_rss_mib\tfound\ttraces\ttraces_per_sec\n");
+  std::string Prefix = Opts.Dir + "/st_bench_" + std::to_string(getpid());
+  std::string CG = Prefix + ".cg", ST = Prefix + ".st";
+  bool AllOk = true;
+  for (const auto &Funcs : Opts.Funcs)
+  for (const auto &FanIn : Opts.FanIns)
+  for (const auto &BucketSize : Opts.BucketSizes)
+  for (const auto &Depth : Opts.Depths) {
+    std::vector<std::string> GenArgs = {
+      Opts.GenPath, "--out=" + Prefix, "--funcs=" + Funcs,
+      "--fan-in=" + FanIn, "--bucket-size=" + BucketSize, "--depth=" + Depth,
+      "--traces=" + Opts.NumTraces, "--seed=" + Opts.Seed};
+    struct rusage Usage;
+    if (!Run(GenArgs, Usage)) {
+      std::cerr << "ERROR: the generator failed for --funcs=" << Funcs
+                << " --fan-in=" << FanIn << " --bucket-size=" << BucketSize
+                << " --depth=" << Depth << std::endl;
+      AllOk = false;
+      continue;
+    }
+    for (const auto &Params : Opts.Params) {
+      RunResult R = RunReconstruction(Opts, CG, ST, Params);
+      printf("%s\t%s\t%s\t%s\t%s\t", Funcs.c_str(), FanIn.c_str(),
+             BucketSize.c_str(), Depth.c_str(), Params.c_str());
+      if (!R.Ok) {
+        printf("FAILED\n");
+        AllOk = false;
+      } else {
+        printf("%.4f\t%.4f\t%.1f\t%zu\t%zu\t%.1f\n", R.ParseSeconds,
+               R.BuildSeconds, R.PeakRssKiB / 1024.0, R.NumFound, R.NumTraces,
+               R.TracesPerSec);
+      }
+      fflush(stdout);
+    }
+  }
+  unlink(CG.c_str());
+  unlink(ST.c_str());
+  return AllOk ? 0 : -1;
+}
@@ -0,0 +1,152 @@
+#include "st_collect.hpp"
+#include "hash_policy.hpp"
+#include "search.hpp"
+
+#include <pthread.h>
+
+// Bounds of the text of the program, defined by the linker.
+extern "C" char __executable_start[];
+extern "C" char etext[];
+
+namespace {
+
+struct CollectorConfig {
+  bool Initialized = false;
+  HashKind Kind = DefaultHashKind;
+  uint32_t MaxDepth = 0;
+  uint32_t PruningDepth1 = 0;
+  uint32_t PruningDepth2 = 0;
+  uint32_t SkipFrames = 0;
+  uintptr_t TextBegin = 0;
+  uintptr_t TextEnd = 0;
+  uint64_t PcBias = 0;
+};
+
+CollectorConfig Cfg;
+
+// Stack of the calling thread, looked up on its first walk. The frames are
+// only followed within it.
+thread_local uintptr_t StackLo = 0;
+thread_local uintptr_t StackHi = 0;
+thread_local bool StackLookup = false;
+
+// Look up the stack of the calling thread. Returns false if the lookup is
+// in progress on this thread: pthread_getattr_np may allocate, and the
+// allocation hook may collect meanwhile.
+bool InitStackBounds() {
+  if (StackLookup)
+    return false;
+  StackLookup = true;
+  pthread_attr_t Attr;
+  if (pthread_getattr_np(pthread_self(), &Attr) == 0) {
+    void *Addr;
+    size_t Size;
+    if (pthread_attr_getstack(&Attr, &Addr, &Size) == 0) {
+      StackLo = (uintptr_t)Addr;
+      StackHi = StackLo + Size;
+    }
+    pthread_attr_destroy(&Attr);
+  }
+  StackLookup = false;
+  return StackHi != 0;
+}
+
+// Move to the frame of the caller. The saved frame pointers grow towards the
+// top of the stack, and a frame holds the saved frame pointer and the return
+// address.
+inline bool NextFrame(const uintptr_t *&FP) {
+  uintptr_t Next = FP[0];
+  if (Next <= (uintptr_t)FP || Next % sizeof(uintptr_t) ||
+      Next + 2 * sizeof(uintptr_t) > StackHi)
+    return false;
+  FP = (const uintptr_t *)Next;
+  return true;
+}
+
+// Walk the frames above the entry function, starting from the frame FP of
+// the function called by the entry function (or by a skipped frame), and
+// call Visit with the index and the pc of each. Returns the number of frames.
+template<class VisitT>
+inline uint32_t WalkFrames(const uintptr_t *FP, uint32_t MaxFrames,
+                           VisitT Visit) {
+  if (!StackHi && !InitStackBounds())
+    return 0;
+  if ((uintptr_t)FP < StackLo || (uintptr_t)FP >= StackHi)
+    return 0;
+  // The return address of the first frame is in the entry function, which is
+  // given instead.
+  for (uint32_t I = 0; I <= Cfg.SkipFrames; I++)
+    if (!NextFrame(FP))
+      return 0;
+
+  uint32_t Depth = 0;
+  while (Depth < MaxFrames) {
+    uintptr_t ReturnAddress = FP[1];
+    if (ReturnAddress < Cfg.TextBegin || ReturnAddress >= Cfg.TextEnd)
+      break;
+    Visit(Depth, ReturnAddress - Cfg.PcBias);
+    Depth++;
+    if (!NextFrame(FP))
+      break;
+  }
+  return Depth;
+}
+
+template<class HashT>
+inline void Collect(const uintptr_t *FP, StCollectRecord *Record) {
+  const uint32_t PD1 = Cfg.PruningDepth1, PD2 = Cfg.PruningDepth2;
+  uint64_t Hash = 0;
+  uint32_t Verifier = 0;
+  auto Fold = [&](uint32_t Idx, uint64_t PC) {
+    Hash = HashStep<HashT>(Hash, PC, Idx, PD1, PD2);
+    Verifier = VerifierStep(Verifier, PC);
+  };
+  Record->Depth = WalkFrames(FP, Cfg.MaxDepth, Fold);
+  Record->Hash = Hash;
+  Record->Verifier = Verifier;
+}
+
+} // namespace
+
+int StCollectInit(const StCollectConfig *Config) {
+  CollectorConfig C;
+  if (Config->Hash && !ParseHashKind(Config->Hash, C.Kind))
+    return -1;
+  C.MaxDepth = Config->MaxDepth;
+  C.PruningDepth1 = Config->PruningDepth1;
+  C.PruningDepth2 = Config->PruningDepth2;
+  C.SkipFrames = Config->SkipFrames;
+  C.TextBegin = Config->TextBegin;
+  C.TextEnd = Config->TextEnd;
+  if (!C.TextBegin && !C.TextEnd) {
+    C.TextBegin = (uintptr_t)__executable_start;
+    C.TextEnd = (uintptr_t)etext;
+  }
+  if (C.TextBegin >= C.TextEnd)
+    return -1;
+  C.PcBias = Config->PcBias;
+  C.Initialized = true;
+  Cfg = C;
+  return 0;
+}
+
+__attribute__((noinline))
+int StCollect(uint64_t EntryPc, StCollectRecord *Record) {
+  if (!Cfg.Initialized)
+    return -1;
+  const uintptr_t *FP = (const uintptr_t *)__builtin_frame_address(0);
+  Record->EntryPc = EntryPc;
+  WithHashPolicy(Cfg.Kind, [&](auto Policy) {
+    Collect<decltype(Policy)>(FP, Record);
+  });
+  return 0;
+}
+
+__attribute__((noinline))
+uint32_t StCollectPcs(uint64_t *Pcs, uint32_t MaxPcs) {
+  if (!Cfg.Initialized)
+    return 0;
+  const uintptr_t *FP = (const uintptr_t *)__builtin_frame_address(0);
+  return WalkFrames(FP, MaxPcs,
+                    [&](uint32_t Idx, uint64_t PC) { Pcs[Idx] = PC; });
+}
@@ -0,0 +1,66 @@
+#ifndef __ST_COLLECT_H__
+#define __ST_COLLECT_H__
+
+// Runtime collection of compressed stack traces, for allocation hooks.
+//
+// StCollect walks the frame pointers from its caller, the entry function
+// (e.g., malloc), and folds each return address into the stack trace hash as
+// it is read, with the same HashStep and bucket layout as the offline
+// compression (see hash_policy.hpp and search.hpp). The frames are never
+// stored: a collected stack trace is only the entry pc, the hash, the
+// verifier and the depth, i.e., a version 1 CompressedTrace that st_reconst
+// can reconstruct.
+//
+// The walk stops at MaxDepth frames, as the ASan output is clipped, or at the
+// first return address outside the text of the program, where the frames of
+// libc and of the other libraries start, which the call graph does not cover.
+// The program must be built with -fno-omit-frame-pointer.
+//
+// Callable from C. Linux on x86-64 only.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct StCollectConfig {
+  uint32_t MaxDepth;      //< Frames to hash at most.
+  uint32_t PruningDepth1; //< Same as the st_reconst arguments.
+  uint32_t PruningDepth2;
+  const char *Hash;       //< Hash policy name as --hash, or null for the
+                          //< default.
+  uint64_t TextBegin;     //< Return addresses in [TextBegin, TextEnd) are
+  uint64_t TextEnd;       //< hashed. Both zero for the text of the program.
+  uint64_t PcBias;        //< Subtracted from the return addresses, e.g., the
+                          //< load base of a PIE to hash link-time pcs.
+  uint32_t SkipFrames;    //< Frames between the entry function and the
+                          //< caller of StCollect, e.g., a hook wrapper.
+};
+
+struct StCollectRecord {
+  uint64_t EntryPc;  //< As given to StCollect.
+  uint64_t Hash;     //< Hash() of the frames.
+  uint32_t Verifier; //< VerifierHash() of the frames.
+  uint32_t Depth;    //< Number of frames hashed.
+};
+
+// Set the configuration for all threads. Not thread-safe; call once before
+// any StCollect. Returns 0, or -1 if the configuration is invalid, e.g., an
+// unknown hash policy.
+int StCollectInit(const struct StCollectConfig *Config);
+
+// Collect the stack trace of the calling entry function, whose entry pc is
+// given. Returns 0, or -1 if not initialized.
+int StCollect(uint64_t EntryPc, struct StCollectRecord *Record);
+
+// Walk the frames as StCollect does, but store the return addresses in Pcs
+// instead of hashing them. Returns the number of frames, at most MaxPcs. For
+// tests and benchmarks.
+uint32_t StCollectPcs(uint64_t *Pcs, uint32_t MaxPcs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
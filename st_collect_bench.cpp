@@ -0,0 +1,212 @@
+// Microbenchmark of the runtime collection.
+//
+// An allocation function is called at the bottom of a recursion of each
+// given depth, and collects its stack trace in one of the ways below. The
+// cost per call is reported net of the same calls without collection:
+//
+//   collect:   StCollect, storing the 24-byte record.
+//   capture:   the same frame pointer walk storing the return addresses, and
+//              the full stack trace appended to a log.
+//   backtrace: backtrace(3) of glibc, i.e., the unwinder, appended likewise.
+//
+// Before timing, the hash and the verifier of StCollect are checked against
+// the offline compression of the captured stack trace.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <execinfo.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+#include "search.hpp"
+#include "st_collect.hpp"
+
+namespace {
+
+enum class Mode { None, Collect, Capture, Backtrace };
+
+const size_t MaxFrames = 256;
+const size_t LogWords = 1 << 20; //< Log of the stored stack traces.
+
+// Where the stack traces are stored. Reset once full, as a collector would
+// flush it.
+struct Sink {
+  std::vector<StCollectRecord> Records;
+  std::vector<uint64_t> Log;
+
+  Sink() {
+    Records.reserve(LogWords / 3);
+    Log.reserve(LogWords);
+  }
+  void Store(const StCollectRecord &R) {
+    if (Records.size() == Records.capacity())
+      Records.clear();
+    Records.push_back(R);
+  }
+  void Store(const uint64_t *Pcs, size_t N) {
+    if (Log.size() + N + 1 > Log.capacity())
+      Log.clear();
+    Log.push_back(N);
+    Log.insert(Log.end(), Pcs, Pcs + N);
+  }
+};
+
+Sink Out;
+
+// The allocation function.
+__attribute__((noinline)) void Allocate(Mode M) {
+  switch (M) {
+  case Mode::None:
+    break;
+  case Mode::Collect: {
+    StCollectRecord R;
+    StCollect((uint64_t)&Allocate, &R);
+    Out.Store(R);
+    break;
+  }
+  case Mode::Capture: {
+    uint64_t Pcs[MaxFrames];
+    Out.Store(Pcs, StCollectPcs(Pcs, MaxFrames));
+    break;
+  }
+  case Mode::Backtrace: {
+    void *Frames[MaxFrames];
+    int N = backtrace(Frames, MaxFrames);
+    Out.Store((const uint64_t *)Frames, N);
+    break;
+  }
+  }
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) int Recurse(int N, Mode M) {
+  if (N == 0) {
+    Allocate(M);
+    return 0;
+  }
+  int R = Recurse(N - 1, M);
+  asm volatile("" ::: "memory"); //< Not a tail call.
+  return R + 1;
+}
+
+// Collect both ways from the same frame, and compare to the offline
+// compression. Returns the number of frames, or -1 on a mismatch.
+__attribute__((noinline)) int CheckAllocate(const SearchParams &P) {
+  StCollectRecord R;
+  StCollect((uint64_t)&CheckAllocate, &R);
+  uint64_t Pcs[MaxFrames];
+  StackTrace ST(Pcs, Pcs + StCollectPcs(Pcs, P.MaxDepth));
+  uint64_t Hash = WithHashPolicy(P.Kind, [&](auto Policy) {
+    return ::Hash<decltype(Policy)>(ST, P);
+  });
+  if (R.Depth != ST.size() || R.Hash != Hash ||
+      R.Verifier != VerifierHash(ST.begin(), ST.size()))
+    return -1;
+  return R.Depth;
+}
+
+__attribute__((noinline)) int CheckRecurse(int N, const SearchParams &P) {
+  if (N == 0)
+    return CheckAllocate(P);
+  int R = CheckRecurse(N - 1, P);
+  asm volatile("" ::: "memory");
+  return R;
+}
+
+// Nanoseconds per call of the recursion.
+double TimeCalls(int Depth, Mode M, size_t Calls) {
+  auto Start = std::chrono::steady_clock::now();
+  for (size_t I = 0; I < Calls; I++)
+    Recurse(Depth, M);
+  auto Stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(Stop - Start).count() /
+         Calls;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> Depths = {"4", "8", "16", "32", "64"};
+  size_t Calls = 1000000;
+  std::string Params = "64:4:6";
+  std::string HashName;
+  bool BadOptions = false;
+  for (int I = 1; I < argc; I++) {
+    if (!ReadListOption(argv[I], "--depth", Depths) &&
+        !ReadOption(argv[I], "--calls", Calls) &&
+        !ReadOption(argv[I], "--params", Params) &&
+        !ReadOption(argv[I], "--hash", HashName)) {
+      std::cerr << "Unknown option: " << argv[I] << std::endl;
+      BadOptions = true;
+    }
+  }
+  unsigned MaxDepth = 0, PD1 = 0, PD2 = 0;
+  if (sscanf(Params.c_str(), "%u:%u:%u", &MaxDepth, &PD1, &PD2) != 3 ||
+      MaxDepth > MaxFrames) {
+    std::cerr << "Bad search parameters: " << Params << std::endl;
+    BadOptions = true;
+  }
+  HashKind Kind = DefaultHashKind;
+  if (!HashName.empty() && !ParseHashKind(HashName, Kind)) {
+    std::cerr << "Unknown or unsupported hash: " << HashName << std::endl;
+    BadOptions = true;
+  }
+  if (BadOptions) {
+    std::cerr << "OVERVIEW: cost of the runtime collection of compressed "
+                 "stack traces" << std::endl;
+    std::cerr << "USAGE: " << argv[0] << " [options]\n\n";
+    std::cerr << "OPTIONS:\n"
+              << " --depth=LIST               "
+              << "Recursion depths to call the allocation function at\n"
+              << "                            "
+              << "(default: 4,8,16,32,64)\n"
+              << " --calls=N                  "
+              << "Calls per depth and way (default: 1000000)\n"
+              << " --params=MAX:PD1:PD2       "
+              << "Maximum depth and pruning depths (default: 64:4:6)\n"
+              << " --hash=NAME                "
+              << "Hash policy, as the --hash of st_reconst\n"
+              << std::endl;
+    return -1;
+  }
+
+  StCollectConfig Config;
+  memset(&Config, 0, sizeof(Config));
+  Config.MaxDepth = MaxDepth;
+  Config.PruningDepth1 = PD1;
+  Config.PruningDepth2 = PD2;
+  Config.Hash = HashName.empty() ? nullptr : HashName.c_str();
+  if (StCollectInit(&Config) != 0) {
+    std::cerr << "ERROR: cannot initialize the collector" << std::endl;
+    return -1;
+  }
+  SearchParams P(MaxDepth, PD1, PD2, Kind);
+
+  // The unwinder loads libgcc on its first call.
+  void *Frame;
+  backtrace(&Frame, 1);
+
+  printf("depth\tframes\tbaseline_ns\tcollect_ns\tcapture_ns\tbacktrace_ns"
+         "\n");
+  for (const auto &D : Depths) {
+    int Depth = atoi(D.c_str());
+    int Frames = CheckRecurse(Depth, P);
+    if (Frames < 0) {
+      std::cerr << "ERROR: the collected hash differs from the offline hash "
+                   "at depth " << Depth << std::endl;
+      return -1;
+    }
+    double Baseline = TimeCalls(Depth, Mode::None, Calls);
+    double Collect = TimeCalls(Depth, Mode::Collect, Calls);
+    double Capture = TimeCalls(Depth, Mode::Capture, Calls);
+    double Backtrace = TimeCalls(Depth, Mode::Backtrace, Calls / 10 + 1);
+    printf("%d\t%d\t%.1f\t%.1f\t%.1f\t%.1f\n", Depth, Frames, Baseline,
+           Collect - Baseline, Capture - Baseline, Backtrace - Baseline);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,390 @@
+// Generator of synthetic call graphs and stack traces for st_reconst.
+//
+// The call graph is written in the llvm-objdump --call-graph-info format, and
+// the stack traces in the "ST:" format of the ASAN hooks, so both can be given
+// to st_reconst as they are. Functions are numbered from main (0) to the
+// allocation functions (the last ones), and laid out at increasing addresses:
+//  * Each function has a number of direct call sites. Their targets are drawn
+//    from a popularity distribution that favors the functions closer to the
+//    allocation functions, like the utility functions of a real program. With
+//    a Zipf distribution, the fan-in is heavy-tailed.
+//  * Direct calls go to later functions, so the direct call graph is acyclic,
+//    except for a fraction of back edges that make recursion, including self
+//    recursion.
+//  * Some functions are indirect targets, spread over the type ids so that
+//    each type bucket has the same number of targets. Some functions have an
+//    indirect call site of a random type id, which may call any target of the
+//    bucket.
+//  * Each stack trace starts at the hook call site of an allocation function,
+//    and walks random callers up to a depth, or until a function without
+//    callers.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+
+namespace {
+
+struct GenOptions {
+  size_t NumFuncs = 10000;     //< Functions, including main and the entries.
+  unsigned CallsPerFunc = 4;   //< Average direct call sites per function.
+  std::string FanIn = "zipf";  //< Target distribution: uniform or zipf[:S].
+  size_t NumTypes = 64;        //< Indirect call type ids.
+  size_t BucketSize = 8;       //< Indirect targets per type id.
+  double IndirectRatio = 0.2;  //< Functions with an indirect call site.
+  double Recursion = 0.01;     //< Direct calls that are back edges.
+  size_t NumEntries = 2;       //< Allocation functions traces start at.
+  size_t NumTraces = 1000;     //< Stack traces to generate.
+  std::string Depth = "1-16";  //< Depth of the traces: D or MIN-MAX.
+  uint64_t Seed = 1;           //< Seed of the random generator.
+  std::string Out;             //< Output prefix, for .cg and .st files.
+};
+
+// Names of the allocation functions, which st_reconst keeps in the graph.
+const char *EntryNames[] = {"malloc", "free",   "calloc",  "realloc",
+                            "_Znwm",  "_ZdlPv", "_Znam",   "_ZdaPv"};
+const size_t MaxEntries = sizeof(EntryNames) / sizeof(EntryNames[0]);
+
+// Call sites are 4 bytes apart within a function.
+const uint64_t TextBase = 0x400000;
+const uint64_t FuncSize = 0x100;
+const unsigned MaxCallSites = FuncSize / 4 - 1;
+// Target of the hook call sites, outside the functions of the graph.
+const uint64_t HookPc = 0x10;
+
+uint64_t FuncPc(size_t F) { return TextBase + F * FuncSize; }
+
+// A call site and the function containing it.
+struct CallerEdge {
+  uint64_t CallSitePc;
+  uint32_t Caller;
+};
+
+class Generator {
+  const GenOptions &Opts;
+  std::mt19937_64 Rng;
+  double ZipfExponent = 1; //< 0 for the uniform distribution.
+  std::vector<double> TargetCdf; //< Popularity of the targets, by distance.
+
+  // Graph, by function.
+  std::vector<std::vector<std::pair<uint64_t, uint32_t>>> DirectCalls;
+  std::vector<std::vector<std::pair<uint64_t, uint32_t>>> IndirectCalls;
+  std::vector<std::vector<uint32_t>> Buckets; //< Targets per type.
+  std::vector<uint64_t> TypeIds;
+  std::vector<std::vector<CallerEdge>> Callers; //< Reverse edges.
+
+  double Uniform() {
+    return std::uniform_real_distribution<double>(0, 1)(Rng);
+  }
+  size_t UniformInt(size_t Min, size_t Max) {
+    return std::uniform_int_distribution<size_t>(Min, Max)(Rng);
+  }
+
+  uint32_t DrawTarget(size_t F);
+
+public:
+  explicit Generator(const GenOptions &Opts) : Opts(Opts), Rng(Opts.Seed) {}
+
+  bool Init(std::string &Err);
+  void BuildGraph();
+  bool WriteCallGraph(const std::string &Path, std::string &Err) const;
+  bool WriteTraces(const std::string &Path, size_t MinDepth, size_t MaxDepth,
+                   std::string &Err);
+};
+
+bool Generator::Init(std::string &Err) {
+  if (Opts.NumEntries < 1 || Opts.NumEntries > MaxEntries) {
+    Err = "--entries must be between 1 and " + std::to_string(MaxEntries);
+    return false;
+  }
+  if (Opts.NumFuncs < Opts.NumEntries + 2) {
+    Err = "--funcs must leave main and a function besides the entries";
+    return false;
+  }
+  if (Opts.CallsPerFunc < 1) {
+    Err = "--calls must be at least 1";
+    return false;
+  }
+  if (Opts.FanIn == "uniform")
+    ZipfExponent = 0;
+  else if (Opts.FanIn.compare(0, 4, "zipf") == 0 &&
+           (Opts.FanIn.size() == 4 || Opts.FanIn[4] == ':'))
+    ZipfExponent = Opts.FanIn.size() > 5 ? atof(Opts.FanIn.c_str() + 5) : 1;
+  else {
+    Err = "unknown fan-in distribution: " + Opts.FanIn;
+    return false;
+  }
+
+  // The Kth target from the end has the weight 1/K^S.
+  TargetCdf.resize(Opts.NumFuncs);
+  double Sum = 0;
+  for (size_t K = 0; K < Opts.NumFuncs; K++)
+    TargetCdf[K] = Sum += std::pow(K + 1, -ZipfExponent);
+  for (double &C : TargetCdf)
+    C /= Sum;
+  return true;
+}
+
+// Draw the target of a direct call site in F.
+uint32_t Generator::DrawTarget(size_t F) {
+  size_t N = Opts.NumFuncs;
+  if (F > 0 && Uniform() < Opts.Recursion)
+    return UniformInt(1, F);
+  // Only the later functions are targets, so retry the draws of the earlier
+  // ones a few times before falling back to the uniform distribution.
+  for (int Try = 0; Try < 8; Try++) {
+    size_t K = std::lower_bound(TargetCdf.begin(), TargetCdf.end(),
+                                Uniform()) - TargetCdf.begin();
+    size_t T = N - 1 - std::min(K, N - 1);
+    if (T > F)
+      return T;
+  }
+  return UniformInt(F + 1, N - 1);
+}
+
+void Generator::BuildGraph() {
+  size_t N = Opts.NumFuncs;
+  size_t FirstEntry = N - Opts.NumEntries;
+  DirectCalls.assign(N, {});
+  IndirectCalls.assign(N, {});
+  Callers.assign(N, {});
+
+  // Each allocation function calls the hook.
+  for (size_t F = FirstEntry; F < N; F++)
+    DirectCalls[F].push_back({FuncPc(F) + 4, (uint32_t)-1});
+
+  // Spread the indirect targets over the type ids.
+  Buckets.assign(Opts.NumTypes, {});
+  TypeIds.clear();
+  for (size_t T = 0; T < Opts.NumTypes; T++)
+    TypeIds.push_back(Rng() | 1);
+  std::vector<uint32_t> Candidates;
+  for (size_t F = 1; F < FirstEntry; F++)
+    Candidates.push_back(F);
+  std::shuffle(Candidates.begin(), Candidates.end(), Rng);
+  size_t NumTargets = std::min(Candidates.size(),
+                               Opts.NumTypes * Opts.BucketSize);
+  for (size_t I = 0; Opts.NumTypes && I < NumTargets; I++)
+    Buckets[I % Opts.NumTypes].push_back(Candidates[I]);
+
+  for (size_t F = 0; F < FirstEntry; F++) {
+    unsigned NumCalls = std::min<size_t>(
+      UniformInt(1, 2 * Opts.CallsPerFunc - 1), MaxCallSites);
+    uint64_t CallSitePc = FuncPc(F);
+    for (unsigned I = 0; I < NumCalls; I++) {
+      uint32_t Target = DrawTarget(F);
+      CallSitePc += 4;
+      DirectCalls[F].push_back({CallSitePc, Target});
+      Callers[Target].push_back({CallSitePc, (uint32_t)F});
+    }
+    if (Opts.NumTypes && NumCalls < MaxCallSites &&
+        Uniform() < Opts.IndirectRatio) {
+      uint32_t Type = UniformInt(0, Opts.NumTypes - 1);
+      CallSitePc += 4;
+      IndirectCalls[F].push_back({CallSitePc, Type});
+      for (uint32_t Target : Buckets[Type])
+        Callers[Target].push_back({CallSitePc, (uint32_t)F});
+    }
+  }
+}
+
+bool Generator::WriteCallGraph(const std::string &Path,
+                               std::string &Err) const {
+  FILE *Out = fopen(Path.c_str(), "w");
+  if (!Out) {
+    Err = "cannot open " + Path;
+    return false;
+  }
+  size_t N = Opts.NumFuncs;
+
+  fprintf(Out, "INDIRECT TARGET TYPES (TYPEID [FUNC_ADDR,])\n");
+  for (size_t T = 0; T < Buckets.size(); T++) {
+    if (Buckets[T].empty())
+      continue;
+    fprintf(Out, "%llx", (unsigned long long)TypeIds[T]);
+    for (uint32_t F : Buckets[T])
+      fprintf(Out, " %llx", (unsigned long long)FuncPc(F));
+    fprintf(Out, "\n");
+  }
+
+  std::vector<std::vector<uint64_t>> CallSitesOfType(TypeIds.size());
+  for (size_t F = 0; F < N; F++)
+    for (const auto &C : IndirectCalls[F])
+      CallSitesOfType[C.second].push_back(C.first);
+  fprintf(Out, "\nINDIRECT CALL TYPES (TYPEID [CALL_SITE_ADDR,])\n");
+  for (size_t T = 0; T < CallSitesOfType.size(); T++) {
+    if (CallSitesOfType[T].empty())
+      continue;
+    fprintf(Out, "%llx", (unsigned long long)TypeIds[T]);
+    for (uint64_t CallSitePc : CallSitesOfType[T])
+      fprintf(Out, " %llx", (unsigned long long)CallSitePc);
+    fprintf(Out, "\n");
+  }
+
+  fprintf(Out, "\nINDIRECT CALL SITES (CALLER_ADDR [CALL_SITE_ADDR,])\n");
+  for (size_t F = 0; F < N; F++) {
+    if (IndirectCalls[F].empty())
+      continue;
+    fprintf(Out, "%llx", (unsigned long long)FuncPc(F));
+    for (const auto &C : IndirectCalls[F])
+      fprintf(Out, " %llx", (unsigned long long)C.first);
+    fprintf(Out, "\n");
+  }
+
+  fprintf(Out, "\nDIRECT CALL SITES (CALLER_ADDR [(CALL_SITE_ADDR, "
+               "TARGET_ADDR),])\n");
+  for (size_t F = 0; F < N; F++) {
+    if (DirectCalls[F].empty())
+      continue;
+    fprintf(Out, "%llx", (unsigned long long)FuncPc(F));
+    for (const auto &C : DirectCalls[F])
+      fprintf(Out, " %llx %llx", (unsigned long long)C.first,
+              (unsigned long long)(C.second == (uint32_t)-1
+                                     ? HookPc : FuncPc(C.second)));
+    fprintf(Out, "\n");
+  }
+
+  fprintf(Out, "\nFUNCTIONS (FUNC_ENTRY_ADDR, SYM_NAME)\n");
+  size_t FirstEntry = N - Opts.NumEntries;
+  for (size_t F = 0; F < N; F++) {
+    if (F == 0)
+      fprintf(Out, "%llx main\n", (unsigned long long)FuncPc(F));
+    else if (F >= FirstEntry)
+      fprintf(Out, "%llx %s\n", (unsigned long long)FuncPc(F),
+              EntryNames[F - FirstEntry]);
+    else
+      fprintf(Out, "%llx fn_%zu\n", (unsigned long long)FuncPc(F), F);
+  }
+  fprintf(Out, "\n");
+
+  bool Ok = !ferror(Out);
+  Ok &= fclose(Out) == 0;
+  if (!Ok)
+    Err = "cannot write " + Path;
+  return Ok;
+}
+
+bool Generator::WriteTraces(const std::string &Path, size_t MinDepth,
+                            size_t MaxDepth, std::string &Err) {
+  FILE *Out = fopen(Path.c_str(), "w");
+  if (!Out) {
+    Err = "cannot open " + Path;
+    return false;
+  }
+  size_t FirstEntry = Opts.NumFuncs - Opts.NumEntries;
+  std::vector<uint64_t> Frames, Best;
+  for (size_t I = 0; I < Opts.NumTraces; I++) {
+    size_t Entry = UniformInt(FirstEntry, Opts.NumFuncs - 1);
+    size_t Depth = UniformInt(MinDepth, MaxDepth);
+    // A walk may end early at a function without callers, so keep the
+    // longest of a few.
+    Best.clear();
+    for (int Try = 0; Try < 16 && Best.size() < Depth + 1; Try++) {
+      Frames.assign(1, FuncPc(Entry) + 4);
+      size_t F = Entry;
+      while (Frames.size() < Depth + 1 && !Callers[F].empty()) {
+        const CallerEdge &E = Callers[F][UniformInt(0, Callers[F].size() - 1)];
+        Frames.push_back(E.CallSitePc);
+        F = E.Caller;
+      }
+      if (Frames.size() > Best.size())
+        Best.swap(Frames);
+    }
+    fprintf(Out, "ST:");
+    for (uint64_t PC : Best)
+      fprintf(Out, " %llx", (unsigned long long)PC);
+    fprintf(Out, "\n");
+  }
+  bool Ok = !ferror(Out);
+  Ok &= fclose(Out) == 0;
+  if (!Ok)
+    Err = "cannot write " + Path;
+  return Ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  GenOptions Opts;
+  bool BadOptions = false;
+  for (int I = 1; I < argc; I++) {
+    if (!ReadOption(argv[I], "--funcs", Opts.NumFuncs) &&
+        !ReadOption(argv[I], "--calls", Opts.CallsPerFunc) &&
+        !ReadOption(argv[I], "--fan-in", Opts.FanIn) &&
+        !ReadOption(argv[I], "--types", Opts.NumTypes) &&
+        !ReadOption(argv[I], "--bucket-size", Opts.BucketSize) &&
+        !ReadOption(argv[I], "--indirect", Opts.IndirectRatio) &&
+        !ReadOption(argv[I], "--recursion", Opts.Recursion) &&
+        !ReadOption(argv[I], "--entries", Opts.NumEntries) &&
+        !ReadOption(argv[I], "--traces", Opts.NumTraces) &&
+        !ReadOption(argv[I], "--depth", Opts.Depth) &&
+        !ReadOption(argv[I], "--seed", Opts.Seed) &&
+        !ReadOption(argv[I], "--out", Opts.Out)) {
+      std::cerr << "Unknown option: " << argv[I] << std::endl;
+      BadOptions = true;
+    }
+  }
+  size_t MinDepth = 0, MaxDepth = 0;
+  size_t Dash = Opts.Depth.find('-');
+  MinDepth = atoi(Opts.Depth.c_str());
+  MaxDepth = Dash == std::string::npos ? MinDepth
+                                       : atoi(Opts.Depth.c_str() + Dash + 1);
+  if (MinDepth < 1 || MaxDepth < MinDepth) {
+    std::cerr << "Bad depth: " << Opts.Depth << std::endl;
+    BadOptions = true;
+  }
+
+  if (Opts.Out.empty() || BadOptions) {
+    std::cerr << "OVERVIEW: synthetic call graph and stack trace generator"
+              << std::endl;
+    std::cerr << "USAGE: " << argv[0] << " --out=PREFIX [options]\n\n"
+              << "Writes the call graph to PREFIX.cg and the stack traces to "
+                 "PREFIX.st.\n\n";
+    std::cerr << "OPTIONS:\n"
+              << " --funcs=N                  "
+              << "Functions, including main and the entries (default: 10000)\n"
+              << " --calls=N                  "
+              << "Average direct call sites per function (default: 4)\n"
+              << " --fan-in=uniform|zipf[:S]  "
+              << "Distribution of the call targets (default: zipf, S=1)\n"
+              << " --types=N                  "
+              << "Indirect call type ids (default: 64)\n"
+              << " --bucket-size=N            "
+              << "Indirect targets per type id (default: 8)\n"
+              << " --indirect=F               "
+              << "Fraction of functions with an indirect call (default: 0.2)\n"
+              << " --recursion=F              "
+              << "Fraction of direct calls that are back edges (default: 0.01)\n"
+              << " --entries=N                "
+              << "Allocation functions the traces start at (default: 2)\n"
+              << " --traces=N                 "
+              << "Stack traces to generate (default: 1000)\n"
+              << " --depth=D|MIN-MAX          "
+              << "Depth of the stack traces (default: 1-16)\n"
+              << " --seed=N                   "
+              << "Seed of the random generator (default: 1)\n"
+              << std::endl;
+    return -1;
+  }
+
+  Generator Gen(Opts);
+  std::string Err;
+  if (!Gen.Init(Err)) {
+    std::cerr << "ERROR: " << Err << std::endl;
+    return -1;
+  }
+  Gen.BuildGraph();
+  if (!Gen.WriteCallGraph(Opts.Out + ".cg", Err) ||
+      !Gen.WriteTraces(Opts.Out + ".st", MinDepth, MaxDepth, Err)) {
+    std::cerr << "ERROR: " << Err << std::endl;
+    return -1;
+  }
+  return 0;
+}
@@ -1,9 +1,11 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
-#include <fstream>
+#include <cstring>
 #include <iostream>
 #include <map>
+#include <set>
+#include <memory>
 #include <sstream>
 #include <iomanip>
 #include <unordered_map>
@@ -11,213 +13,1521 @@
 #include <vector>
 #include <string>
 #include <chrono>
+#include <mutex>
+#include <random>
+#include <malloc.h>
+#include <unistd.h>
 #include "cg.hpp"
 #include "rcg.hpp"
-
-typedef std::vector<uint64_t> StackTrace;
-
-// Followings are set on program initialization from CLI. They are kept global
-// to avoid passing them as arguments to each recursive call to DFS.
-// Alternatively, a class can be implemented for DFS where these will be kept
-// as instance members.
-size_t MaxDepth = 0;           //< Maximum depth to search for.
-uint64_t PruningDepth1 = 0;    //< Pruning depth 1.
-uint64_t PruningDepth2 = 0;    //< Pruning depth 2.
-uint64_t *ST = nullptr;        //< Stack trace to fill by reconstruction.
-                               //< Allocated based on the maximum depth.
-ReverseCallGraph *RCG = nullptr; //< Reverse call graph.
-
-// Followings are set everytime before calling DFS based on the stack trace
-// to reconstruct.
-std::vector<uint64_t> WantedST; //< Wanted stack trace.
-uint64_t WantedHash = 0;        //< The hash for WantedST.
-uint64_t WantedHashMed1 = 0;    //< Pruning hash 1.
-uint64_t WantedHashMed2 = 0;    //< Pruning hash 2.
-int DoesNotMatchCount = 0;      //< Count how many incorrect reconstructions
-                                //< were made.
+#include "csr.hpp"
+#include "decode_server.hpp"
+#include "snapshot.hpp"
+#include "symtab.hpp"
+#include "scan.hpp"
+#include "mapped_file.hpp"
+#include "memory_usage.hpp"
+#include "module_set.hpp"
+#include "options.hpp"
+#include "trace_stream.hpp"
+#include "trace_store.hpp"
+#include "result_cache.hpp"
+#include "call_site_profile.hpp"
+#include "candidates.hpp"
+#include "stats_writer.hpp"
+#include "pool.hpp"
+#include "pruning_tuner.hpp"
+#include "search.hpp"
+#include "mitm.hpp"
+#include "multi_search.hpp"
+#include "iterative_search.hpp"
 
 // Pretty print a stack trace.
 template<class T>
-void PrettyPrintST(const CallGraph &CG, T it_begin, size_t length) {
-  std::cerr << "Stack Trace (length=" << std::dec << length <<"): " << std::endl;
+void PrettyPrintST(std::ostream &Out, const SymbolTable &Symbols, T it_begin,
+                   size_t length) {
+  Out << "Stack Trace (length=" << std::dec << length <<"): " << std::endl;
 
   for (size_t I = 0; I < length; I++) {
     uint64_t CallSitePc = *it_begin;
-    uint64_t CallerPc = CG.CallSiteToCaller.find(CallSitePc)->second;
-    std::string CallerName = "UNKNOWN_NAME";
-    if (CG.FuncAddrToName.count(CallerPc))
-      CallerName = CG.FuncAddrToName.find(CallerPc)->second;
+    uint64_t CallerPc = 0;
+    Symbols.CallerOf(CallSitePc, CallerPc);
+    std::string_view CallerName = "UNKNOWN_NAME";
+    Symbols.NameOf(CallerPc, CallerName);
     // Print frame.
-    std::cerr << "  " << I << ": [" << std::hex << CallSitePc << "] "
-              << CallerName
-              << "[" << std::hex << CallerPc << "]" << std::endl;
+    Out << "  " << I << ": [" << std::hex << CallSitePc << "] "
+        << CallerName
+        << "[" << std::hex << CallerPc << "]" << std::endl;
     it_begin++;
   }
 }
 
 // Pretty print a stack trace.
-void PrettyPrintST(const CallGraph &CG, std::vector<uint64_t> st) {
-    PrettyPrintST(CG, st.begin(), st.size());
+void PrettyPrintST(std::ostream &Out, const SymbolTable &Symbols,
+                   const StackTrace &st) {
+    PrettyPrintST(Out, Symbols, st.begin(), st.size());
+}
+
+// Print info on the stack trace that is going to be reconstructed.
+void PrintTraceHeader(std::ostream &Out, const SymbolTable &Symbols,
+                      const TraceRecord &STI, uint64_t FuncEntryPc) {
+  Out << "\nFuncName: " << STI.FuncName
+      << "\nFuncEntryPc: " << std::hex << FuncEntryPc
+      << "\nStack trace hash: " << std::hex << STI.Compressed.Hash
+      << "\nStack trace: " << std::endl;
+  PrettyPrintST(Out, Symbols, STI.ST);
+}
+
+// Print after reconstruction logs. The time is left out without Elapsed,
+// e.g., for a stack trace searched along with others.
+void PrintTraceResult(
+    std::ostream &Out, const ResultCache::Result &R,
+    const std::chrono::high_resolution_clock::duration *Elapsed) {
+  if (R.Found) {
+    Out << "SUCCESS: Matches!\n";
+    Out << "Found " << std::dec << R.DoesNotMatchCount
+        << " incorrect reconstructions due to collisions" << std::endl;
+  }
+  if (Elapsed)
+    Out << "Time elapsed (sec): " << std::dec
+        << std::chrono::duration<double>(*Elapsed).count() << std::endl;
+
+  if (R.BudgetExhausted)
+    Out << "\nBUDGET EXHAUSTED: Gave up on the stack trace.\n";
+  else if (!R.Found)
+    Out << "\nFAIL: Could not reconstruct the stack trace.\n";
+  Out << "\n=========================================\n" << std::endl;
+}
+
+void PrintTraceResult(std::ostream &Out, const ResultCache::Result &R,
+                      std::chrono::high_resolution_clock::duration Elapsed) {
+  PrintTraceResult(Out, R, &Elapsed);
+}
+
+// Fill the record of a stack trace with its result.
+void FillStatsRecord(TraceStatsRecord &Rec, const TraceRecord &STI,
+                     uint64_t FuncEntryPc, const ResultCache::Result &R,
+                     std::chrono::high_resolution_clock::duration Elapsed) {
+  Rec.Index = STI.Index;
+  Rec.FuncName = STI.FuncName;
+  Rec.EntryPc = FuncEntryPc;
+  Rec.Depth = STI.ST.size();
+  Rec.Found = R.Found;
+  Rec.BudgetExhausted = R.BudgetExhausted;
+  Rec.FalseMatches = R.DoesNotMatchCount;
+  Rec.Nanoseconds =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(Elapsed).count();
+}
+
+// Per worker state of the --stats output.
+struct WorkerStats {
+  const StatsWriter *Writer = nullptr;
+  size_t MaxDepth = 0;
+  SearchStats Search;                 //< Counters of the current search.
+  bool WantPerf = false;              //< Read the perf counters, if they can
+                                      //< be opened.
+  std::unique_ptr<PerfCounters> Perf; //< Opened by the worker on first use.
+  std::string Line;                   //< Record of the last stack trace.
+  bool Retry = false;                 //< In the retry pass of the budgets.
+
+  // Start the perf counters of the calling thread, if wanted and available.
+  PerfCounters *StartPerf() {
+    if (!WantPerf)
+      return nullptr;
+    if (!Perf) {
+      Perf.reset(new PerfCounters());
+      std::string Err;
+      if (!Perf->Open(Err)) {
+        static std::once_flag Warned;
+        std::call_once(Warned, [&]() {
+          std::cerr << "WARNING: Not reading the perf counters: " << Err
+                    << std::endl;
+        });
+        Perf.reset();
+        WantPerf = false;
+        return nullptr;
+      }
+    }
+    Perf->Start();
+    return Perf.get();
+  }
+};
+
+// Let the searcher count its search in Stats, if it supports counting.
+template<class SearcherT>
+auto SetSearchStats(SearcherT &Ctx, SearchStats *Stats, int)
+  -> decltype(Ctx.Stats = Stats, bool()) {
+  Ctx.Stats = Stats;
+  return true;
+}
+template<class SearcherT>
+bool SetSearchStats(SearcherT &, SearchStats *, long) {
+  return false;
+}
+
+// Reconstruct one stack trace using the searcher (SearchContext or
+// ParallelSearch), and write the logs for it to Out. The result is taken
+// from the cache if given and the stack trace is seen before. If WS is given,
+// the search is also measured and its record is left in WS->Line. Returns
+// the result of the stack trace.
+template<class SearcherT>
+ResultCache::Result ReconstructOne(std::ostream &Out, const SymbolTable &Symbols,
+                    SearcherT &Ctx, ResultCache *Cache,
+                    const TraceRecord &STI, WorkerStats *WS = nullptr) {
+  const StackTrace &WantedST = STI.ST;
+  uint64_t FuncEntryPc = STI.EntryPc;
+  PrintTraceHeader(Out, Symbols, STI, FuncEntryPc);
+
+  bool Counted = WS && SetSearchStats(Ctx, &WS->Search, 0);
+  if (Counted)
+    WS->Search.Reset(WS->MaxDepth);
+  PerfCounters *Perf = WS ? WS->StartPerf() : nullptr;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  // Start reconstruction.
+  ResultCache::Result R;
+  bool Cached = Cache && Cache->Lookup(FuncEntryPc, STI.Compressed, WantedST, R);
+  if (!Cached) {
+    R.Found = Ctx.Reconstruct(FuncEntryPc, STI.Compressed, WantedST);
+    R.DoesNotMatchCount = Ctx.DoesNotMatchCount;
+    R.BudgetExhausted = Ctx.BudgetExhausted;
+    if (Cache)
+      Cache->Insert(FuncEntryPc, STI.Compressed, WantedST, R);
+  }
+  auto stop = std::chrono::high_resolution_clock::now();
+  PrintTraceResult(Out, R, stop - start);
+
+  if (WS) {
+    PerfCounters::Sample Sample;
+    if (Perf)
+      Sample = Perf->Stop();
+    TraceStatsRecord Rec;
+    FillStatsRecord(Rec, STI, FuncEntryPc, R, stop - start);
+    Rec.Cached = Cached;
+    Rec.Retry = WS->Retry;
+    Rec.Search = Counted && !Cached ? &WS->Search : nullptr;
+    Rec.Perf = Perf ? &Sample : nullptr;
+    WS->Line = WS->Writer->FormatRecord(Rec);
+  }
+  return R;
 }
 
-// Check whether two stack traces are the same.
-template<class T1, class T2>
-bool AreSTSame(T1 it1_begin, size_t size1, T2 it2_begin, size_t size2) {
-  if (size1 != size2)
+// Reconstruct a batch of stack traces with one traversal per entry function.
+// The stack traces are grouped by the entry function, and the groups are
+// searched in parallel, one group per worker at a time. The logs are printed
+// in the input order once the whole batch is done, and the time of a stack
+// trace is the time of its group.
+template<class SearcherT>
+void ReconstructGrouped(
+    WorkStealingPool &Pool,
+    std::vector<std::unique_ptr<SearcherT>> &Searchers,
+    ResultCache *Cache, StatsWriter *Writer, CallSiteProfile *Profile,
+    const SymbolTable &Symbols, const TraceBatch &STS, size_t &NumFound,
+    double &MaxTraceSeconds) {
+  typedef typename SearcherT::Query Query;
+  std::vector<uint64_t> EntryPcs(STS.size(), 0);
+  std::vector<ResultCache::Result> Results(STS.size());
+  std::vector<bool> Cached(STS.size(), false);
+  std::vector<std::chrono::high_resolution_clock::duration> Elapsed(
+    STS.size(), std::chrono::high_resolution_clock::duration::zero());
+
+  // Group the stack traces that are not cached by the entry function.
+  std::unordered_map<uint64_t, size_t> GroupOfPc;
+  std::vector<std::vector<size_t>> Groups;
+  for (size_t I = 0; I < STS.size(); I++) {
+    EntryPcs[I] = STS[I].EntryPc;
+    if (Cache && Cache->Lookup(EntryPcs[I], STS[I].Compressed, STS[I].ST,
+                               Results[I])) {
+      Cached[I] = true;
+      continue;
+    }
+    auto It = GroupOfPc.emplace(EntryPcs[I], Groups.size()).first;
+    if (It->second == Groups.size())
+      Groups.emplace_back();
+    Groups[It->second].push_back(I);
+  }
+
+  Pool.ParallelFor(Groups.size(), [&](unsigned WorkerId, size_t G) {
+    const std::vector<size_t> &Group = Groups[G];
+    std::vector<Query> Queries;
+    for (size_t I : Group)
+      Queries.push_back({&STS[I].Compressed, &STS[I].ST, false, 0});
+
+    auto GroupStart = std::chrono::high_resolution_clock::now();
+    Searchers[WorkerId]->Reconstruct(EntryPcs[Group[0]], Queries);
+    auto GroupStop = std::chrono::high_resolution_clock::now();
+
+    for (size_t Q = 0; Q < Group.size(); Q++) {
+      Results[Group[Q]] = {Queries[Q].Found, Queries[Q].DoesNotMatchCount};
+      Elapsed[Group[Q]] = GroupStop - GroupStart;
+    }
+  });
+
+  for (size_t I = 0; I < STS.size(); I++) {
+    if (Cache && !Cached[I])
+      Cache->Insert(EntryPcs[I], STS[I].Compressed, STS[I].ST, Results[I]);
+    PrintTraceHeader(std::cerr, Symbols, STS[I], EntryPcs[I]);
+    PrintTraceResult(std::cerr, Results[I], Elapsed[I]);
+    if (Writer) {
+      TraceStatsRecord Rec;
+      FillStatsRecord(Rec, STS[I], EntryPcs[I], Results[I], Elapsed[I]);
+      Rec.Cached = Cached[I];
+      Writer->Write(Writer->FormatRecord(Rec));
+    }
+    NumFound += Results[I].Found;
+    if (Profile && Results[I].Found)
+      Profile->Record(EntryPcs[I], STS[I].ST, Symbols);
+    MaxTraceSeconds = std::max(MaxTraceSeconds,
+      std::chrono::duration<double>(Elapsed[I]).count());
+  }
+}
+
+// Reconstruct the stack traces in parallel, one stack trace per worker at a
+// time. Searchers, and the state of the stats output if any, are indexed by
+// the worker id. Logs and records are buffered per stack trace, and printed
+// in the input order as soon as all preceding stack traces are done. The
+// stack traces whose search ran out of its budget are appended to Exhausted
+// in the same order. The reconstructed ones are recorded in Profile if given.
+template<class SearcherT>
+void ReconstructAll(WorkStealingPool &Pool,
+                    std::vector<std::unique_ptr<SearcherT>> &Searchers,
+                    ResultCache *Cache, StatsWriter *Writer,
+                    CallSiteProfile *Profile,
+                    std::vector<WorkerStats> &Workers,
+                    const SymbolTable &Symbols, const TraceBatch &STS,
+                    size_t &NumFound, double &MaxTraceSeconds,
+                    TraceBatch &Exhausted) {
+  std::vector<std::string> Logs(STS.size());
+  std::vector<std::string> Records(Writer ? STS.size() : 0);
+  std::vector<bool> Done(STS.size(), false);
+  std::vector<bool> OutOfBudget(STS.size(), false);
+  size_t NextToPrint = 0;
+  std::mutex PrintLock;
+
+  Pool.ParallelFor(STS.size(), [&](unsigned WorkerId, size_t I) {
+    std::ostringstream Log;
+    WorkerStats *WS = Writer ? &Workers[WorkerId] : nullptr;
+    auto TraceStart = std::chrono::high_resolution_clock::now();
+    ResultCache::Result R = ReconstructOne(Log, Symbols, *Searchers[WorkerId],
+                                           Cache, STS[I], WS);
+    auto TraceStop = std::chrono::high_resolution_clock::now();
+
+    std::lock_guard<std::mutex> Guard(PrintLock);
+    NumFound += R.Found;
+    OutOfBudget[I] = R.BudgetExhausted;
+    if (Profile && R.Found) {
+      Profile->Record(STS[I].EntryPc, STS[I].ST, Symbols);
+    }
+    MaxTraceSeconds = std::max(MaxTraceSeconds,
+      std::chrono::duration<double>(TraceStop - TraceStart).count());
+    Logs[I] = Log.str();
+    if (WS)
+      Records[I].swap(WS->Line);
+    Done[I] = true;
+    for (; NextToPrint < STS.size() && Done[NextToPrint]; NextToPrint++) {
+      std::cerr << Logs[NextToPrint];
+      std::string().swap(Logs[NextToPrint]);
+      if (Writer) {
+        Writer->Write(Records[NextToPrint]);
+        std::string().swap(Records[NextToPrint]);
+      }
+      if (OutOfBudget[NextToPrint])
+        Exhausted.push_back(STS[NextToPrint]);
+    }
+  });
+}
+
+// Optional arguments following the positional ones.
+struct Options {
+  unsigned NumThreads = 1;     //< Threads reconstructing in parallel.
+  int SplitDepth = -1;         //< If set, parallelize within each trace.
+  int MitmDepth = -1;          //< If set, search from both ends meeting here.
+  std::string Layout = "csr";  //< Reverse call graph layout.
+  std::string Order = "pc";    //< Function numbering of the CSR layout.
+  std::string SaveSnapshot;    //< If set, save the graph snapshot here.
+  bool Recursive = false;      //< Do not use the specialized search.
+  bool Grouped = false;        //< Search per entry function, not per trace.
+  bool HashOnly = false;       //< Compress the stack traces to the hash only.
+  bool UseCache = false;       //< Cache the reconstruction results.
+  std::string CacheFile;       //< If set, load and save the cache here.
+  bool ParseOnly = false;      //< Only time the parsers of the input files.
+  std::string HashName;        //< If set, the hash policy to compress with.
+  bool HashBench = false;      //< Compare the hash policies on the traces.
+  std::string StatsFile;       //< If set, write a record per trace here.
+  std::string StatsFormat = "jsonl"; //< Format of the records.
+  bool Perf = false;           //< Add the perf counters to the records.
+  SearchBudget Budget;         //< Limits of the search of each trace.
+  double RetryFactor = 0;      //< If set, search the traces out of budget
+                               //< again with a budget this many times larger.
+  std::string ProfileFile;     //< If set, order the callers by the profile
+                               //< here, and add the reconstructed traces.
+  std::string StoreFile;       //< If set, add the compressed traces to the
+                               //< store here instead of reconstructing.
+  bool LowMemory = false;      //< Build the graphs keeping only what they
+                               //< are built from, and free it after.
+  bool MemReport = false;      //< Report the memory per structure and phase.
+  unsigned BuildThreads = 1;   //< Threads building the graphs.
+  bool BuildTimings = false;   //< Print the time of each phase of the builds.
+  std::string ModuleCache;     //< If set, cache the graph of each module here.
+  bool Serve = false;          //< Keep the graph resident and serve decode
+                               //< requests on stack_traces_file.
+  size_t Candidates = 0;       //< If set, decode each record into up to this
+                               //< many candidates instead of the first match.
+  bool TunePruning = false;    //< Only report the best pruning depths.
+  bool AutoPruning = false;    //< Reconstruct with the best pruning depths.
+  size_t TuneSample = 200;     //< Stack traces replayed to tune.
+};
+
+// Print the time of each phase of a build, with --build-timings.
+static void ReportBuildPhases(const Options &Opts, const char *What,
+                              const BuildPhases &Phases) {
+  if (!Opts.BuildTimings)
+    return;
+  for (const auto &El : Phases.Seconds)
+    std::cerr << "  " << What << ", " << El.first << ": " << El.second
+              << " sec." << std::endl;
+}
+
+// Print the memory of the process after a phase, with --mem-report.
+static void ReportProcessMemory(const Options &Opts, const char *Phase) {
+  if (!Opts.MemReport)
+    return;
+  ProcessMemory M;
+  if (!M.Read()) {
+    std::cerr << "WARNING: Cannot read the memory of the process."
+              << std::endl;
+    return;
+  }
+  std::cerr << "Memory after " << Phase << ": " << std::dec
+            << M.RssBytes / (1 << 20) << " MiB resident, "
+            << M.PeakRssBytes / (1 << 20) << " MiB peak." << std::endl;
+}
+
+// Reconstruct all stack traces of the stream on the given reverse call graph
+// layout, batch by batch as they are read, and print the statistics. HashT is
+// the hash policy of the parameters. If Profile is given, the reconstructed
+// stack traces are added to it, and it is saved to Opts.ProfileFile.
+template<class GraphT, class HashT>
+bool RunReconstructions(const GraphT &RevCG, const SymbolTable &Symbols,
+                        const SearchParams &Params, const Options &Opts,
+                        TraceStream &Traces, CallSiteProfile *Profile) {
+  WorkStealingPool Pool(Opts.NumThreads);
+  size_t NumFound = 0;
+  double MaxTraceSeconds = 0; //< Latency of the slowest stack trace.
+
+  // Searchers of the chosen mode, created once and reused by all batches.
+  std::unique_ptr<CalleeIndex<GraphT>> Callees;
+  std::vector<std::unique_ptr<MeetInTheMiddleSearch<GraphT, HashT>>>
+    MitmSearchers;
+  std::unique_ptr<ParallelSearch<GraphT, HashT>> Splitter;
+  std::vector<std::unique_ptr<MultiQuerySearch<GraphT, HashT>>>
+    GroupSearchers;
+  std::vector<std::unique_ptr<SpecializedSearch<GraphT>>> Specialized;
+  std::vector<std::unique_ptr<SearchContext<GraphT, HashT>>> Contexts;
+  if (Opts.MitmDepth >= 0) {
+    // The callee index is shared by the searches of all workers.
+    Callees.reset(new CalleeIndex<GraphT>(RevCG));
+    for (unsigned W = 0; W < Pool.NumThreads(); W++)
+      MitmSearchers.emplace_back(new MeetInTheMiddleSearch<GraphT, HashT>(
+        RevCG, *Callees, Params, Opts.MitmDepth));
+  } else if (Opts.SplitDepth >= 0) {
+    // Stack traces are reconstructed one by one, and the pool runs the
+    // subtrees of each search.
+    Splitter.reset(new ParallelSearch<GraphT, HashT>(RevCG, Params, Pool,
+                                                     Opts.SplitDepth));
+  } else if (Opts.Grouped) {
+    // Each worker searches all stack traces of an entry function at once.
+    for (unsigned W = 0; W < Pool.NumThreads(); W++)
+      GroupSearchers.emplace_back(
+        new MultiQuerySearch<GraphT, HashT>(RevCG, Params));
+  } else if (!Opts.Recursive &&
+             MakeSpecializedSearch<GraphT, HashT>(RevCG, Params)
+               ->IsSpecialized()) {
+    // The non-recursive search compiled for the parameters.
+    std::cerr << "Using the search specialized for the depths." << std::endl;
+    for (unsigned W = 0; W < Pool.NumThreads(); W++)
+      Specialized.push_back(MakeSpecializedSearch<GraphT, HashT>(RevCG,
+                                                                 Params));
+  } else {
+    // Each worker owns a search context, and all of them share the read-only
+    // reverse call graph.
+    for (unsigned W = 0; W < Pool.NumThreads(); W++)
+      Contexts.emplace_back(new SearchContext<GraphT, HashT>(RevCG, Params));
+  }
+
+  // Results of the stack traces seen before, possibly in the earlier runs.
+  std::unique_ptr<ResultCache> Cache;
+  if (Opts.UseCache) {
+    Cache.reset(new ResultCache(Params, GraphFingerprint(RevCG)));
+    std::string Err;
+    if (!Opts.CacheFile.empty() && access(Opts.CacheFile.c_str(), F_OK) == 0) {
+      if (Cache->Load(Opts.CacheFile, Err))
+        std::cerr << "Loaded " << Cache->size() << " cached results from "
+                  << Opts.CacheFile << std::endl;
+      else
+        std::cerr << "WARNING: Ignoring the result cache: " << Err
+                  << std::endl;
+    }
+  }
+
+  // A record per stack trace, if asked for.
+  std::unique_ptr<StatsWriter> Writer;
+  std::vector<WorkerStats> Workers(Pool.NumThreads());
+  if (!Opts.StatsFile.empty()) {
+    StatsWriter::Format Format;
+    StatsWriter::ParseFormat(Opts.StatsFormat, Format);
+    Writer.reset(new StatsWriter());
+    std::string Err;
+    if (!Writer->Open(Opts.StatsFile, Format, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
       return false;
+    }
+    for (auto &WS : Workers) {
+      WS.Writer = Writer.get();
+      WS.MaxDepth = Params.MaxDepth;
+      WS.WantPerf = Opts.Perf;
+    }
+  }
 
-  for (int I = 0; I < size1; I++) {
-    if (*it1_begin != *it2_begin)
+  // Search budgets of the searchers of the chosen mode.
+  auto SetBudget = [&](const SearchBudget &B) {
+    for (auto &S : MitmSearchers)
+      S->Budget = B;
+    if (Splitter)
+      Splitter->Budget = B;
+    for (auto &S : Specialized)
+      S->Budget = B;
+    for (auto &S : Contexts)
+      S->Budget = B;
+  };
+  SetBudget(Opts.Budget);
+
+  // Reconstruct a batch in the chosen mode, and collect the stack traces out
+  // of budget in the input order.
+  auto ReconstructBatch = [&](const TraceBatch &STS, TraceBatch &Exhausted) {
+    if (Splitter) {
+      // The perf counters only count the calling thread.
+      WorkerStats *WS = Writer ? &Workers[0] : nullptr;
+      for (const auto &STI : STS) {
+        auto TraceStart = std::chrono::high_resolution_clock::now();
+        ResultCache::Result R = ReconstructOne(std::cerr, Symbols, *Splitter,
+                                               Cache.get(), STI, WS);
+        auto TraceStop = std::chrono::high_resolution_clock::now();
+        NumFound += R.Found;
+        if (Profile && R.Found) {
+          Profile->Record(STI.EntryPc, STI.ST, Symbols);
+        }
+        MaxTraceSeconds = std::max(MaxTraceSeconds,
+          std::chrono::duration<double>(TraceStop - TraceStart).count());
+        if (WS)
+          Writer->Write(WS->Line);
+        if (R.BudgetExhausted)
+          Exhausted.push_back(STI);
+      }
+    } else if (Callees) {
+      ReconstructAll(Pool, MitmSearchers, Cache.get(), Writer.get(), Profile,
+                     Workers, Symbols, STS, NumFound, MaxTraceSeconds,
+                     Exhausted);
+    } else if (!GroupSearchers.empty()) {
+      // Budgets are per stack trace, hence not given with --group.
+      ReconstructGrouped(Pool, GroupSearchers, Cache.get(), Writer.get(),
+                         Profile, Symbols, STS, NumFound, MaxTraceSeconds);
+    } else if (!Specialized.empty()) {
+      ReconstructAll(Pool, Specialized, Cache.get(), Writer.get(), Profile,
+                     Workers, Symbols, STS, NumFound, MaxTraceSeconds,
+                     Exhausted);
+    } else {
+      ReconstructAll(Pool, Contexts, Cache.get(), Writer.get(), Profile,
+                     Workers, Symbols, STS, NumFound, MaxTraceSeconds,
+                     Exhausted);
+    }
+  };
+
+  std::cerr << "Starting the reconstructions." << std::endl;
+  auto start = std::chrono::high_resolution_clock::now();
+  TraceBatch STS, Exhausted;
+  while (Traces.Next(STS))
+    ReconstructBatch(STS, Exhausted);
+  size_t NumExhausted = Exhausted.size();
+
+  // Search the stack traces out of budget again once the cheap ones are done,
+  // with a larger budget.
+  if (Opts.RetryFactor > 0 && !Exhausted.empty()) {
+    SearchBudget Retry = Opts.Budget;
+    Retry.MaxNodes = (uint64_t)(Retry.MaxNodes * Opts.RetryFactor);
+    Retry.MaxSeconds *= Opts.RetryFactor;
+    std::cerr << "Retrying " << std::dec << Exhausted.size()
+              << " stack traces out of budget with a budget "
+              << Opts.RetryFactor << " times larger." << std::endl;
+    SetBudget(Retry);
+    for (auto &WS : Workers)
+      WS.Retry = true;
+    STS.swap(Exhausted);
+    Exhausted.clear();
+    ReconstructBatch(STS, Exhausted);
+  }
+  auto stop = std::chrono::high_resolution_clock::now();
+  if (!Traces.Error().empty()) {
+    std::cerr << "ERROR: " << Traces.Error() << std::endl;
+    return false;
+  }
+  Traces.Stats().PrintWarnings();
+
+  // The time includes reading the stack traces, which overlaps with the
+  // reconstructions.
+  size_t NumTraces = Traces.Stats().NumTraces;
+  double Seconds = std::chrono::duration<double>(stop - start).count();
+  std::cerr << "Reconstructed " << std::dec << NumFound << "/" << NumTraces
+            << " stack traces in " << Seconds << " sec ("
+            << (Seconds > 0 ? NumTraces / Seconds : 0) << " traces/sec, "
+            << Pool.NumThreads() << " threads)." << std::endl;
+  std::cerr << "Slowest stack trace took " << MaxTraceSeconds << " sec."
+            << std::endl;
+  if (Opts.Budget.IsLimited()) {
+    std::cerr << "Budget exhausted on " << NumExhausted << " stack traces";
+    if (Opts.RetryFactor > 0)
+      std::cerr << ", " << Exhausted.size() << " after the retry";
+    std::cerr << "." << std::endl;
+  }
+
+  if (Cache) {
+    std::cerr << "Result cache: " << Cache->NumHits() << " hits, "
+              << Cache->NumMisses() << " misses, " << Cache->size()
+              << " entries." << std::endl;
+    std::string Err;
+    if (!Opts.CacheFile.empty() && !Cache->Save(Opts.CacheFile, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
       return false;
-    it1_begin++;
-    it2_begin++;
+    }
+  }
+  std::string Err;
+  if (Writer && !Writer->Close(Err)) {
+    std::cerr << "ERROR: " << Err << std::endl;
+    return false;
+  }
+  if (Profile) {
+    if (!Profile->Save(Opts.ProfileFile, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return false;
+    }
+    std::cerr << "Saved the profile of " << Profile->size()
+              << " call sites to " << Opts.ProfileFile << std::endl;
   }
+  ReportProcessMemory(Opts, "the reconstructions");
   return true;
 }
 
-uint64_t HashStep(uint64_t Hash, uint64_t PC, size_t Idx) {
-  uint64_t CRC32 = __builtin_ia32_crc32di(Hash, PC);
-  if (Idx == PruningDepth1) {
-    return CRC32 | (Hash << (48));
-  } else if (Idx == PruningDepth2) {
-    return CRC32 | ((Hash >> 48) << 48) | ((Hash & 0xFFFFll) << 32);
-  } else {
-    return CRC32 | ((Hash >> 32) << 32);
-  }
-}
-
-uint64_t Hash(const StackTrace &ST) {
-  uint64_t Res = 0;
-  for (size_t I = 0; I < ST.size(); I++)
-    Res = HashStep(Res, ST[I], I);
-  return Res;
-}
-
-// Reads the stack traces from input stream, and returns a vector of stack
-// traces together with the name of the entry function and the hash of the
-// stack trace. The first frame from the list is eliminated and used as the
-// entry point.
-std::vector<std::tuple<std::string/*FuncName*/, uint64_t/*Hash*/, StackTrace>>
-ReadStackTracesFromASanOut(std::istream &In, const CallGraph &CG, 
-                           size_t DepthLimit) {
-  std::vector<std::tuple<std::string, uint64_t, StackTrace>> Res;
-  std::string X;
-  int CountStackTracesClipped = 0;
-  int CountHashCollisions = 0;
-  int CSCouldntFind = 0;
-  std::unordered_set<uint64_t> HashesFound;
-  while (std::getline(In, X)) {
-    std::stringstream Line(X);
-    std::string FirstWord;
-    Line >> FirstWord;
-    if (FirstWord != std::string("ST:")) continue;
-    std::string FuncName;
-    StackTrace ST;
-    int CurrentDepth = 0;
-    while (true) {
-      uint64_t PC;
-      Line >> std::hex >> PC;
-
-      if (!CG.CallSiteToCaller.count(PC)) {
-        CSCouldntFind++;
-        break;
+// Compare the hash policies on the same stack traces: for each policy, the
+// stack traces are compressed with it and searched without printing the
+// logs. Reports the search throughput, the false matches rejected by the
+// check of the candidates, and the collisions of the compressed forms among
+// the distinct stack traces of an entry function.
+template<class GraphT>
+bool RunHashBenchmark(const GraphT &RevCG, const SearchParams &Params,
+                      const Options &Opts, TraceStream &Traces) {
+  std::vector<TraceRecord> Records;
+  TraceBatch STS;
+  while (Traces.Next(STS))
+    Records.insert(Records.end(), STS.begin(), STS.end());
+  if (!Traces.Error().empty()) {
+    std::cerr << "ERROR: " << Traces.Error() << std::endl;
+    return false;
+  }
+  Traces.Stats().PrintWarnings();
+  std::vector<uint64_t> EntryPcs(Records.size(), 0);
+  for (size_t I = 0; I < Records.size(); I++)
+    EntryPcs[I] = Records[I].EntryPc;
+
+  // The distinct stack traces, as indices of their first record.
+  std::map<std::pair<uint64_t, StackTrace>, size_t> Distinct;
+  for (size_t I = 0; I < Records.size(); I++)
+    Distinct.emplace(std::make_pair(EntryPcs[I], Records[I].ST), I);
+
+  WorkStealingPool Pool(Opts.NumThreads);
+  std::cerr << "Comparing the hash policies on " << std::dec << Records.size()
+            << " stack traces (" << Distinct.size() << " distinct)."
+            << std::endl;
+  for (HashKind Kind : {HashKind::Crc32Hw, HashKind::Crc32Sw,
+                        HashKind::MulXorShift}) {
+#ifndef __SSE4_2__
+    if (Kind == HashKind::Crc32Hw)
+      continue;
+#endif
+    SearchParams P = Params;
+    P.Kind = Kind;
+    for (auto &R : Records) {
+      if (Opts.HashOnly) {
+        R.Compressed = CompressedTrace();
+        R.Compressed.Hash = Hash(R.ST, P);
+      } else {
+        R.Compressed = Compress(R.ST, P);
+      }
+    }
+
+    std::set<std::pair<uint64_t, uint64_t>> Hashes;
+    for (const auto &El : Distinct)
+      Hashes.emplace(El.first.first, Records[El.second].Compressed.Hash);
+    size_t NumCollisions = Distinct.size() - Hashes.size();
+
+    size_t NumFound = 0, NumFalseMatches = 0;
+    std::mutex Lock;
+    auto Start = std::chrono::high_resolution_clock::now();
+    WithHashPolicy(Kind, [&](auto Policy) {
+      typedef decltype(Policy) HashT;
+      std::vector<std::unique_ptr<SpecializedSearch<GraphT>>> Searchers;
+      std::vector<std::unique_ptr<SearchContext<GraphT, HashT>>> Contexts;
+      for (unsigned W = 0; W < Pool.NumThreads(); W++) {
+        if (Opts.Recursive)
+          Contexts.emplace_back(new SearchContext<GraphT, HashT>(RevCG, P));
+        else
+          Searchers.push_back(MakeSpecializedSearch<GraphT, HashT>(RevCG, P));
       }
-      
-      // Get the entry point
-      if (CurrentDepth == 0) {
-        CurrentDepth++;
-        if (!CG.CallSiteToCaller.count(PC)) {
-          fprintf(stderr, "WARNING: Failed to find caller for the call site at %p.\n",
-                          (void*)PC);
-          break;
+      Pool.ParallelFor(Records.size(), [&](unsigned WorkerId, size_t I) {
+        bool Found;
+        int DoesNotMatchCount;
+        if (Opts.Recursive) {
+          auto &Ctx = *Contexts[WorkerId];
+          Found = Ctx.Reconstruct(EntryPcs[I], Records[I].Compressed,
+                                  Records[I].ST);
+          DoesNotMatchCount = Ctx.DoesNotMatchCount;
         } else {
-          auto Caller = CG.CallSiteToCaller.find(PC)->second;
-          if (!CG.FuncAddrToName.count(Caller)) {
-            fprintf(stderr, "WARNING: Failed to find func name for caller at %p.\n",
-                            (void*)Caller);
-            break;
-          }
-          FuncName = CG.FuncAddrToName.find(Caller)->second;
+          auto &Ctx = *Searchers[WorkerId];
+          Found = Ctx.Reconstruct(EntryPcs[I], Records[I].Compressed,
+                                  Records[I].ST);
+          DoesNotMatchCount = Ctx.DoesNotMatchCount;
         }
+        std::lock_guard<std::mutex> Guard(Lock);
+        NumFound += Found;
+        NumFalseMatches += DoesNotMatchCount;
+      });
+    });
+    double Seconds = std::chrono::duration<double>(
+      std::chrono::high_resolution_clock::now() - Start).count();
+    std::cerr << std::left << std::setw(9) << HashKindName(Kind) << std::right
+              << ": found " << NumFound << "/" << Records.size() << " in "
+              << Seconds << " sec ("
+              << (Seconds > 0 ? Records.size() / Seconds : 0)
+              << " traces/sec), " << NumFalseMatches << " false matches ("
+              << (double)NumFalseMatches / std::max<size_t>(Records.size(), 1)
+              << " per trace), " << NumCollisions << " collisions."
+              << std::endl;
+  }
+  return true;
+}
+
+// Same as RunReconstructions above, with the hash policy of the parameters.
+template<class GraphT>
+bool RunReconstructions(const GraphT &RevCG, const SymbolTable &Symbols,
+                        const SearchParams &Params, const Options &Opts,
+                        TraceStream &Traces, CallSiteProfile *Profile) {
+  if (Opts.HashBench)
+    return RunHashBenchmark(RevCG, Params, Opts, Traces);
+  return WithHashPolicy(Params.Kind, [&](auto Policy) {
+    return RunReconstructions<GraphT, decltype(Policy)>(RevCG, Symbols, Params,
+                                                        Opts, Traces, Profile);
+  });
+}
+
+// Add the compressed stack traces of the stream to the store at
+// Opts.StoreFile, merged into it if it exists, instead of reconstructing
+// them.
+bool AddToStore(const SearchParams &Params, const Options &Opts,
+                TraceStream &Traces) {
+  TraceStoreBuilder Builder(Params);
+  std::string Err;
+  if (access(Opts.StoreFile.c_str(), F_OK) == 0) {
+    TraceStore Old;
+    if (!Old.Load(Opts.StoreFile, Err) || !Builder.Add(Old, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return false;
+    }
+  }
+  size_t NumOld = Builder.size(), NumStored = 0;
+  TraceBatch STS;
+  while (Traces.Next(STS)) {
+    for (const auto &STI : STS) {
+      Builder.Add(STI.EntryPc, STI.Compressed);
+    }
+    NumStored += STS.size();
+  }
+  if (!Traces.Error().empty()) {
+    std::cerr << "ERROR: " << Traces.Error() << std::endl;
+    return false;
+  }
+  Traces.Stats().PrintWarnings();
+  if (!Builder.Write(Opts.StoreFile, Err)) {
+    std::cerr << "ERROR: " << Err << std::endl;
+    return false;
+  }
+  std::cerr << "Stored " << std::dec << NumStored << " stack traces ("
+            << Traces.Stats().NumBytes << " bytes) to " << Opts.StoreFile
+            << ": " << Builder.size() - NumOld << " new, " << Builder.size()
+            << " distinct in total." << std::endl;
+  return true;
+}
+
+// Reconstruct the distinct stack traces of a store. There is no wanted stack
+// trace to compare to, and the first candidate matching the compressed form
+// of a record is taken as its stack trace. With --candidates, all of them are
+// enumerated instead, up to the limit, and printed from the most likely,
+// ranked by the profile if given. The records of an entry function are
+// searched together, in chunks so that the buckets of a chunk still prune and
+// the entry functions with many records are spread among the workers. Logs
+// are printed in the order of the store.
+template<class GraphT, class HashT>
+bool DecodeStore(const GraphT &RevCG, const SymbolTable &Symbols,
+                 const SearchParams &Params, const Options &Opts,
+                 const TraceStore &Store) {
+  static const size_t QueriesPerSearch = 256;
+
+  // The profile only ranks the candidates, and is not added to.
+  CallSiteProfile Profile;
+  const CallSiteProfile *Ranking = nullptr;
+  if (Opts.Candidates && !Opts.ProfileFile.empty()) {
+    std::string Err;
+    if (!Profile.Load(Opts.ProfileFile, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return false;
+    }
+    std::cerr << "Ranking the candidates by the " << Profile.size()
+              << " call sites of " << Opts.ProfileFile << std::endl;
+    Ranking = &Profile;
+  }
+
+  // A chunk of the records of an entry function.
+  struct Task {
+    uint64_t EntryPc;
+    ArrayRef<TraceStore::Record> Records;
+  };
+  std::vector<Task> Tasks;
+  for (const TraceStore::Entry &E : Store.Entries()) {
+    ArrayRef<TraceStore::Record> Records = Store.Records(E);
+    for (size_t I = 0; I < Records.size(); I += QueriesPerSearch)
+      Tasks.push_back({E.EntryPc, ArrayRef<TraceStore::Record>(
+        Records.begin() + I, std::min(QueriesPerSearch, Records.size() - I))});
+  }
+
+  WorkStealingPool Pool(Opts.NumThreads);
+  std::vector<std::unique_ptr<MultiQuerySearch<GraphT, HashT>>> Searchers;
+  for (unsigned W = 0; W < Pool.NumThreads(); W++)
+    Searchers.emplace_back(new MultiQuerySearch<GraphT, HashT>(RevCG, Params));
+
+  std::vector<std::string> Logs(Tasks.size());
+  std::vector<bool> Done(Tasks.size(), false);
+  size_t NextToPrint = 0, NumFound = 0, NumInvalid = 0;
+  size_t NumCandidates = 0, NumAmbiguous = 0, NumTruncated = 0;
+  std::mutex PrintLock;
+
+  std::cerr << "Decoding " << std::dec << Store.NumRecords()
+            << " distinct stack traces of " << Store.Entries().size()
+            << " entry functions." << std::endl;
+  auto Start = std::chrono::high_resolution_clock::now();
+  Pool.ParallelFor(Tasks.size(), [&](unsigned WorkerId, size_t T) {
+    const Task &Tk = Tasks[T];
+    std::vector<CompressedTrace> Wanted(Tk.Records.size());
+    std::vector<StackTrace> Decoded(Tk.Records.size());
+    std::vector<typename MultiQuerySearch<GraphT, HashT>::Query> Queries;
+    std::vector<size_t> QueryOf(Tk.Records.size(), SIZE_MAX);
+    std::vector<CandidateSet> Candidates;
+    if (Opts.Candidates)
+      Candidates.resize(Tk.Records.size(), CandidateSet(Opts.Candidates));
+    size_t NumTaskInvalid = 0;
+    for (size_t I = 0; I < Tk.Records.size(); I++) {
+      if (!Tk.Records[I].Unpack(Wanted[I])) {
+        NumTaskInvalid++;
         continue;
       }
-      if (!Line) break;
-      ST.push_back(PC);
-      if (CurrentDepth++ == DepthLimit) {
-        CountStackTracesClipped++;
-        break;
+      QueryOf[I] = Queries.size();
+      Queries.push_back({&Wanted[I], nullptr, false, 0, &Decoded[I],
+                         Opts.Candidates ? &Candidates[I] : nullptr});
+    }
+
+    auto SearchStart = std::chrono::high_resolution_clock::now();
+    Searchers[WorkerId]->Reconstruct(Tk.EntryPc, Queries);
+    auto SearchStop = std::chrono::high_resolution_clock::now();
+
+    // The records of the chunk are searched together, so the time is the one
+    // of the chunk.
+    std::ostringstream Log;
+    std::string_view FuncName = "UNKNOWN_NAME";
+    Symbols.NameOf(Tk.EntryPc, FuncName);
+    Log << "\nSearched " << std::dec << Tk.Records.size() << " records of "
+        << FuncName << " together in "
+        << std::chrono::duration<double>(SearchStop - SearchStart).count()
+        << " sec." << std::endl;
+    size_t NumTaskFound = 0, NumTaskCandidates = 0, NumTaskAmbiguous = 0,
+           NumTaskTruncated = 0;
+    for (size_t I = 0; I < Tk.Records.size(); I++) {
+      Log << "\nFuncName: " << FuncName
+          << "\nFuncEntryPc: " << std::hex << Tk.EntryPc
+          << "\nStack trace hash: " << std::hex << Tk.Records[I].Words[0]
+          << "\nOccurrences: " << std::dec << Tk.Records[I].Count << std::endl;
+      ResultCache::Result R = {false, 0};
+      if (QueryOf[I] == SIZE_MAX) {
+        Log << "WARNING: Invalid record." << std::endl;
+      } else {
+        const auto &Q = Queries[QueryOf[I]];
+        R = {Q.Found, Q.DoesNotMatchCount};
+        if (R.Found && Opts.Candidates) {
+          CandidateSet &CS = Candidates[I];
+          CS.Rank(Tk.EntryPc, Ranking, Symbols);
+          Log << "Candidates: " << std::dec << CS.size()
+              << (CS.IsTruncated() ? " (truncated, there are more)" : "")
+              << std::endl;
+          for (size_t C = 0; C < CS.size(); C++) {
+            Log << "Candidate " << std::dec << C + 1 << " (score "
+                << CS[C].Score << "): ";
+            PrettyPrintST(Log, Symbols, CS.Frames(CS[C]).begin(),
+                          CS[C].Depth);
+          }
+          NumTaskCandidates += CS.size();
+          NumTaskAmbiguous += CS.size() > 1;
+          NumTaskTruncated += CS.IsTruncated();
+        } else if (R.Found) {
+          Log << "Decoded stack trace: " << std::endl;
+          PrettyPrintST(Log, Symbols, Decoded[I]);
+        }
       }
+      NumTaskFound += R.Found;
+      PrintTraceResult(Log, R, nullptr);
     }
-    uint64_t STHash = Hash(ST);
-    if (HashesFound.count(STHash)) CountHashCollisions++;
-    
-    Res.emplace_back(FuncName, STHash, ST);
-  }
-  if (CountStackTracesClipped)
-    fprintf(stderr, "WARNING: %d stack traces were clipped as they exceeded "
-                    "the depth limit.\n", CountStackTracesClipped);
-  if (CountHashCollisions)
-    fprintf(stderr, "WARNING: %d stack traces had hash collisions.\n", 
-                                                      CountHashCollisions);
-  if (CSCouldntFind)
-    fprintf(stderr, "WARNING: %d stack traces were ignored since they included filtered frames.\n", 
-                                                      CSCouldntFind);
-  return Res;
-}
-
-// Returns whether the stack trace is found. If it is found, prints a success
-// message and the number of incorrect reconstructions.
-bool DFS(size_t CurrentDepth, uint64_t CurrentHash, FunctionNode *EntryFunc) {
-  // Check hash match
-  if (CurrentHash == WantedHash) {
-    bool DidMatch = AreSTSame(WantedST.begin(), WantedST.size(), ST, CurrentDepth);
-    if (DidMatch) {
-      std::cerr << "SUCCESS: Matches!\n";
-      std::cerr << "Found " << DoesNotMatchCount 
-                << " incorrect reconstructions due to collisions" << std::endl;
-      return true;
-    } else {
-      DoesNotMatchCount++;
+
+    std::lock_guard<std::mutex> Guard(PrintLock);
+    NumFound += NumTaskFound;
+    NumInvalid += NumTaskInvalid;
+    NumCandidates += NumTaskCandidates;
+    NumAmbiguous += NumTaskAmbiguous;
+    NumTruncated += NumTaskTruncated;
+    Logs[T] = Log.str();
+    Done[T] = true;
+    for (; NextToPrint < Tasks.size() && Done[NextToPrint]; NextToPrint++) {
+      std::cerr << Logs[NextToPrint];
+      std::string().swap(Logs[NextToPrint]);
+    }
+  });
+  auto Stop = std::chrono::high_resolution_clock::now();
+
+  if (NumInvalid)
+    std::cerr << "WARNING: " << NumInvalid << " records of the store are "
+                 "invalid." << std::endl;
+  double Seconds = std::chrono::duration<double>(Stop - Start).count();
+  std::cerr << "Decoded " << std::dec << NumFound << "/" << Store.NumRecords()
+            << " distinct stack traces (" << Store.NumOccurrences()
+            << " occurrences) in " << Seconds << " sec ("
+            << (Seconds > 0 ? Store.NumRecords() / Seconds : 0)
+            << " traces/sec, " << Pool.NumThreads() << " threads)."
+            << std::endl;
+  if (Opts.Candidates)
+    std::cerr << "Found " << NumCandidates << " candidates for them: "
+              << NumAmbiguous << " have more than one, " << NumTruncated
+              << " more than " << Opts.Candidates << "." << std::endl;
+  ReportProcessMemory(Opts, "decoding");
+  return true;
+}
+
+// Same as DecodeStore above, with the hash policy of the parameters.
+template<class GraphT>
+bool DecodeStore(const GraphT &RevCG, const SymbolTable &Symbols,
+                 const SearchParams &Params, const Options &Opts,
+                 const TraceStore &Store) {
+  return WithHashPolicy(Params.Kind, [&](auto Policy) {
+    return DecodeStore<GraphT, decltype(Policy)>(RevCG, Symbols, Params, Opts,
+                                                 Store);
+  });
+}
+
+// Load the profile of Opts.ProfileFile if it exists, and order the callers
+// of the graph by it. Returns the profile to add to, or null if not asked
+// for. Exits if the file cannot be read.
+template<class GraphT>
+CallSiteProfile *ApplyProfile(GraphT &RevCG, const Options &Opts,
+                              CallSiteProfile &Profile) {
+  if (Opts.ProfileFile.empty())
+    return nullptr;
+  if (access(Opts.ProfileFile.c_str(), F_OK) != 0)
+    return &Profile;
+  std::string Err;
+  if (!Profile.Load(Opts.ProfileFile, Err)) {
+    std::cerr << "ERROR: " << Err << std::endl;
+    exit(-1);
+  }
+  auto Start = std::chrono::high_resolution_clock::now();
+  size_t NumMoved = RevCG.ReorderCallers(Profile);
+  auto Stop = std::chrono::high_resolution_clock::now();
+  std::cerr << "Ordered the call sites of " << NumMoved
+            << " caller lists by the profile of " << Profile.size()
+            << " call sites in "
+            << std::chrono::duration<double>(Stop - Start).count() << " sec."
+            << std::endl;
+  return &Profile;
+}
+
+// Print the estimated bytes of the structures of the call graph once built,
+// and of the symbol table, with --mem-report.
+static void ReportStructureMemory(const Options &Opts, const CallGraph &CG,
+                                  const SymbolTable &Symbols) {
+  if (!Opts.MemReport)
+    return;
+  std::cerr << "Memory of the call graph structures (estimated):"
+            << std::endl;
+  size_t Total = 0;
+  for (const auto &El : CG.StructureBytes) {
+    std::cerr << "  " << std::left << std::setw(30) << El.first << std::right
+              << std::setw(12) << El.second << " bytes" << std::endl;
+    Total += El.second;
+  }
+  std::cerr << "  " << std::left << std::setw(30) << "Total" << std::right
+            << std::setw(12) << Total << " bytes" << std::endl;
+  std::cerr << "Memory of the symbol table: " << Symbols.ArrayBytes()
+            << " bytes." << std::endl;
+}
+
+// Free the call graph and its text once the symbol table and the reverse
+// call graph are built, with --low-memory. The freed memory is given back to
+// the system so that it leaves the resident set.
+static void ReleaseCallGraph(const Options &Opts,
+                             std::unique_ptr<CallGraph> &CG,
+                             MappedFile &CGFile) {
+  if (!Opts.LowMemory)
+    return;
+  CG.reset();
+  CGFile.Close();
+  malloc_trim(0);
+  ReportProcessMemory(Opts, "releasing the call graph");
+}
+
+// Map the file, or exit if it cannot be read.
+static void MapInputFile(MappedFile &File, const char *Path) {
+  std::string Err;
+  if (!File.Open(Path, Err)) {
+    std::cerr << "ERROR: " << Err << std::endl;
+    exit(-1);
+  }
+}
+
+static std::string_view Text(const MappedFile &File) {
+  return std::string_view(File.data(), File.size());
+}
+
+// Open the stack traces, or exit if they cannot be read.
+static int OpenTraces(const char *Path) {
+  std::string Err;
+  int Fd = TraceStream::OpenInput(Path, Err);
+  if (Fd < 0) {
+    std::cerr << "ERROR: " << Err << std::endl;
+    exit(-1);
+  }
+  return Fd;
+}
+
+// Predict the nodes the searches of the stack traces of Path visit on the
+// graph for all pruning depths, and measure the best ones and the given ones
+// on a sample of the stack traces. With --auto-pruning, the depths measured
+// best are set in Params. Returns false on failure.
+template<class GraphT>
+bool TunePruning(const GraphT &RevCG, const SymbolTable &Symbols,
+                 SearchParams &Params, const Options &Opts, const char *Path) {
+  static const size_t NumMeasured = 3;
+
+  auto Start = std::chrono::high_resolution_clock::now();
+  PruningTuner<GraphT> Tuner(RevCG, Params.MaxDepth, Opts.HashOnly);
+  // The sample is drawn uniformly, and the same in every run.
+  TraceBatch Sample, Batch;
+  std::mt19937_64 Rng(0);
+  size_t NumRead = 0, NumUnknown = 0;
+  SearchParams ReadParams = Params;
+  TraceStream Traces(OpenTraces(Path), Symbols, ReadParams, Opts.HashOnly);
+  while (Traces.Next(Batch)) {
+    for (TraceRecord &R : Batch) {
+      if (!Tuner.AddTrace(R.EntryPc, R.ST.size())) {
+        NumUnknown++;
+        continue;
+      }
+      NumRead++;
+      if (Sample.size() < Opts.TuneSample)
+        Sample.push_back(std::move(R));
+      else if (size_t I = Rng() % NumRead; I < Opts.TuneSample)
+        Sample[I] = std::move(R);
+    }
+  }
+  if (!Traces.Error().empty()) {
+    std::cerr << "ERROR: " << Traces.Error() << std::endl;
+    return false;
+  }
+  if (!NumRead) {
+    std::cerr << "ERROR: No stack trace to tune the pruning depths on."
+              << std::endl;
+    return false;
+  }
+
+  // The figures are printed to 3 digits, leaving the precision of std::cerr
+  // as it is.
+  auto Figure = [](double X) {
+    std::ostringstream Out;
+    Out << std::setprecision(3) << X;
+    return Out.str();
+  };
+  std::cerr << "Tuning the pruning depths for the maximum depth "
+            << Params.MaxDepth << " on " << NumRead << " stack traces";
+  if (NumUnknown)
+    std::cerr << " (" << NumUnknown << " with an unknown entry function "
+                 "ignored)";
+  std::cerr << ".\nPaths per depth from the entry functions (stack traces):"
+            << std::endl;
+  for (const auto &E : Tuner.Entries()) {
+    std::string_view Name = "UNKNOWN_NAME";
+    Symbols.NameOf(E.first, Name);
+    std::cerr << "  " << Name << " [" << std::hex << E.first << std::dec
+              << "] (" << E.second << "):";
+    for (double N : Tuner.PathsPerDepth(E.first))
+      std::cerr << " " << Figure(N);
+    std::cerr << std::endl;
+  }
+
+  // Measure the best predicted depths, and the given ones to compare. A
+  // search visiting many more nodes than predicted is given up on.
+  std::vector<typename PruningTuner<GraphT>::Choice> Ranked = Tuner.RankAll();
+  // Same restriction as for the given depths.
+  if (Opts.MitmDepth >= 0)
+    Ranked.erase(std::remove_if(Ranked.begin(), Ranked.end(),
+                                [](const auto &C) {
+                                  return C.PruningDepth1 >= C.PruningDepth2;
+                                }),
+                 Ranked.end());
+  std::vector<typename PruningTuner<GraphT>::Choice> Measured(
+    Ranked.begin(), Ranked.begin() + std::min(NumMeasured, Ranked.size()));
+  bool GivenMeasured = false;
+  for (const auto &C : Measured)
+    GivenMeasured |= C.PruningDepth1 == Params.PruningDepth1 &&
+                     C.PruningDepth2 == Params.PruningDepth2;
+  if (!GivenMeasured)
+    Measured.push_back({Params.PruningDepth1, Params.PruningDepth2,
+                        Tuner.Predict(Params.PruningDepth1,
+                                      Params.PruningDepth2)});
+  if (!Sample.empty()) {
+    WorkStealingPool Pool(Opts.NumThreads);
+    for (auto &C : Measured) {
+      SearchBudget Budget = Opts.Budget;
+      if (!Budget.IsLimited())
+        Budget.MaxNodes = (uint64_t)std::min(
+          std::max(64 * C.PredictedNodes, (double)(1 << 20)), 1e12);
+      Tuner.Measure(C, Sample, Params.Kind, Pool, Budget);
     }
   }
+  auto Stop = std::chrono::high_resolution_clock::now();
 
-  if (CurrentDepth > MaxDepth)
+  std::cerr << "Nodes per stack trace with the pruning depths";
+  if (!Sample.empty())
+    std::cerr << " (measured on " << Sample.size() << " stack traces)";
+  std::cerr << ":" << std::endl;
+  for (const auto &C : Measured) {
+    std::cerr << "  " << C.PruningDepth1 << " " << C.PruningDepth2
+              << ": predicted " << Figure(C.PredictedNodes);
+    if (C.MeasuredNodes >= 0) {
+      std::cerr << ", measured " << (C.NumExhausted ? ">= " : "")
+                << Figure(C.MeasuredNodes);
+      if (C.NumExhausted)
+        std::cerr << " (" << C.NumExhausted << " out of budget)";
+    }
+    if (C.PruningDepth1 == Params.PruningDepth1 &&
+        C.PruningDepth2 == Params.PruningDepth2)
+      std::cerr << " (given)";
+    std::cerr << std::endl;
+  }
+  // The depths measured best, or predicted best without a measurement.
+  const auto *Best = &Measured[0];
+  for (const auto &C : Measured)
+    if (C.MeasuredNodes >= 0 && !C.NumExhausted &&
+        (Best->MeasuredNodes < 0 || Best->NumExhausted ||
+         C.MeasuredNodes < Best->MeasuredNodes))
+      Best = &C;
+  std::cerr << "Recommended pruning depths: " << Best->PruningDepth1 << " "
+            << Best->PruningDepth2 << " (tuned in "
+            << std::chrono::duration<double>(Stop - Start).count()
+            << " sec)." << std::endl;
+  if (Opts.AutoPruning) {
+    Params.PruningDepth1 = Best->PruningDepth1;
+    Params.PruningDepth2 = Best->PruningDepth2;
+    std::cerr << "Using the recommended pruning depths." << std::endl;
+  }
+  return true;
+}
+
+// Save the graph with --save-snapshot. Only the csr layout is saved, which
+// the checks of the options require.
+static bool SaveSnapshot(const CsrReverseCallGraph &RevCG,
+                         const SymbolTable &Symbols, const Options &Opts) {
+  if (Opts.SaveSnapshot.empty())
+    return true;
+  std::string Err;
+  if (!Snapshot::Write(Opts.SaveSnapshot, RevCG, Symbols, Err)) {
+    std::cerr << "ERROR: " << Err << std::endl;
     return false;
+  }
+  std::cerr << "Saved the snapshot to " << Opts.SaveSnapshot << std::endl;
+  return true;
+}
+
+static bool SaveSnapshot(const ReverseCallGraph &, const SymbolTable &,
+                         const Options &) {
+  return true;
+}
+
+// Tune the pruning depths, order the callers by the profile and save the
+// snapshot, then decode Store if given, or reconstruct the stack traces of
+// Path. Traces are the stack traces of Path if already being read. Returns
+// the exit code.
+template<class GraphT>
+int RunOnGraph(GraphT &RevCG, const SymbolTable &Symbols,
+               SearchParams &Params, const Options &Opts, const char *Path,
+               const TraceStore *Store, std::unique_ptr<TraceStream> &Traces) {
+  // The tuning measures the searches on the graph as built, so that the
+  // recommended depths do not depend on the profile of the past runs.
+  if ((Opts.TunePruning || Opts.AutoPruning) &&
+      !TunePruning(RevCG, Symbols, Params, Opts, Path))
+    return -1;
+  // The snapshot keeps the order of the profile.
+  CallSiteProfile Profile;
+  CallSiteProfile *ToRecord = ApplyProfile(RevCG, Opts, Profile);
+  if (!SaveSnapshot(RevCG, Symbols, Opts))
+    return -1;
+  if (Opts.TunePruning)
+    return 0;
+  if (Store)
+    return DecodeStore(RevCG, Symbols, Params, Opts, *Store) ? 0 : -1;
+  if (!Traces)
+    Traces.reset(new TraceStream(OpenTraces(Path), Symbols, Params,
+                                 Opts.HashOnly));
+  return RunReconstructions(RevCG, Symbols, Params, Opts, *Traces,
+                            ToRecord) ? 0 : -1;
+}
+
+// The reverse call graph and the symbol table to reconstruct on, with what
+// they are loaded or built from.
+struct LoadedGraph {
+  std::unique_ptr<Snapshot> Snap;
+  std::unique_ptr<ModuleSet> Modules;
+  MappedFile CGFile;
+  std::unique_ptr<CallGraph> CG;
+  std::unique_ptr<SymbolTable> BuiltSymbols;
+  std::unique_ptr<CsrReverseCallGraph> BuiltGraph;
+  std::unique_ptr<ReverseCallGraph> PointerGraph; //< With --layout=pointer.
+  CsrReverseCallGraph *Graph = nullptr; //< Null with the pointer layout, or
+                                        //< if only the symbols are read.
+  const SymbolTable *Symbols = nullptr;
+};
+
+// Load the graph of Path: a snapshot saved by --save-snapshot, a module map,
+// or the call graph disassembly. Once the symbols of a disassembly are read,
+// the stack traces of TracesPath start being read into Traces if
+// StartTraces, which overlaps with building the reverse call graph, and the
+// graph is not built if SymbolsOnly. Returns false on failure.
+static bool LoadGraph(const char *Path, const char *TracesPath,
+                      const Options &Opts, const SearchParams &Params,
+                      const CallGraphFilter &CGF,
+                      CsrReverseCallGraph::Order Order, bool StartTraces,
+                      bool SymbolsOnly, LoadedGraph &G,
+                      std::unique_ptr<TraceStream> &Traces) {
+  // A snapshot is used as mapped without building anything.
+  if (Snapshot::IsSnapshot(Path)) {
+    if (Opts.Layout != "csr" || !Opts.SaveSnapshot.empty()) {
+      std::cerr << "ERROR: A snapshot is only used with the csr layout, and "
+                   "cannot be saved again." << std::endl;
+      return false;
+    }
+    auto LoadStart = std::chrono::high_resolution_clock::now();
+    G.Snap.reset(new Snapshot());
+    std::string Err;
+    if (!G.Snap->Load(Path, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return false;
+    }
+    G.Graph = &G.Snap->Graph();
+    G.Symbols = &G.Snap->Symbols();
+    auto LoadStop = std::chrono::high_resolution_clock::now();
+    std::cerr << "Loaded the reverse call graph snapshot: "
+              << G.Graph->NumFuncs() << " functions, "
+              << G.Graph->NumCallSites() << " call sites, "
+              << G.Graph->NumEdges() << " edges in "
+              << std::chrono::duration<double>(LoadStop - LoadStart).count()
+              << " sec." << std::endl;
+    ReportProcessMemory(Opts, "loading the snapshot");
+    return true;
+  }
 
-  // If the current depth is one of the pruning depths, check the hash against
-  // the pruning hashes.
-  if (CurrentDepth == PruningDepth1+1) {
-    // Pruning depth 1: prune based on the highest 16-bits bucket
-    if ((CurrentHash >> 48) != WantedHashMed1)
+  // A module map lists the modules of a process and their load addresses.
+  // The graph of each module is loaded from the cache, or built, and they are
+  // linked at the addresses of the run.
+  if (ModuleSet::IsModuleMap(Path)) {
+    if (Opts.Layout != "csr") {
+      std::cerr << "ERROR: A module map is only used with the csr layout."
+                << std::endl;
+      return false;
+    }
+    std::vector<ModuleSpec> Specs;
+    std::string Err;
+    if (!ModuleSet::ReadModuleMap(Path, Specs, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
       return false;
-  } else if (CurrentDepth == PruningDepth2+1) {
-    // Pruning depth 2: prune based on the second highest 16-bits bucket
-    if (((CurrentHash >> 32) & 0xFFFFll) != WantedHashMed2)
+    }
+    std::unique_ptr<WorkStealingPool> BuildPool;
+    if (Opts.BuildThreads != 1)
+      BuildPool.reset(new WorkStealingPool(Opts.BuildThreads));
+    auto LinkStart = std::chrono::high_resolution_clock::now();
+    G.Modules.reset(new ModuleSet(CGF, Order, Opts.ModuleCache,
+                                  BuildPool.get()));
+    if (!G.Modules->Update(Specs, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
       return false;
+    }
+    BuildPool.reset();
+    G.Graph = &G.Modules->Graph();
+    G.Symbols = &G.Modules->Symbols();
+    auto LinkStop = std::chrono::high_resolution_clock::now();
+    const ModuleSet::UpdateStats &US = G.Modules->LastUpdate();
+    std::cerr << "Linked the reverse call graphs of "
+              << G.Modules->NumModules() << " modules (" << US.NumCached
+              << " cached, " << US.NumBuilt << " built): "
+              << G.Graph->NumFuncs() << " functions, "
+              << G.Graph->NumCallSites() << " call sites, "
+              << G.Graph->NumEdges() << " edges in "
+              << std::chrono::duration<double>(LinkStop - LinkStart).count()
+              << " sec (" << US.LinkSeconds << " sec linking)." << std::endl;
+    ReportProcessMemory(Opts, "linking the modules");
+    return true;
   }
 
-  // Continue search from the callers of the current function.
-  auto NumCallers = EntryFunc->NumCallers;
-  auto Callers = EntryFunc->Callers;
-  for (int I = 0; I < NumCallers; I++) {
-    const CallSiteNode &CSN = Callers[I];
+  // Read the call graph, parsed in place from the mapped file. The threads
+  // building the graphs are stopped once they are built.
+  MapInputFile(G.CGFile, Path);
+  std::unique_ptr<WorkStealingPool> BuildPool;
+  if (Opts.BuildThreads != 1)
+    BuildPool.reset(new WorkStealingPool(Opts.BuildThreads));
+  auto ReadStart = std::chrono::high_resolution_clock::now();
+  G.CG.reset(new CallGraph(Text(G.CGFile), CGF, Opts.LowMemory,
+                           Opts.MemReport, BuildPool.get()));
+  G.BuiltSymbols.reset(new SymbolTable(*G.CG));
+  G.Symbols = G.BuiltSymbols.get();
+  auto ReadStop = std::chrono::high_resolution_clock::now();
+  std::cerr << "Read the call graph: " << G.CG->FuncAddrToName.size()
+            << " functions in "
+            << std::chrono::duration<double>(ReadStop - ReadStart).count()
+            << " sec." << std::endl;
+  ReportBuildPhases(Opts, "Read", G.CG->Phases);
+  ReportStructureMemory(Opts, *G.CG, *G.Symbols);
+  ReportProcessMemory(Opts, "reading the call graph");
 
-    // Fill one frame in the stack trace.
-    ST[CurrentDepth] = CSN.CallSitePc;
-    bool Found = DFS(
-      CurrentDepth + 1,
-      HashStep(CurrentHash, CSN.CallSitePc, CurrentDepth),
-      CSN.Caller
-    );
+  if (StartTraces)
+    Traces.reset(new TraceStream(OpenTraces(TracesPath), *G.Symbols, Params,
+                                 Opts.HashOnly));
+  if (SymbolsOnly)
+    return true;
 
-    if (Found)
-      return true;
+  // Compute the light-weight reverse call graph.
+  auto BuildStart = std::chrono::high_resolution_clock::now();
+  if (Opts.Layout == "pointer") {
+    G.PointerGraph.reset(new ReverseCallGraph(*G.CG, BuildPool.get()));
+    BuildPool.reset();
+    const ReverseCallGraph &RevCG = *G.PointerGraph;
+    auto BuildStop = std::chrono::high_resolution_clock::now();
+    std::cerr << "Built the reverse call graph (pointer layout): "
+              << RevCG.FuncPcToNode.size() << " functions, "
+              << RevCG.NumCallSites() << " call sites, " << RevCG.NumEdges()
+              << " edges in "
+              << std::chrono::duration<double>(BuildStop - BuildStart).count()
+              << " sec." << std::endl;
+    ReportBuildPhases(Opts, "Built", RevCG.Phases);
+    if (Opts.MemReport)
+      std::cerr << "Memory of the reverse call graph (estimated): "
+                << RevCG.HeapBytes() << " bytes." << std::endl;
+  } else {
+    G.BuiltGraph.reset(new CsrReverseCallGraph(*G.CG, Order,
+                                               BuildPool.get()));
+    BuildPool.reset();
+    G.Graph = G.BuiltGraph.get();
+    auto BuildStop = std::chrono::high_resolution_clock::now();
+    std::cerr << "Built the reverse call graph (csr layout, " << Opts.Order
+              << " order): " << G.Graph->NumFuncs() << " functions, "
+              << G.Graph->NumCallSites() << " call sites, "
+              << G.Graph->NumEdges() << " edges, " << G.Graph->ArrayBytes()
+              << " bytes in "
+              << std::chrono::duration<double>(BuildStop - BuildStart).count()
+              << " sec." << std::endl;
+    ReportBuildPhases(Opts, "Built", G.Graph->Phases);
   }
-  return false;
+  ReportProcessMemory(Opts, "building the reverse call graph");
+  ReleaseCallGraph(Opts, G.CG, G.CGFile);
+  return true;
+}
+
+// Time the parsers alone on the inputs and print their throughput. The
+// tokenizer pass only splits the call graph into lines and hex words, so it
+// bounds what the full parser can achieve.
+static bool RunParseBenchmark(std::string_view CGText, int TracesFd,
+                              const CallGraphFilter &CGF,
+                              const SearchParams &Params) {
+  auto PrintRate = [](const char *What, size_t Bytes,
+                      std::chrono::high_resolution_clock::time_point Start) {
+    double Seconds = std::chrono::duration<double>(
+      std::chrono::high_resolution_clock::now() - Start).count();
+    std::cerr << What << ": " << Bytes << " bytes in " << Seconds << " sec ("
+              << (Seconds > 0 ? Bytes / Seconds / 1e6 : 0) << " MB/s)."
+              << std::endl;
+  };
+
+  auto Start = std::chrono::high_resolution_clock::now();
+  size_t NumLines = 0, NumHexWords = 0;
+  TextCursor In(CGText), Line(In);
+  while (In.NextLine(Line)) {
+    NumLines++;
+    std::string_view Word;
+    while (Line.ReadWord(Word))
+      NumHexWords += HexDigitValue[(uint8_t)Word[0]] >= 0;
+  }
+  PrintRate("Tokenized the call graph", CGText.size(), Start);
+  std::cerr << "  " << NumLines << " lines, " << NumHexWords
+            << " hex words." << std::endl;
+
+  Start = std::chrono::high_resolution_clock::now();
+  CallGraph CG(CGText, CGF);
+  PrintRate("Read the call graph", CGText.size(), Start);
+
+  Start = std::chrono::high_resolution_clock::now();
+  SymbolTable Symbols(CG);
+  TraceStream Traces(TracesFd, Symbols, Params);
+  TraceBatch Batch;
+  while (Traces.Next(Batch)) {}
+  if (!Traces.Error().empty()) {
+    std::cerr << "ERROR: " << Traces.Error() << std::endl;
+    return false;
+  }
+  PrintRate("Read the stack traces", Traces.Stats().NumBytes, Start);
+  std::cerr << "  " << Traces.Stats().NumTraces << " stack traces."
+            << std::endl;
+  return true;
 }
 
 int main(int argc, char **argv) {
-  if (argc != 6) {
+  Options Opts;
+  bool BadOptions = false;
+  for (int I = 6; I < argc; I++) {
+    if (!ReadOption(argv[I], "--threads", Opts.NumThreads) &&
+        !ReadOption(argv[I], "--split-depth", Opts.SplitDepth) &&
+        !ReadOption(argv[I], "--mitm", Opts.MitmDepth) &&
+        !ReadOption(argv[I], "--layout", Opts.Layout) &&
+        !ReadOption(argv[I], "--order", Opts.Order) &&
+        !ReadOption(argv[I], "--save-snapshot", Opts.SaveSnapshot) &&
+        !ReadFlag(argv[I], "--parse-only", Opts.ParseOnly) &&
+        !ReadFlag(argv[I], "--hash-only", Opts.HashOnly) &&
+        !ReadFlag(argv[I], "--group", Opts.Grouped) &&
+        !ReadFlag(argv[I], "--recursive", Opts.Recursive) &&
+        !ReadFlag(argv[I], "--cache", Opts.UseCache) &&
+        !ReadOption(argv[I], "--cache", Opts.CacheFile) &&
+        !ReadOption(argv[I], "--hash", Opts.HashName) &&
+        !ReadFlag(argv[I], "--hash-bench", Opts.HashBench) &&
+        !ReadOption(argv[I], "--stats", Opts.StatsFile) &&
+        !ReadOption(argv[I], "--stats-format", Opts.StatsFormat) &&
+        !ReadFlag(argv[I], "--perf", Opts.Perf) &&
+        !ReadOption(argv[I], "--max-nodes", Opts.Budget.MaxNodes) &&
+        !ReadOption(argv[I], "--max-trace-time", Opts.Budget.MaxSeconds) &&
+        !ReadOption(argv[I], "--retry-factor", Opts.RetryFactor) &&
+        !ReadOption(argv[I], "--profile", Opts.ProfileFile) &&
+        !ReadOption(argv[I], "--store", Opts.StoreFile) &&
+        !ReadFlag(argv[I], "--low-memory", Opts.LowMemory) &&
+        !ReadFlag(argv[I], "--mem-report", Opts.MemReport) &&
+        !ReadOption(argv[I], "--build-threads", Opts.BuildThreads) &&
+        !ReadFlag(argv[I], "--build-timings", Opts.BuildTimings) &&
+        !ReadOption(argv[I], "--module-cache", Opts.ModuleCache) &&
+        !ReadFlag(argv[I], "--serve", Opts.Serve) &&
+        !ReadOption(argv[I], "--candidates", Opts.Candidates) &&
+        !ReadFlag(argv[I], "--tune-pruning", Opts.TunePruning) &&
+        !ReadFlag(argv[I], "--auto-pruning", Opts.AutoPruning) &&
+        !ReadOption(argv[I], "--tune-sample", Opts.TuneSample)) {
+      std::cerr << "Unknown option: " << argv[I] << std::endl;
+      BadOptions = true;
+    }
+  }
+  Opts.UseCache |= !Opts.CacheFile.empty();
+  if ((Opts.MitmDepth >= 0) + (Opts.SplitDepth >= 0) + Opts.Grouped > 1) {
+    std::cerr << "Only one of --mitm, --split-depth and --group can be given."
+              << std::endl;
+    BadOptions = true;
+  }
+  HashKind Kind = DefaultHashKind;
+  if (!Opts.HashName.empty() && !ParseHashKind(Opts.HashName, Kind)) {
+    std::cerr << "Unknown or unsupported hash: " << Opts.HashName << std::endl;
+    BadOptions = true;
+  }
+  if (Opts.HashBench &&
+      (Opts.MitmDepth >= 0 || Opts.SplitDepth >= 0 || Opts.Grouped ||
+       Opts.UseCache || !Opts.ProfileFile.empty())) {
+    std::cerr << "--hash-bench cannot be given with --mitm, --split-depth, "
+                 "--group, --cache or --profile." << std::endl;
+    BadOptions = true;
+  }
+  StatsWriter::Format StatsFormat;
+  if (!StatsWriter::ParseFormat(Opts.StatsFormat, StatsFormat)) {
+    std::cerr << "Unknown stats format: " << Opts.StatsFormat << std::endl;
+    BadOptions = true;
+  }
+  if (Opts.Perf && Opts.StatsFile.empty()) {
+    std::cerr << "--perf is only used with --stats." << std::endl;
+    BadOptions = true;
+  }
+  if (Opts.Budget.IsLimited() && (Opts.Grouped || Opts.HashBench)) {
+    std::cerr << "--max-nodes and --max-trace-time cannot be given with "
+                 "--group or --hash-bench." << std::endl;
+    BadOptions = true;
+  }
+  if (Opts.RetryFactor > 0 &&
+      (!Opts.Budget.IsLimited() || Opts.RetryFactor <= 1)) {
+    std::cerr << "--retry-factor must be larger than 1, and is only used with "
+                 "--max-nodes or --max-trace-time." << std::endl;
+    BadOptions = true;
+  }
+  // Options of the search of the ASan output, which are not used on the
+  // stores. With --candidates, the profile only ranks the candidates.
+  bool SearchOptions = Opts.MitmDepth >= 0 || Opts.SplitDepth >= 0 ||
+                       Opts.UseCache || !Opts.StatsFile.empty() ||
+                       Opts.Budget.IsLimited() || Opts.HashBench ||
+                       (!Opts.ProfileFile.empty() && !Opts.Candidates) ||
+                       Opts.ParseOnly || Opts.TunePruning ||
+                       Opts.AutoPruning;
+  if (!Opts.StoreFile.empty() && SearchOptions) {
+    std::cerr << "--store only compresses the stack traces, and cannot be "
+                 "given with the options of the search." << std::endl;
+    BadOptions = true;
+  }
+  if (Opts.Serve && (SearchOptions || Opts.Grouped || Opts.Recursive ||
+                     Opts.HashOnly || !Opts.StoreFile.empty() ||
+                     !Opts.SaveSnapshot.empty() || Opts.Layout != "csr")) {
+    std::cerr << "--serve decodes with the grouped search on the csr layout, "
+                 "and cannot be given with the options of the other modes."
+              << std::endl;
+    BadOptions = true;
+  }
+  // The stack traces are read once to tune, and again to reconstruct.
+  bool Tuning = Opts.TunePruning || Opts.AutoPruning;
+  if (Tuning && (Opts.TunePruning == Opts.AutoPruning ||
+                 (argc > 2 && !strcmp(argv[2], "-")))) {
+    std::cerr << "Only one of --tune-pruning and --auto-pruning can be "
+                 "given, and the stack traces must be read from a file."
+              << std::endl;
+    BadOptions = true;
+  }
+  if (Opts.Layout != "csr" && Opts.Layout != "pointer") {
+    std::cerr << "Unknown layout: " << Opts.Layout << std::endl;
+    BadOptions = true;
+  }
+  if (!Opts.SaveSnapshot.empty() && Opts.Layout != "csr") {
+    std::cerr << "--save-snapshot only saves the csr layout." << std::endl;
+    BadOptions = true;
+  }
+  if (Opts.Order != "pc" && Opts.Order != "bfs" && Opts.Order != "rcm") {
+    std::cerr << "Unknown order: " << Opts.Order << std::endl;
+    BadOptions = true;
+  }
+
+  if (argc < 6 || BadOptions) {
     std::cerr << "OVERVIEW: efficient stack trace collection and reconstruction simulation tool" << std::endl;
     std::cerr << "USAGE: " << argv[0] 
               << " call_graph_disasm_file" //< 1st
@@ -225,25 +1535,178 @@ int main(int argc, char **argv) {
               << " max_depth"              //< 3rd
               << " pruning_depth_1"        //< 4th
               << " pruning_depth_2"        //< 5th
+              << " [options]"
               << "\n\n";
     std::cerr << " call_graph_disasm_file     " 
               << "File containing call graph disassembly output obtained from llvm-objdump --call-graph-info\n"
+              << "                            "
+              << "(or a snapshot, or a module map linking the graphs of many modules)\n"
               << " stack_traces_file          "
               << "File containing stack traces to compress/decompress, obtained using ASAN hooks\n"
+              << "                            "
+              << "(- for stdin, which can be a live pipe). With --serve, the Unix\n"
+              << "                            "
+              << "domain socket to serve on (- for stdin and stdout)\n"
               << " max_depth                  "
               << "Maximum depth at which to clip the stack traces and stop the reconstruction search\n"
               << " pruning_depth_1            "
               << "First pruning depth\n"
               << " pruning_depth_2            "
-              << "Second pruning depth\n" << std::endl;
+              << "Second pruning depth\n\n";
+    std::cerr << "OPTIONS:\n"
+              << " --threads=N                "
+              << "Reconstruct stack traces on N threads (0: all cores, default: 1)\n"
+              << " --split-depth=K            "
+              << "Reconstruct one stack trace at a time, splitting its search into\n"
+              << "                            "
+              << "parallel tasks at depth K (e.g., pruning_depth_1)\n"
+              << " --mitm=K                   "
+              << "Search from both ends of the stack traces, meeting at depth K\n"
+              << " --layout=csr|pointer       "
+              << "Reverse call graph layout to search on (default: csr)\n"
+              << " --order=pc|bfs|rcm         "
+              << "Function numbering of the csr layout (default: pc)\n"
+              << " --save-snapshot=FILE       "
+              << "Save the reverse call graph to FILE, which can be given as\n"
+              << "                            "
+              << "call_graph_disasm_file in later runs to skip parsing\n"
+              << " --parse-only               "
+              << "Only time the parsers of the input files, and exit\n"
+              << " --group                    "
+              << "Reconstruct the stack traces with the same entry function in\n"
+              << "                            "
+              << "a single traversal\n"
+              << " --recursive                "
+              << "Use the recursive search even if one is compiled for the depths\n"
+              << " --hash-only                "
+              << "Compress the stack traces to the bare hash, without the depth\n"
+              << "                            "
+              << "and the verifier\n"
+              << " --cache[=FILE]             "
+              << "Reuse the results of the stack traces seen before, and load\n"
+              << "                            "
+              << "and save them in FILE across runs\n"
+              << " --hash=crc32-hw|crc32-sw|mulxor\n"
+              << "                            "
+              << "Hash policy of the compression (default: crc32-hw if built\n"
+              << "                            "
+              << "with SSE4.2, otherwise crc32-sw)\n"
+              << " --hash-bench               "
+              << "Compare the search throughput and the false matches of the\n"
+              << "                            "
+              << "hash policies on the stack traces, and exit\n"
+              << " --stats=FILE               "
+              << "Write a record per stack trace with the search counters to\n"
+              << "                            "
+              << "FILE (- for stdout)\n"
+              << " --stats-format=jsonl|csv   "
+              << "Format of the records (default: jsonl)\n"
+              << " --perf                     "
+              << "Add the cycles and cache misses of each search to the\n"
+              << "                            "
+              << "records, if perf_event_open is available\n"
+              << " --max-nodes=N              "
+              << "Give up on a stack trace after visiting N states of its search\n"
+              << " --max-trace-time=SEC       "
+              << "Give up on a stack trace after searching it for SEC seconds\n"
+              << " --retry-factor=K           "
+              << "Search the stack traces given up on again after all others,\n"
+              << "                            "
+              << "with K times the budget\n"
+              << " --profile=FILE             "
+              << "Search the callers seen on the reconstructed stack traces of\n"
+              << "                            "
+              << "the past runs first, and add the ones of this run to FILE\n"
+              << " --store=FILE               "
+              << "Add the compressed stack traces to the store FILE instead of\n"
+              << "                            "
+              << "reconstructing them. A store given as stack_traces_file is\n"
+              << "                            "
+              << "decoded, searching each distinct stack trace once\n"
+              << " --low-memory               "
+              << "Keep only what the reverse call graph is built from while\n"
+              << "                            "
+              << "reading the call graph, and free it once built\n"
+              << " --mem-report               "
+              << "Report the memory of the call graph structures, and of the\n"
+              << "                            "
+              << "process after each phase\n"
+              << " --build-threads=N          "
+              << "Build the call graph and the reverse call graph on N threads\n"
+              << "                            "
+              << "(0: all cores, default: 1). The graphs are the same with any N\n"
+              << " --build-timings            "
+              << "Print the time of each phase of the graph builds\n"
+              << " --module-cache=DIR         "
+              << "Save the graph of each module of a module map to DIR once\n"
+              << "                            "
+              << "built, and load it from there while its call graph is the same\n"
+              << " --serve                    "
+              << "Keep the reverse call graph resident and decode the compressed\n"
+              << "                            "
+              << "stack traces requested on stack_traces_file, on --threads\n"
+              << "                            "
+              << "workers (see decode_server.hpp for the protocol)\n"
+              << " --candidates=N             "
+              << "Decode each record of a store into all stack traces matching\n"
+              << "                            "
+              << "it, up to N, ranked by --profile if given. With --serve, the\n"
+              << "                            "
+              << "limit of the candidates requests (default: 16)\n"
+              << " --tune-pruning             "
+              << "Predict the nodes visited with all pruning depths from the\n"
+              << "                            "
+              << "paths per depth of the entry functions, measure the best ones\n"
+              << "                            "
+              << "and the given ones on a sample of the stack traces, and exit\n"
+              << " --auto-pruning             "
+              << "Same as --tune-pruning, then reconstruct with the pruning\n"
+              << "                            "
+              << "depths measured best instead of the given ones\n"
+              << " --tune-sample=N            "
+              << "Stack traces replayed to measure (0: only predict,\n"
+              << "                            "
+              << "default: 200)\n"
+              << std::endl;
     return -1;
   }
 
   // TODO: Verify the input values. Specifically, verify the filepath inputs.
 
-  // Read the medium indices.
-  PruningDepth1 = atoi(argv[4]);
-  PruningDepth2 = atoi(argv[5]);
+  // Read the maximum depth and the medium indices.
+  SearchParams Params(/*MaxDepth=*/atoi(argv[3]),
+                      /*PruningDepth1=*/atoi(argv[4]),
+                      /*PruningDepth2=*/atoi(argv[5]), Kind);
+  // Without ordered depths, the backward half of --mitm does not prune, and
+  // takes far longer than the plain search.
+  if (Opts.MitmDepth >= 0 && Params.PruningDepth1 >= Params.PruningDepth2) {
+    std::cerr << "ERROR: --mitm requires pruning_depth_1 < pruning_depth_2."
+              << std::endl;
+    return -1;
+  }
+
+  // A store written by --store is decoded in place of the ASan output.
+  TraceStore Store;
+  bool FromStore = !Opts.Serve && TraceStore::IsTraceStore(argv[2]);
+  if (Opts.Candidates && !FromStore && !Opts.Serve) {
+    std::cerr << "ERROR: --candidates is only used to decode a store, or "
+                 "with --serve." << std::endl;
+    return -1;
+  }
+  if (FromStore) {
+    std::string Err;
+    if (SearchOptions || Opts.HashOnly || !Opts.StoreFile.empty()) {
+      std::cerr << "ERROR: A store is decoded with the grouped search, and "
+                   "only --threads, --layout, --order, --hash and "
+                   "--candidates are used."
+                << std::endl;
+      return -1;
+    }
+    if (!Store.Load(argv[2], Err) || !Store.CheckParams(Params, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return -1;
+    }
+  }
 
   // Create call graph filter.
   CallGraphFilter CGF;
@@ -264,61 +1727,114 @@ int main(int argc, char **argv) {
   CGF.ExcludeUnknownIndirCalls = true;
   CGF.ExcludeUnknownIndirTargets = true;
 
-  // Read the call graph.
-  std::ifstream CGIn(argv[1]);
-  CallGraph CG(CGIn, CGF);
+  auto Order = Opts.Order == "bfs" ? CsrReverseCallGraph::Order::Bfs
+             : Opts.Order == "rcm" ? CsrReverseCallGraph::Order::Rcm
+             : CsrReverseCallGraph::Order::EntryPc;
 
-  // Compute the light-weight reverse call graph.
-  auto RevCG = ReverseCallGraph(CG);
-
-  // Read the maximum depth.
-  size_t Depth = atoi(argv[3]);
-
-  // Read the stack traces.
-  std::ifstream TargetStacksIn(argv[2]);
-  auto STS = ReadStackTracesFromASanOut(TargetStacksIn, CG, Depth);
+  // With --serve, the graph is loaded once and serves the decode requests
+  // until the end of the input, or forever on a socket. A reload request
+  // loads the graph again the same way, while the requests in flight finish
+  // on the old one.
+  if (Opts.Serve) {
+    std::unique_ptr<WorkStealingPool> BuildPool;
+    if (Opts.BuildThreads != 1)
+      BuildPool.reset(new WorkStealingPool(Opts.BuildThreads));
+    auto Load = [&](const std::string &Path, ResidentGraph &RG,
+                    std::string &Err) {
+      if (Snapshot::IsSnapshot(Path)) {
+        RG.Snap.reset(new Snapshot());
+        if (!RG.Snap->Load(Path, Err))
+          return false;
+        RG.Graph = &RG.Snap->Graph();
+        RG.Symbols = &RG.Snap->Symbols();
+      } else if (ModuleSet::IsModuleMap(Path)) {
+        // The modules that did not change are loaded from the cache.
+        std::vector<ModuleSpec> Specs;
+        RG.Modules.reset(new ModuleSet(CGF, Order, Opts.ModuleCache,
+                                       BuildPool.get()));
+        if (!ModuleSet::ReadModuleMap(Path, Specs, Err) ||
+            !RG.Modules->Update(Specs, Err))
+          return false;
+        RG.Graph = &RG.Modules->Graph();
+        RG.Symbols = &RG.Modules->Symbols();
+      } else {
+        MappedFile File;
+        if (!File.Open(Path, Err))
+          return false;
+        CallGraph CG(Text(File), CGF, Opts.LowMemory, /*MeasureMemory=*/false,
+                     BuildPool.get());
+        RG.BuiltSymbols.reset(new SymbolTable(CG));
+        RG.BuiltGraph.reset(new CsrReverseCallGraph(CG, Order,
+                                                    BuildPool.get()));
+        RG.Graph = RG.BuiltGraph.get();
+        RG.Symbols = RG.BuiltSymbols.get();
+      }
+      return true;
+    };
+    std::string Err;
+    CallSiteProfile Profile;
+    if (!Opts.ProfileFile.empty() && !Profile.Load(Opts.ProfileFile, Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return -1;
+    }
+    DecodeServer Server(Params, Opts.NumThreads, Load,
+                        Opts.Candidates ? Opts.Candidates : 16,
+                        Opts.ProfileFile.empty() ? nullptr : &Profile);
+    auto LoadStart = std::chrono::high_resolution_clock::now();
+    if (!Server.Reload(argv[1], Err)) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return -1;
+    }
+    auto LoadStop = std::chrono::high_resolution_clock::now();
+    std::cerr << "Loaded " << Server.Describe() << " in "
+              << std::chrono::duration<double>(LoadStop - LoadStart).count()
+              << " sec." << std::endl;
+    bool Served;
+    if (!strcmp(argv[2], "-")) {
+      Served = Server.ServeConnection(STDIN_FILENO, STDOUT_FILENO, Err);
+    } else {
+      std::cerr << "Serving on " << argv[2] << std::endl;
+      Served = Server.ServeSocket(argv[2], Err);
+    }
+    if (!Served) {
+      std::cerr << "ERROR: " << Err << std::endl;
+      return -1;
+    }
+    return 0;
+  }
 
-  // Set globals used by DFS. These are intentionally set global to avoid
-  // recursively passing the same arguments for the DFS function. Alternatively,
-  // a search class may be implemented where these are stored per instance.
-  MaxDepth = Depth;
-  ST = new uint64_t[MaxDepth+1];
-  RCG = &RevCG;
+  // The timing of the parsers only applies to the call graph disassembly.
+  if (Opts.ParseOnly) {
+    if (Snapshot::IsSnapshot(argv[1]) || ModuleSet::IsModuleMap(argv[1])) {
+      std::cerr << "ERROR: A snapshot or a module map cannot be parsed."
+                << std::endl;
+      return -1;
+    }
+    MappedFile CGFile;
+    MapInputFile(CGFile, argv[1]);
+    return RunParseBenchmark(Text(CGFile), OpenTraces(argv[2]), CGF,
+                             Params) ? 0 : -1;
+  }
 
-  std::cerr << "Starting the reconstructions." << std::endl;
-  for (const auto &STI : STS) {
-    std::string FuncName = std::get<0>(STI);
-    // Further set the globals used by DFS.
-    WantedHash = std::get<1>(STI);
-    WantedST = std::get<2>(STI);
-    WantedHashMed1 = WantedHash >> 48;
-    WantedHashMed2 = (WantedHash >> 32) & 0xFFFFll;
-    DoesNotMatchCount = 0;
-    // Print info on the stack trace that is going to be reconstructed.
-    auto FuncEntryPc = CG.FuncNameToAddr[FuncName];
-    std::cerr << "\nFuncName: " << FuncName
-              << "\nFuncEntryPc: " << std::hex << FuncEntryPc
-              << "\nStack trace hash: " << std::hex << WantedHash
-              << "\nStack trace: " << std::endl;
-    PrettyPrintST(CG, WantedST);
-
-    auto start = std::chrono::high_resolution_clock::now();
-    // Start reconstruction.
-    bool Ret = DFS(/*CurrentDepth=*/0, /*CurrentHash=*/0,
-                  /*EntryFunc=*/RCG->FuncPcToNode[FuncEntryPc]);
-    
-    // Print after reconstruction logs.
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-    std::cerr << "Time elapsed (sec): " << std::dec <<duration.count() << std::endl;
-
-    if (!Ret)
-      std::cerr << "\nFAIL: Could not reconstruct the stack trace.\n";
-    std::cerr<< "\n=========================================\n" << std::endl;
-  }
-
-  if (MaxDepth)
-    delete[] ST;
-
-  return 0;
+  // Start reading the stack traces once the symbols are read. Storing them
+  // does not need the graph. To tune the pruning depths, they are read once
+  // the graph is built.
+  LoadedGraph G;
+  std::unique_ptr<TraceStream> Traces;
+  if (!LoadGraph(argv[1], argv[2], Opts, Params, CGF, Order,
+                 /*StartTraces=*/!FromStore && !Tuning,
+                 /*SymbolsOnly=*/!Opts.StoreFile.empty(), G, Traces))
+    return -1;
+  if (!Opts.StoreFile.empty()) {
+    if (!Traces)
+      Traces.reset(new TraceStream(OpenTraces(argv[2]), *G.Symbols, Params,
+                                   Opts.HashOnly));
+    return AddToStore(Params, Opts, *Traces) ? 0 : -1;
+  }
+  const TraceStore *ToDecode = FromStore ? &Store : nullptr;
+  if (G.PointerGraph)
+    return RunOnGraph(*G.PointerGraph, *G.Symbols, Params, Opts, argv[2],
+                      ToDecode, Traces);
+  return RunOnGraph(*G.Graph, *G.Symbols, Params, Opts, argv[2], ToDecode,
+                    Traces);
 }
@@ -0,0 +1,153 @@
+#include "stats_writer.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// Columns of the CSV output, and the keys of the JSON records.
+static const char *CsvHeader =
+  "trace,func,entry_pc,depth,found,found_depth,cached,budget_exhausted,"
+  "retry,ns,false_matches,nodes,nodes_per_depth,pruned_pd1,pruned_pd2,"
+  "cycles,cache_misses\n";
+
+bool StatsWriter::ParseFormat(const std::string &Name, Format &F) {
+  if (Name == "jsonl")
+    F = Format::Jsonl;
+  else if (Name == "csv")
+    F = Format::Csv;
+  else
+    return false;
+  return true;
+}
+
+bool StatsWriter::Open(const std::string &Path, Format F, std::string &Err) {
+  Fmt = F;
+  if (Path == "-") {
+    Out = &std::cout;
+  } else {
+    File.open(Path);
+    if (!File) {
+      Err = "cannot open " + Path + ": " + strerror(errno);
+      return false;
+    }
+    Out = &File;
+  }
+  if (Fmt == Format::Csv)
+    *Out << CsvHeader;
+  return true;
+}
+
+bool StatsWriter::Close(std::string &Err) {
+  Out->flush();
+  if (!*Out) {
+    Err = "cannot write the stats";
+    return false;
+  }
+  return true;
+}
+
+// Append the string as a JSON string literal.
+static void AppendJsonString(std::string &S, std::string_view V) {
+  S += '"';
+  for (char C : V) {
+    if (C == '"' || C == '\\') {
+      S += '\\';
+      S += C;
+    } else if ((unsigned char)C < 0x20) {
+      char Buf[8];
+      snprintf(Buf, sizeof(Buf), "\\u%04x", C);
+      S += Buf;
+    } else {
+      S += C;
+    }
+  }
+  S += '"';
+}
+
+// Append the string as a CSV field, quoted if needed.
+static void AppendCsvString(std::string &S, std::string_view V) {
+  if (V.find_first_of(",\"\n") == std::string_view::npos) {
+    S += V;
+    return;
+  }
+  S += '"';
+  for (char C : V) {
+    if (C == '"')
+      S += '"';
+    S += C;
+  }
+  S += '"';
+}
+
+std::string StatsWriter::FormatRecord(const TraceStatsRecord &R) const {
+  bool Json = Fmt == Format::Jsonl;
+  std::string S;
+  // Append a field with its key, or a null value if not Valid.
+  auto Field = [&](const char *Key, bool Valid, auto Append) {
+    if (Json) {
+      S += S.empty() ? "{\"" : ",\"";
+      S += Key;
+      S += "\":";
+      if (Valid)
+        Append();
+      else
+        S += "null";
+    } else {
+      if (!S.empty())
+        S += ',';
+      if (Valid)
+        Append();
+    }
+  };
+  auto Number = [&](uint64_t V) {
+    return [&S, V]() { S += std::to_string(V); };
+  };
+  auto Bool = [&](bool V) {
+    return [&S, V]() { S += V ? "true" : "false"; };
+  };
+
+  Field("trace", true, Number(R.Index));
+  Field("func", true, [&]() {
+    if (Json)
+      AppendJsonString(S, R.FuncName);
+    else
+      AppendCsvString(S, R.FuncName);
+  });
+  Field("entry_pc", true, [&]() {
+    char Buf[24];
+    snprintf(Buf, sizeof(Buf), Json ? "\"%llx\"" : "%llx",
+             (unsigned long long)R.EntryPc);
+    S += Buf;
+  });
+  Field("depth", true, Number(R.Depth));
+  Field("found", true, Bool(R.Found));
+  Field("found_depth", R.Found, Number(R.Depth));
+  Field("cached", true, Bool(R.Cached));
+  Field("budget_exhausted", true, Bool(R.BudgetExhausted));
+  Field("retry", true, Bool(R.Retry));
+  Field("ns", true, Number(R.Nanoseconds));
+  Field("false_matches", true, Number(R.FalseMatches));
+
+  const SearchStats *St = R.Search;
+  Field("nodes", St, [&]() { S += std::to_string(St->NumNodes()); });
+  Field("nodes_per_depth", St, [&]() {
+    // Up to the deepest depth visited.
+    size_t End = St->NodesPerDepth.size();
+    while (End > 1 && !St->NodesPerDepth[End - 1])
+      End--;
+    S += Json ? "[" : "";
+    for (size_t I = 0; I < End; I++) {
+      if (I)
+        S += Json ? "," : ";";
+      S += std::to_string(St->NodesPerDepth[I]);
+    }
+    S += Json ? "]" : "";
+  });
+  Field("pruned_pd1", St, [&]() { S += std::to_string(St->PrunedAtDepth1); });
+  Field("pruned_pd2", St, [&]() { S += std::to_string(St->PrunedAtDepth2); });
+  Field("cycles", R.Perf, [&]() { S += std::to_string(R.Perf->Cycles); });
+  Field("cache_misses", R.Perf,
+        [&]() { S += std::to_string(R.Perf->CacheMisses); });
+  S += Json ? "}\n" : "\n";
+  return S;
+}
@@ -0,0 +1,59 @@
+#ifndef __STATS_WRITER_H__
+#define __STATS_WRITER_H__
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#include "perf_counters.hpp"
+#include "search.hpp"
+
+// Measurements of one reconstructed stack trace.
+struct TraceStatsRecord {
+  size_t Index = 0;         //< Position of the stack trace in the input.
+  std::string_view FuncName;
+  uint64_t EntryPc = 0;
+  size_t Depth = 0;         //< Frames of the stack trace.
+  bool Found = false;
+  bool Cached = false;      //< Taken from the result cache.
+  bool BudgetExhausted = false; //< The search gave up on its budget.
+  bool Retry = false;       //< Searched again with the larger budget.
+  int FalseMatches = 0;     //< Candidates with the wanted hash rejected.
+  uint64_t Nanoseconds = 0;
+  const SearchStats *Search = nullptr;        //< If the search was counted.
+  const PerfCounters::Sample *Perf = nullptr; //< If the counters were read.
+};
+
+// Writes a record per reconstructed stack trace, as JSON lines or CSV, for
+// the analysis of where the search time goes. Fields that were not measured,
+// e.g., the counters of a cached result, are null in JSON and empty in CSV.
+class StatsWriter {
+public:
+  enum class Format { Jsonl, Csv };
+
+private:
+  std::ofstream File;
+  std::ostream *Out;
+  Format Fmt;
+
+public:
+  StatsWriter() : Out(nullptr), Fmt(Format::Jsonl) {}
+
+  // Parse "jsonl" or "csv". Returns false if unknown.
+  static bool ParseFormat(const std::string &Name, Format &F);
+
+  // Open the output, or stdout for "-", and write the header if any.
+  bool Open(const std::string &Path, Format F, std::string &Err);
+
+  // Format the record as a line of the output.
+  std::string FormatRecord(const TraceStatsRecord &R) const;
+
+  // Write formatted lines. Not thread-safe.
+  void Write(const std::string &Lines) { *Out << Lines; }
+
+  // Flush the output. Returns false on a write error.
+  bool Close(std::string &Err);
+};
+
+#endif
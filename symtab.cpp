@@ -0,0 +1,85 @@
+#include "symtab.hpp"
+
+#include <algorithm>
+
+SymbolTable::SymbolTable(const CallGraph &RawCG) {
+  // Functions, sorted by the entry pc.
+  for (const auto &El : RawCG.FuncAddrToName)
+    OwnedFuncPcs.push_back(El.first);
+  std::sort(OwnedFuncPcs.begin(), OwnedFuncPcs.end());
+  for (uint64_t FuncPc : OwnedFuncPcs) {
+    const std::string &Name = RawCG.FuncAddrToName.find(FuncPc)->second;
+    OwnedNameOffsets.push_back(OwnedNames.size());
+    OwnedNames.insert(OwnedNames.end(), Name.begin(), Name.end());
+    OwnedNames.push_back('\0');
+  }
+  OwnedNameOffsets.push_back(OwnedNames.size());
+
+  // Call sites, sorted by the call site pc.
+  for (const auto &El : RawCG.CallSiteToCaller)
+    OwnedCallSitePcs.push_back(El.first);
+  std::sort(OwnedCallSitePcs.begin(), OwnedCallSitePcs.end());
+  for (uint64_t CallSitePc : OwnedCallSitePcs)
+    OwnedCallerPcs.push_back(RawCG.CallSiteToCaller.find(CallSitePc)->second);
+
+  FuncPcs = OwnedFuncPcs;
+  NameOffsets = OwnedNameOffsets;
+  Names = OwnedNames;
+  CallSitePcs = OwnedCallSitePcs;
+  CallerPcs = OwnedCallerPcs;
+
+  // Functions sorted by the name. Functions sharing a name are kept in entry
+  // pc order, and the first one is found by name.
+  for (uint32_t F = 0; F < FuncPcs.size(); F++)
+    OwnedFuncsByName.push_back(F);
+  std::stable_sort(OwnedFuncsByName.begin(), OwnedFuncsByName.end(),
+                   [&](uint32_t A, uint32_t B) {
+                     return NameAt(A) < NameAt(B);
+                   });
+  FuncsByName = OwnedFuncsByName;
+}
+
+SymbolTable::SymbolTable(ArrayRef<uint64_t> FuncPcs,
+                         ArrayRef<uint32_t> NameOffsets, ArrayRef<char> Names,
+                         ArrayRef<uint32_t> FuncsByName,
+                         ArrayRef<uint64_t> CallSitePcs,
+                         ArrayRef<uint64_t> CallerPcs)
+  : FuncPcs(FuncPcs), NameOffsets(NameOffsets), Names(Names),
+    FuncsByName(FuncsByName), CallSitePcs(CallSitePcs),
+    CallerPcs(CallerPcs) {}
+
+bool SymbolTable::CallerOf(uint64_t CallSitePc, uint64_t &CallerPc) const {
+  auto It = std::lower_bound(CallSitePcs.begin(), CallSitePcs.end(),
+                             CallSitePc);
+  if (It == CallSitePcs.end() || *It != CallSitePc)
+    return false;
+  CallerPc = CallerPcs[It - CallSitePcs.begin()];
+  return true;
+}
+
+bool SymbolTable::NameOf(uint64_t FuncPc, std::string_view &Name) const {
+  auto It = std::lower_bound(FuncPcs.begin(), FuncPcs.end(), FuncPc);
+  if (It == FuncPcs.end() || *It != FuncPc)
+    return false;
+  Name = NameAt(It - FuncPcs.begin());
+  return true;
+}
+
+bool SymbolTable::PcOf(std::string_view Name, uint64_t &FuncPc) const {
+  auto It = std::lower_bound(FuncsByName.begin(), FuncsByName.end(), Name,
+                             [&](uint32_t F, std::string_view N) {
+                               return NameAt(F) < N;
+                             });
+  if (It == FuncsByName.end() || NameAt(*It) != Name)
+    return false;
+  FuncPc = FuncPcs[*It];
+  return true;
+}
+
+size_t SymbolTable::ArrayBytes() const {
+  return FuncPcs.size() * sizeof(uint64_t) +
+         NameOffsets.size() * sizeof(uint32_t) + Names.size() +
+         FuncsByName.size() * sizeof(uint32_t) +
+         CallSitePcs.size() * sizeof(uint64_t) +
+         CallerPcs.size() * sizeof(uint64_t);
+}
@@ -0,0 +1,62 @@
+#ifndef __SYMBOL_TABLE_H__
+#define __SYMBOL_TABLE_H__
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "array_ref.hpp"
+#include "cg.hpp"
+
+// The lookups that reading and printing the stack traces need from the call
+// graph: the function containing a call site, and the function names.
+//
+// Everything is kept in sorted arrays searched with binary search. Like
+// CsrReverseCallGraph, the arrays are either owned when the table is built
+// from a CallGraph, or point into a mapped snapshot file.
+struct SymbolTable {
+  ArrayRef<uint64_t> FuncPcs;     //< Function entry pcs, sorted.
+  ArrayRef<uint32_t> NameOffsets; //< Per function, plus the end, into Names.
+  ArrayRef<char> Names;           //< Function names, each ending with '\0'.
+  ArrayRef<uint32_t> FuncsByName; //< Function indices, sorted by name.
+  ArrayRef<uint64_t> CallSitePcs; //< Call site pcs, sorted.
+  ArrayRef<uint64_t> CallerPcs;   //< Entry pc of the caller per call site.
+
+  SymbolTable(const CallGraph &RawCG);
+
+  // View arrays owned elsewhere.
+  SymbolTable(ArrayRef<uint64_t> FuncPcs, ArrayRef<uint32_t> NameOffsets,
+              ArrayRef<char> Names, ArrayRef<uint32_t> FuncsByName,
+              ArrayRef<uint64_t> CallSitePcs, ArrayRef<uint64_t> CallerPcs);
+
+  // The arrays may point into the owned vectors.
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable &operator=(const SymbolTable&) = delete;
+
+  // Get the entry pc of the function containing the call site.
+  bool CallerOf(uint64_t CallSitePc, uint64_t &CallerPc) const;
+
+  // Get the name of the function.
+  bool NameOf(uint64_t FuncPc, std::string_view &Name) const;
+
+  // Get the entry pc of the function with the name.
+  bool PcOf(std::string_view Name, uint64_t &FuncPc) const;
+
+  // Bytes used by the arrays.
+  size_t ArrayBytes() const;
+
+private:
+  std::string_view NameAt(uint32_t Func) const {
+    return std::string_view(Names.begin() + NameOffsets[Func],
+                            NameOffsets[Func + 1] - NameOffsets[Func] - 1);
+  }
+
+  std::vector<uint64_t> OwnedFuncPcs;
+  std::vector<uint32_t> OwnedNameOffsets;
+  std::vector<char> OwnedNames;
+  std::vector<uint32_t> OwnedFuncsByName;
+  std::vector<uint64_t> OwnedCallSitePcs;
+  std::vector<uint64_t> OwnedCallerPcs;
+};
+
+#endif
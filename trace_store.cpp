@@ -0,0 +1,177 @@
+#include "trace_store.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+const char Magic[8] = {'S', 'T', 'T', 'R', 'A', 'C', 'E', 'S'};
+
+// The header is followed by NumEntries entries, and NumRecords records.
+struct Header {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Kind;
+  uint64_t MaxDepth;
+  uint64_t PruningDepth1;
+  uint64_t PruningDepth2;
+  uint64_t NumEntries;
+  uint64_t NumRecords;
+};
+
+} // namespace
+
+bool TraceStore::IsTraceStore(const std::string &Path) {
+  std::ifstream In(Path, std::ios::binary);
+  char Buf[sizeof(Magic)];
+  return In.read(Buf, sizeof(Buf)) && !memcmp(Buf, Magic, sizeof(Magic));
+}
+
+bool TraceStore::Load(const std::string &Path, std::string &Err) {
+  if (!File.Open(Path, Err))
+    return false;
+
+  Header H;
+  if (File.size() < sizeof(H)) {
+    Err = Path + " is too small to be a trace store";
+    return false;
+  }
+  memcpy(&H, File.data(), sizeof(H));
+  if (memcmp(H.Magic, Magic, sizeof(Magic))) {
+    Err = Path + " is not a trace store";
+    return false;
+  }
+  if (H.Version != Version) {
+    Err = Path + " is a trace store of version " + std::to_string(H.Version) +
+          ", expected version " + std::to_string(Version);
+    return false;
+  }
+  size_t Left = File.size() - sizeof(H);
+  if (H.Kind > (uint32_t)HashKind::MulXorShift ||
+      H.NumEntries > Left / sizeof(Entry) ||
+      H.NumRecords > Left / sizeof(Record) ||
+      Left != H.NumEntries * sizeof(Entry) + H.NumRecords * sizeof(Record)) {
+    Err = Path + " is a corrupted trace store";
+    return false;
+  }
+  MaxDepth = H.MaxDepth;
+  PruningDepth1 = H.PruningDepth1;
+  PruningDepth2 = H.PruningDepth2;
+  Kind = (HashKind)H.Kind;
+  const char *Data = File.data() + sizeof(H);
+  EntryArray = ArrayRef<Entry>((const Entry*)Data, H.NumEntries);
+  RecordArray = ArrayRef<Record>(
+    (const Record*)(Data + H.NumEntries * sizeof(Entry)), H.NumRecords);
+
+  // Check the ranges that Records() relies on.
+  uint64_t Next = 0;
+  for (const Entry &E : EntryArray) {
+    if (E.FirstRecord != Next || E.NumRecords > H.NumRecords - Next) {
+      Err = Path + " is a corrupted trace store";
+      return false;
+    }
+    Next += E.NumRecords;
+  }
+  return true;
+}
+
+SearchParams TraceStore::Params() const {
+  return SearchParams(MaxDepth, PruningDepth1, PruningDepth2, Kind);
+}
+
+bool TraceStore::CheckParams(const SearchParams &P, std::string &Err) const {
+  if (MaxDepth == P.MaxDepth && PruningDepth1 == P.PruningDepth1 &&
+      PruningDepth2 == P.PruningDepth2 && Kind == P.Kind)
+    return true;
+  Err = "the trace store was compressed with the depths " +
+        std::to_string(MaxDepth) + " " + std::to_string(PruningDepth1) + " " +
+        std::to_string(PruningDepth2) + " and the hash " + HashKindName(Kind);
+  return false;
+}
+
+uint64_t TraceStore::NumOccurrences() const {
+  uint64_t Res = 0;
+  for (const Record &R : RecordArray)
+    Res += R.Count;
+  return Res;
+}
+
+bool TraceStoreBuilder::Add(uint64_t EntryPc, const CompressedTrace &CT,
+                            uint64_t Count) {
+  Key K;
+  K.EntryPc = EntryPc;
+  CT.Pack(K.Words);
+  auto It = Counts.emplace(K, 0).first;
+  bool New = It->second == 0;
+  It->second += Count;
+  return New;
+}
+
+bool TraceStoreBuilder::Add(const TraceStore &Store, std::string &Err) {
+  if (!Store.CheckParams(P, Err))
+    return false;
+  for (const TraceStore::Entry &E : Store.Entries())
+    for (const TraceStore::Record &R : Store.Records(E)) {
+      Key K = {E.EntryPc, {R.Words[0], R.Words[1]}};
+      Counts[K] += R.Count;
+    }
+  return true;
+}
+
+bool TraceStoreBuilder::Write(const std::string &Path,
+                              std::string &Err) const {
+  // Records are grouped by the entry function, and sorted by the hash within.
+  std::vector<std::pair<Key, uint64_t>> Sorted(Counts.begin(), Counts.end());
+  std::sort(Sorted.begin(), Sorted.end(), [](const auto &A, const auto &B) {
+    const Key &X = A.first, &Y = B.first;
+    if (X.EntryPc != Y.EntryPc)
+      return X.EntryPc < Y.EntryPc;
+    if (X.Words[0] != Y.Words[0])
+      return X.Words[0] < Y.Words[0];
+    return X.Words[1] < Y.Words[1];
+  });
+  std::vector<TraceStore::Entry> Entries;
+  std::vector<TraceStore::Record> Records;
+  Records.reserve(Sorted.size());
+  for (const auto &El : Sorted) {
+    if (Entries.empty() || Entries.back().EntryPc != El.first.EntryPc)
+      Entries.push_back({El.first.EntryPc, Records.size(), 0});
+    Entries.back().NumRecords++;
+    Records.push_back({{El.first.Words[0], El.first.Words[1]}, El.second});
+  }
+
+  Header H;
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = TraceStore::Version;
+  H.Kind = (uint32_t)P.Kind;
+  H.MaxDepth = P.MaxDepth;
+  H.PruningDepth1 = P.PruningDepth1;
+  H.PruningDepth2 = P.PruningDepth2;
+  H.NumEntries = Entries.size();
+  H.NumRecords = Records.size();
+
+  // Written aside and renamed over the old store.
+  std::string TmpPath = Path + ".tmp";
+  {
+    std::ofstream Out(TmpPath, std::ios::binary | std::ios::trunc);
+    Out.write((const char*)&H, sizeof(H));
+    Out.write((const char*)Entries.data(),
+              Entries.size() * sizeof(TraceStore::Entry));
+    Out.write((const char*)Records.data(),
+              Records.size() * sizeof(TraceStore::Record));
+    if (!Out.flush()) {
+      Err = "cannot write " + TmpPath + ": " + strerror(errno);
+      return false;
+    }
+  }
+  if (rename(TmpPath.c_str(), Path.c_str())) {
+    Err = "cannot rename " + TmpPath + " to " + Path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,116 @@
+#ifndef __TRACE_STORE_H__
+#define __TRACE_STORE_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "array_ref.hpp"
+#include "mapped_file.hpp"
+#include "search.hpp"
+
+// Binary store of compressed stack traces, the persistent form of the ASan
+// output. Only the compressed form of each stack trace is kept, and each
+// distinct one once, with the number of times it occurred. Hence the store
+// is a fraction of the text dumps, and decoding it searches each distinct
+// stack trace once.
+//
+// The file is a fixed header with the search parameters, the index of the
+// entry functions sorted by the entry pc, and the records of all entry
+// functions. An index entry is the range of the records of its entry
+// function, which are reconstructed together, and a record is the packed
+// compressed form and the count. All in host byte order. Like a snapshot,
+// the file is used as mapped.
+class TraceStore {
+public:
+  // Incremented on any change to the layout.
+  static const uint32_t Version = 1;
+
+  struct Entry {
+    uint64_t EntryPc;     //< Entry pc of the entry function.
+    uint64_t FirstRecord; //< Index of its first record.
+    uint64_t NumRecords;
+  };
+
+  struct Record {
+    uint64_t Words[2]; //< CompressedTrace::Pack of the stack trace.
+    uint64_t Count;    //< Occurrences of the stack trace.
+
+    // Returns false if the record is not valid.
+    bool Unpack(CompressedTrace &CT) const {
+      return CompressedTrace::Unpack(Words, 2, CT);
+    }
+  };
+
+  // Whether the file starts with the store magic.
+  static bool IsTraceStore(const std::string &Path);
+
+  // Map the store at Path. Returns false and sets Err on failure.
+  bool Load(const std::string &Path, std::string &Err);
+
+  // Parameters the stack traces were compressed with.
+  SearchParams Params() const;
+
+  // Returns false and sets Err if the parameters differ from P.
+  bool CheckParams(const SearchParams &P, std::string &Err) const;
+
+  ArrayRef<Entry> Entries() const { return EntryArray; }
+  ArrayRef<Record> Records(const Entry &E) const {
+    return ArrayRef<Record>(RecordArray.begin() + E.FirstRecord,
+                            E.NumRecords);
+  }
+  size_t NumRecords() const { return RecordArray.size(); }
+  uint64_t NumOccurrences() const;
+
+private:
+  MappedFile File;
+  uint64_t MaxDepth = 0;
+  uint64_t PruningDepth1 = 0;
+  uint64_t PruningDepth2 = 0;
+  HashKind Kind = DefaultHashKind;
+  ArrayRef<Entry> EntryArray;
+  ArrayRef<Record> RecordArray;
+};
+
+// Collects the compressed stack traces to store, deduplicating them as they
+// are added. Adding to an existing store merges it first, and writes the
+// union back: records are only added, and their counts only grow.
+class TraceStoreBuilder {
+public:
+  explicit TraceStoreBuilder(const SearchParams &P) : P(P) {}
+
+  // Add an occurrence of the stack trace. Returns whether it is new.
+  bool Add(uint64_t EntryPc, const CompressedTrace &CT, uint64_t Count = 1);
+
+  // Add all records of the store. Returns false and sets Err if it was
+  // compressed with other parameters.
+  bool Add(const TraceStore &Store, std::string &Err);
+
+  // Write the store to Path, replacing it at once so that readers mapping
+  // the old file are not affected. Returns false and sets Err on failure.
+  bool Write(const std::string &Path, std::string &Err) const;
+
+  size_t size() const { return Counts.size(); }
+
+private:
+  struct Key {
+    uint64_t EntryPc;
+    uint64_t Words[2];
+
+    bool operator==(const Key &Other) const {
+      return EntryPc == Other.EntryPc && Words[0] == Other.Words[0] &&
+             Words[1] == Other.Words[1];
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &K) const {
+      // The stack trace hash is already well mixed.
+      return K.Words[0] ^ (K.EntryPc * 0x9e3779b97f4a7c15ull) ^ K.Words[1];
+    }
+  };
+
+  const SearchParams &P;
+  std::unordered_map<Key, uint64_t, KeyHash> Counts;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "trace_stream.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+void TraceStats::PrintWarnings() const {
+  if (CountClipped)
+    fprintf(stderr, "WARNING: %d stack traces were clipped as they exceeded "
+                    "the depth limit.\n", CountClipped);
+  if (CountCouldntFind)
+    fprintf(stderr, "WARNING: %d stack traces were ignored since they included filtered frames.\n",
+                                                      CountCouldntFind);
+}
+
+bool ParseStackTraceLine(TextCursor Line, const SymbolTable &Symbols,
+                         const SearchParams &P, TraceRecord &R,
+                         TraceStats &Stats) {
+  std::string_view FirstWord;
+  if (!Line.ReadWord(FirstWord) || FirstWord != "ST:")
+    return false;
+  R.Index = Stats.NumTraces++;
+  R.FuncName = std::string_view();
+  R.EntryPc = 0;
+  R.ST.clear();
+  size_t CurrentDepth = 0;
+  uint64_t PC;
+  while (Line.ReadHex(PC)) {
+    uint64_t Caller;
+    if (!Symbols.CallerOf(PC, Caller)) {
+      Stats.CountCouldntFind++;
+      break;
+    }
+
+    // Get the entry point
+    if (CurrentDepth == 0) {
+      CurrentDepth++;
+      if (!Symbols.NameOf(Caller, R.FuncName)) {
+        fprintf(stderr, "WARNING: Failed to find func name for caller at %p.\n",
+                        (void*)Caller);
+        break;
+      }
+      R.EntryPc = Caller;
+      continue;
+    }
+    R.ST.push_back(PC);
+    if (CurrentDepth++ == P.MaxDepth) {
+      Stats.CountClipped++;
+      break;
+    }
+  }
+  return true;
+}
+
+TraceStream::TraceStream(int Fd, const SymbolTable &Symbols,
+                         const SearchParams &P, bool HashOnly,
+                         size_t BatchSize, size_t QueueDepth)
+  : Fd(Fd), Symbols(Symbols), P(P), HashOnly(HashOnly),
+    BatchSize(BatchSize ? BatchSize : 1), Parsed(QueueDepth),
+    Compressed(QueueDepth), ParseThread(&TraceStream::ParseStage, this),
+    CompressThread(&TraceStream::CompressStage, this) {}
+
+TraceStream::~TraceStream() {
+  // Unblock the stages if the caller stopped before the end of the input.
+  // The parse stage may still be waiting for more input from a pipe.
+  Parsed.Close();
+  Compressed.Close();
+  ParseThread.join();
+  CompressThread.join();
+}
+
+int TraceStream::OpenInput(const std::string &Path, std::string &Err) {
+  if (Path == "-")
+    return STDIN_FILENO;
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0)
+    Err = "cannot open " + Path + ": " + strerror(errno);
+  return Fd;
+}
+
+bool TraceStream::Next(TraceBatch &Batch) {
+  return Compressed.Pop(Batch);
+}
+
+// Read the input in chunks, and parse the complete lines of each chunk. The
+// incomplete last line is moved to the front of the buffer to be completed
+// by the next read.
+void TraceStream::ParseStage() {
+  static const size_t ChunkSize = 1 << 20;
+  std::vector<char> Buf(ChunkSize);
+  size_t Filled = 0;
+  TraceBatch Batch;
+  Batch.reserve(BatchSize);
+  bool Stopped = false;
+  while (!Stopped) {
+    // Grow the buffer for the lines longer than it.
+    if (Filled == Buf.size())
+      Buf.resize(Buf.size() * 2);
+    ssize_t N = read(Fd, Buf.data() + Filled, Buf.size() - Filled);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      ReadError = std::string("cannot read the stack traces: ") +
+                  strerror(errno);
+      break;
+    }
+    bool AtEof = N == 0;
+    Filled += N;
+    ParseStats.NumBytes += N;
+
+    // The last line is complete only at the end of the input.
+    const char *Begin = Buf.data();
+    const char *End = Begin + Filled;
+    const char *LinesEnd = End;
+    if (!AtEof) {
+      const char *LastEol = (const char*)memrchr(Begin, '\n', Filled);
+      LinesEnd = LastEol ? LastEol + 1 : Begin;
+    }
+
+    TextCursor In(Begin, LinesEnd), Line(In);
+    while (!Stopped && In.NextLine(Line)) {
+      Batch.emplace_back();
+      if (!ParseStackTraceLine(Line, Symbols, P, Batch.back(), ParseStats)) {
+        Batch.pop_back();
+        continue;
+      }
+      if (Batch.size() == BatchSize) {
+        Stopped = !Parsed.Push(std::move(Batch));
+        Batch = TraceBatch();
+        Batch.reserve(BatchSize);
+      }
+    }
+    memmove(Buf.data(), LinesEnd, End - LinesEnd);
+    Filled = End - LinesEnd;
+
+    // Hand over what is parsed so far rather than waiting for a full batch,
+    // which may take long on a live input.
+    if (!Batch.empty() && !Stopped) {
+      Stopped = !Parsed.Push(std::move(Batch));
+      Batch = TraceBatch();
+      Batch.reserve(BatchSize);
+    }
+    if (AtEof)
+      break;
+  }
+  if (Fd != STDIN_FILENO)
+    close(Fd);
+  Parsed.Close();
+}
+
+void TraceStream::CompressStage() {
+  TraceBatch Batch;
+  while (Parsed.Pop(Batch)) {
+    for (TraceRecord &R : Batch) {
+      if (HashOnly) {
+        R.Compressed = CompressedTrace();
+        R.Compressed.Hash = Hash(R.ST, P);
+      } else {
+        R.Compressed = Compress(R.ST, P);
+      }
+    }
+    if (!Compressed.Push(std::move(Batch)))
+      break;
+    Batch = TraceBatch();
+  }
+  Compressed.Close();
+}
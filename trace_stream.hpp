@@ -0,0 +1,106 @@
+#ifndef __TRACE_STREAM_H__
+#define __TRACE_STREAM_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "scan.hpp"
+#include "search.hpp"
+#include "symtab.hpp"
+
+// A stack trace read from the ASan output. The first frame is eliminated and
+// used as the entry point.
+struct TraceRecord {
+  std::string_view FuncName;  //< Name of the entry function. Views into the
+                              //< symbol table, which outlives the record.
+  uint64_t EntryPc;           //< Entry pc of the entry function, 0 if not
+                              //< found. Names are not unique across modules.
+  CompressedTrace Compressed; //< Compressed ST.
+  StackTrace ST;              //< Frames following the entry point.
+  size_t Index;               //< Position among the stack traces of the
+                              //< input, counting the ignored ones.
+};
+
+typedef std::vector<TraceRecord> TraceBatch;
+
+// Counts of the stack traces read so far, and of the ones with issues.
+struct TraceStats {
+  size_t NumTraces = 0;
+  size_t NumBytes = 0;        //< Bytes of input read.
+  int CountClipped = 0;       //< Exceeded the depth limit.
+  int CountCouldntFind = 0;   //< Included filtered frames.
+
+  // Print a warning for each kind of issue seen.
+  void PrintWarnings() const;
+};
+
+// Parse a line of the ASan output into R, except for the compressed form.
+// Returns whether the line holds a stack trace.
+bool ParseStackTraceLine(TextCursor Line, const SymbolTable &Symbols,
+                         const SearchParams &P, TraceRecord &R,
+                         TraceStats &Stats);
+
+// Reads the stack traces from the ASan output as a pipeline:
+//
+//   read & parse --> compress --> Next()
+//
+// The first two stages run on their own threads, and bounded queues of
+// batches connect the stages. Hence memory stays constant regardless of the
+// input size, and the caller can start reconstructing the first batch while
+// the rest is still being read. The input can be a pipe, e.g., the live
+// stderr of an instrumented program, in which case a batch is handed over as
+// soon as the lines read so far are parsed.
+class TraceStream {
+public:
+  static const size_t DefaultBatchSize = 1024; //< Traces per batch.
+  static const size_t DefaultQueueDepth = 4;   //< Batches per queue.
+
+  // Starts reading from Fd, which is closed at the end unless it is stdin.
+  // The stack traces are compressed in the latest version, or as the bare
+  // hash if HashOnly.
+  TraceStream(int Fd, const SymbolTable &Symbols, const SearchParams &P,
+              bool HashOnly = false,
+              size_t BatchSize = DefaultBatchSize,
+              size_t QueueDepth = DefaultQueueDepth);
+
+  // Stops the stages and joins their threads.
+  ~TraceStream();
+
+  TraceStream(const TraceStream&) = delete;
+  TraceStream &operator=(const TraceStream&) = delete;
+
+  // Open the file, or stdin for "-". Returns -1 and sets Err on failure.
+  static int OpenInput(const std::string &Path, std::string &Err);
+
+  // Get the next batch of compressed stack traces, in the input order.
+  // Returns false at the end of the input.
+  bool Next(TraceBatch &Batch);
+
+  // Statistics of the whole input. Only complete once Next returned false.
+  const TraceStats &Stats() const { return ParseStats; }
+
+  // Whether reading the input failed. Only complete once Next returned false.
+  const std::string &Error() const { return ReadError; }
+
+private:
+  int Fd;
+  const SymbolTable &Symbols;
+  const SearchParams &P;
+  bool HashOnly;
+  size_t BatchSize;
+  TraceStats ParseStats; //< Written by the parse stage only.
+  std::string ReadError; //< Written by the parse stage only.
+  BoundedQueue<TraceBatch> Parsed;
+  BoundedQueue<TraceBatch> Compressed;
+  std::thread ParseThread;
+  std::thread CompressThread;
+
+  void ParseStage();
+  void CompressStage();
+};
+
+#endif